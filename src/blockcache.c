@@ -0,0 +1,124 @@
+#include "headers/blockcache.h"
+#include "headers/instructions.h"
+#include "string.h"
+
+void block_cache_init(BlockCache *bc, MemoryMap *m) {
+    memset(bc, 0, sizeof(BlockCache));
+    bc->memmap     = m;
+    m->block_cache = bc;
+}
+
+void block_cache_flush(BlockCache *bc) {
+    for (uint i = 0; i < BLOCK_CACHE_SIZE; i++) {
+        if (bc->blocks[i].writable) {
+            bc->blocks[i].valid = false;
+        }
+    }
+    memset(bc->code_pages, 0, sizeof(bc->code_pages));
+    mem_hook_pages(bc->memmap, 0, 0xFF);
+}
+
+void block_cache_invalidate(BlockCache *bc, memaddr lo, memaddr hi) {
+    for (uint i = 0; i < BLOCK_CACHE_SIZE; i++) {
+        CachedBlock *b     = bc->blocks + i;
+        bool         wraps = b->end < b->pc; // past $FFFF
+        if (wraps ? b->pc <= hi || b->end >= lo : b->pc <= hi && b->end >= lo) {
+            b->valid = false;
+        }
+    }
+}
+
+bool block_cache_is_valid(BlockCache *bc, const CachedBlock *b) {
+    return !b->writable
+        || (bc->page_versions[b->pc >> 8] == b->versions[0]
+            && bc->page_versions[b->end >> 8] == b->versions[1]);
+}
+
+void block_cache_write(BlockCache *bc, memaddr addr) {
+    if (bc->code_pages[addr >> 8]) {
+        bc->page_versions[addr >> 8]++;
+    }
+}
+
+// Through the page table, as looking the block up costs a scan. A split page
+// is looked up address by address, like mem_write_addr does.
+bool _block_cache_writable(MemoryMap *m, memaddr addr) {
+    const MemoryPage *p = m->write_mapped + (addr >> 8);
+    return p->base || (p->handler == MEM_PAGE_SCAN && mem_get_write_block(m, addr));
+}
+
+// A code byte without side effects: through the page table as mapped, which
+// skips the debugger's watchpoints, or else looked up among the blocks, so I/O
+// isn't read for bytes that may never run.
+u8 _block_cache_peek(MemoryMap *m, memaddr addr) {
+    const MemoryPage *p = m->read_mapped + (addr >> 8);
+    if (p->base) {
+        return p->base[addr];
+    }
+    MemoryBlock *b = mem_get_read_block(m, addr);
+    return b ? b->values[addr - b->range_low] : 0;
+}
+
+void _block_cache_decode(BlockCache *bc, CachedBlock *b, memaddr pc) {
+    b->pc             = pc;
+    b->valid          = true;
+    b->writable       = false;
+    b->n_instructions = 0;
+    b->native         = NULL;
+    b->runs           = 0;
+
+    memaddr addr = pc;
+    bool    done = false;
+    while (!done && b->n_instructions < BLOCK_MAX_INSTRUCTIONS) {
+        CachedInstruction        *inst = &b->instructions[b->n_instructions++];
+        const DecodedInstruction *d;
+
+        inst->opcode  = _block_cache_peek(bc->memmap, addr);
+        inst->operand = 0;
+        d             = &DECODED_INSTRUCTIONS[inst->opcode];
+
+        for (u8 i = 0; i < d->size; i++) {
+            memaddr byte_addr = addr + i;
+            if (i > 0) {
+                inst->operand |= _block_cache_peek(bc->memmap, byte_addr) << (8 * (i - 1));
+            }
+            if (_block_cache_writable(bc->memmap, byte_addr)) {
+                b->writable = true;
+                if (!bc->code_pages[byte_addr >> 8]) {
+                    bc->code_pages[byte_addr >> 8] = true;
+                    mem_hook_pages(bc->memmap, byte_addr >> 8, byte_addr >> 8);
+                }
+            }
+        }
+        addr += d->size;
+
+        switch (d->access) {
+            case CLASS_BRANCH:
+            case CLASS_JMP:
+            case CLASS_JSR:
+            case CLASS_RTS:
+            case CLASS_RTI:
+            case CLASS_BRK:
+                done = true;
+                break;
+            default:
+                break;
+        }
+    }
+
+    b->end         = addr - 1;
+    b->versions[0] = bc->page_versions[b->pc >> 8];
+    b->versions[1] = bc->page_versions[b->end >> 8];
+}
+
+CachedBlock *block_cache_get(BlockCache *bc, memaddr pc) {
+    CachedBlock *b = &bc->blocks[pc & (BLOCK_CACHE_SIZE - 1)];
+    if (b->valid && b->pc == pc && block_cache_is_valid(bc, b)) {
+        bc->hits++;
+        return b;
+    }
+
+    bc->misses++;
+    _block_cache_decode(bc, b, pc);
+    return b;
+}
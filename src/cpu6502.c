@@ -1,44 +1,439 @@
 #include "headers/cpu6502.h"
+#include "headers/guestprofile.h"
+#include "headers/instructions.h"
+#include "string.h"
 
 void _cpu_update_NZ_flags(Cpu6502 *c, u8 val) {
-    setunsetflag(c->p, STAT_N_NEGATIVE, val & 0x80);
-    setunsetflag(c->p, STAT_Z_ZERO, val == 0x00);
-}
-
-void compare(Cpu6502 *c, u8 reg) {
-    _cpu_update_NZ_flags(c, reg - c->data_bus);
-    setunsetflag(c->p, STAT_C_CARRY, reg >= c->data_bus);
-}
-
-void *_cpu_fetch_opcode(Cpu6502 *c);
-void *_cpu_fetch_opcode_add1(Cpu6502 *c);
-void *_cpu_fetch_opcode_add2(Cpu6502 *c);
-void *_cpu_fetch_lo(Cpu6502 *c);
-void *_cpu_fetch_hi(Cpu6502 *c);
-void *_cpu_read_addr(Cpu6502 *c);
-void *_cpu_page_boundary(Cpu6502 *c);
-void *_cpu_read_addr_ind(Cpu6502 *c);
-void *_cpu_push(Cpu6502 *c);
-void *_cpu_pop(Cpu6502 *c);
-void *_cpu_write_then_fetch_add3(Cpu6502 *c);
-void *_cpu_write_brk_write_pclo(Cpu6502 *c);
-void *_cpu_write_brk_write_sr(Cpu6502 *c);
-void *_cpu_write_brk_read_pclo(Cpu6502 *c);
-void *_cpu_read_brk_read_pchi(Cpu6502 *c);
-void *_cpu_read_brk_fetch(Cpu6502 *c);
-void *_cpu_read_rti_read_pclo(Cpu6502 *c);
-void *_cpu_read_rti_read_pchi(Cpu6502 *c);
-void *_cpu_read_rti_fetch(Cpu6502 *c);
-void *_cpu_read_rts_read_pchi(Cpu6502 *c);
-void *_cpu_read_rts_fetch(Cpu6502 *c);
-void *_cpu_read_zpg(Cpu6502 *c);
-void *_cpu_write_zpg_fetch(Cpu6502 *c);
-void *_cpu_write_jsr_write_pclo(Cpu6502 *c);
-void *_cpu_write_jsr_missing_extra_cycle(Cpu6502 *c);
-void *_cpu_write_jsr_fetch(Cpu6502 *c);
-void *_cpu_read_ind_read_addrhi(Cpu6502 *c);
-void *_cpu_read_ind_read_val(Cpu6502 *c);
-void *_cpu_rel_addr_inc(Cpu6502 *c);
+    c->nz = NZ_LAZY | val;
+}
+
+u8 cpu_get_p(Cpu6502 *c) {
+    return cpu_p_of(c->p, c->nz);
+}
+
+void cpu_set_p(Cpu6502 *c, u8 p) {
+    c->p  = p;
+    c->nz = 0;
+}
+
+// N from bit 7 of val, Z from val & a
+void _cpu_bit(Cpu6502 *c, u8 val) {
+    c->p  = (c->p & ~STAT_V_OVERFLOW) | (val & STAT_V_OVERFLOW);
+    c->nz = NZ_LAZY | (val & c->a) | ((val & 0x80) << 8);
+}
+
+void compare(Cpu6502 *c, u8 reg, u8 val) {
+    _cpu_update_NZ_flags(c, reg - val);
+    setunsetflag(c->p, STAT_C_CARRY, reg >= val);
+}
+
+// binary SBC is ADC of the inverted operand
+void _cpu_adc_binary(Cpu6502 *c, u8 val) {
+    u16 sum = (u16)c->a + (u16)val + (u16)((c->p & STAT_C_CARRY) == STAT_C_CARRY);
+    setunsetflag(c->p, STAT_C_CARRY, sum > 0xFF);
+    setunsetflag(c->p, STAT_V_OVERFLOW, (~(c->a ^ val)) & (c->a ^ sum) & 0x80);
+    c->a = sum & 0xFF;
+    _cpu_update_NZ_flags(c, c->a);
+}
+
+#if CPU_HAS_DECIMAL
+// BCD as worked out in Bruce Clark's "Decimal Mode" tutorial. The NMOS 6502
+// takes N and V from the sum before its high digit is adjusted and Z from the
+// binary sum; the 65C02 sets N and Z from the result.
+void _cpu_adc_decimal(Cpu6502 *c, u8 val) {
+    u8  a  = c->a;
+    u8  p  = cpu_get_p(c);
+    int lo = (a & 0x0F) + (val & 0x0F) + (p & STAT_C_CARRY);
+    if (lo >= 0x0A) {
+        lo = ((lo + 0x06) & 0x0F) + 0x10;
+    }
+    int sum = (a & 0xF0) + (val & 0xF0) + lo;
+
+    setunsetflag(p, STAT_Z_ZERO, ((a + val + (p & STAT_C_CARRY)) & 0xFF) == 0);
+    setunsetflag(p, STAT_N_NEGATIVE, sum & 0x80);
+    setunsetflag(p, STAT_V_OVERFLOW, (~(a ^ val)) & (a ^ sum) & 0x80);
+    if (sum >= 0xA0) {
+        sum += 0x60;
+    }
+    setunsetflag(p, STAT_C_CARRY, sum > 0xFF);
+    cpu_set_p(c, p);
+    c->a = sum & 0xFF;
+#if CPU_VARIANT == CPU_VARIANT_65C02
+    _cpu_update_NZ_flags(c, c->a);
+#endif
+}
+
+// The flags are the binary subtraction's, bar N and Z on the 65C02.
+void _cpu_sbc_decimal(Cpu6502 *c, u8 val) {
+    u8  a      = c->a;
+    int borrow = (c->p & STAT_C_CARRY) == 0;
+    int lo     = (a & 0x0F) - (val & 0x0F) - borrow;
+#if CPU_VARIANT == CPU_VARIANT_65C02
+    int diff = a - val - borrow;
+    if (diff < 0) {
+        diff -= 0x60;
+    }
+    if (lo < 0) {
+        diff -= 0x06;
+    }
+#else
+    if (lo < 0) {
+        lo = ((lo - 0x06) & 0x0F) - 0x10;
+    }
+    int diff = (a & 0xF0) - (val & 0xF0) + lo;
+    if (diff < 0) {
+        diff -= 0x60;
+    }
+#endif
+    _cpu_adc_binary(c, ~val);
+    c->a = diff & 0xFF;
+#if CPU_VARIANT == CPU_VARIANT_65C02
+    _cpu_update_NZ_flags(c, c->a);
+#endif
+}
+#endif
+
+// The 2A03 has no decimal mode, so there it's binary whatever D says.
+void _cpu_adc(Cpu6502 *c, u8 val) {
+#if CPU_HAS_DECIMAL
+    if (c->p & STAT_D_DECIMAL) {
+        _cpu_adc_decimal(c, val);
+        return;
+    }
+#endif
+    _cpu_adc_binary(c, val);
+}
+
+void _cpu_sbc(Cpu6502 *c, u8 val) {
+#if CPU_HAS_DECIMAL
+    if (c->p & STAT_D_DECIMAL) {
+        _cpu_sbc_decimal(c, val);
+        return;
+    }
+#endif
+    _cpu_adc_binary(c, ~val);
+}
+
+// PLP/RTI: B and bit 5 don't exist in the register, so pulling leaves them be
+void _cpu_pull_p(Cpu6502 *c, u8 val) {
+    u8 keep = c->p & (STAT_B_BREAK | STAT___IGNORE);
+    cpu_set_p(c, (val & ~(STAT_B_BREAK | STAT___IGNORE)) | keep);
+}
+
+// instruction length and index register, from the addressing mode
+#define _am_size(am)                                                \
+    ((am) == AM_A || (am) == AM_impl ? 1                            \
+     : ((am) == AM_abs || (am) == AM_absX || (am) == AM_absY        \
+        || (am) == AM_ind || (am) == AM_absXind)                    \
+         ? 3                                                        \
+         : 2)
+#define _am_index(am)                                               \
+    ((am) == AM_absX || (am) == AM_zpgX || (am) == AM_Xind          \
+             || (am) == AM_absXind                                  \
+         ? REG_X                                                    \
+     : ((am) == AM_absY || (am) == AM_zpgY || (am) == AM_indY)     \
+         ? REG_Y                                                    \
+         : REG_NONE)
+
+#define m(_mnemonic, addr, op, cyc) \
+    { .mode = addr, .size = _am_size(addr), .index = _am_index(addr), .cycles = cyc, DECODE_##op }
+
+// Everything the cycle engine needs to know about an opcode, decoded at compile
+// time. Once fetch_opcode has latched ir, decoding is a single index into this.
+const DecodedInstruction DECODED_INSTRUCTIONS[0x100] = {
+    INSTRUCTION_TABLE(m)
+};
+
+#undef m
+
+#define m(mnemonic, _addr, _op, _cyc) mnemonic
+const char *const CPU_MNEMONICS[0x100] = {
+    INSTRUCTION_TABLE(m)
+};
+#undef m
+
+#define decoded(c) (&DECODED_INSTRUCTIONS[(c)->ir])
+
+u8 *_cpu_reg(Cpu6502 *c, CpuRegister r) {
+    switch (r) {
+        case REG_A:
+            return &c->a;
+        case REG_X:
+            return &c->x;
+        case REG_Y:
+            return &c->y;
+        case REG_SP:
+            return &c->sp;
+        case REG_P:
+            return &c->p;
+        case REG_ZERO:
+        {
+            static u8 zero = 0; // only ever read, by STZ
+            return &zero;
+        }
+        default:
+            return NULL;
+    }
+}
+
+// Shifts, rotates, increments and decrements: returns the new value.
+u8 _cpu_modify(Cpu6502 *c, AluOp alu, u8 val) {
+    u8 c0 = c->p & STAT_C_CARRY;
+    switch (alu) {
+        case ALU_ASL:
+            setunsetflag(c->p, STAT_C_CARRY, val & 0x80);
+            val <<= 1;
+            break;
+        case ALU_LSR:
+            setunsetflag(c->p, STAT_C_CARRY, val & 0x01);
+            val >>= 1;
+            break;
+        case ALU_ROL:
+            setunsetflag(c->p, STAT_C_CARRY, val & 0x80);
+            val = (val << 1) | c0;
+            break;
+        case ALU_ROR:
+            setunsetflag(c->p, STAT_C_CARRY, val & 0x01);
+            val = (val >> 1) | (c0 << 7);
+            break;
+        case ALU_INC:
+            val++;
+            break;
+        case ALU_DEC:
+            val--;
+            break;
+        case ALU_TSB:
+        case ALU_TRB:
+        {
+            u8 p = cpu_get_p(c);
+            setunsetflag(p, STAT_Z_ZERO, (val & c->a) == 0);
+            cpu_set_p(c, p);
+            return alu == ALU_TSB ? val | c->a : val & ~c->a;
+        }
+        default:
+            return val;
+    }
+    _cpu_update_NZ_flags(c, val);
+    return val;
+}
+
+// Operations that consume a value: the operand of CLASS_READ, or the source
+// register of a transfer.
+void _cpu_alu(Cpu6502 *c, const DecodedInstruction *d, u8 val) {
+    u8 *reg = _cpu_reg(c, d->reg);
+    switch (d->alu) {
+        case ALU_ORA:
+            *reg |= val;
+            _cpu_update_NZ_flags(c, *reg);
+            break;
+        case ALU_AND:
+            *reg &= val;
+            _cpu_update_NZ_flags(c, *reg);
+            break;
+        case ALU_EOR:
+            *reg ^= val;
+            _cpu_update_NZ_flags(c, *reg);
+            break;
+        case ALU_ADC:
+            _cpu_adc(c, val);
+            break;
+        case ALU_SBC:
+            _cpu_sbc(c, val);
+            break;
+        case ALU_CMP:
+            compare(c, *reg, val);
+            break;
+        case ALU_BIT:
+            _cpu_bit(c, val);
+            break;
+        case ALU_BIT_IMM:
+        {
+            u8 p = cpu_get_p(c);
+            setunsetflag(p, STAT_Z_ZERO, (val & c->a) == 0);
+            cpu_set_p(c, p);
+            break;
+        }
+        case ALU_LD:
+            *reg = val;
+            _cpu_update_NZ_flags(c, *reg);
+            break;
+        case ALU_MOV:
+            *reg = val;
+            break;
+        default:
+            break;
+    }
+}
+
+void _cpu_implied(Cpu6502 *c, const DecodedInstruction *d) {
+    switch (d->alu) {
+        case ALU_NONE:
+            break;
+        case ALU_CLEAR:
+            unsetflag(c->p, d->flag);
+            break;
+        case ALU_SET:
+            setflag(c->p, d->flag);
+            break;
+        case ALU_LD:
+        case ALU_MOV:
+            _cpu_alu(c, d, *_cpu_reg(c, d->src));
+            break;
+        default: // INX, DEY, ...
+            *_cpu_reg(c, d->reg) = _cpu_modify(c, d->alu, *_cpu_reg(c, d->reg));
+            break;
+    }
+}
+
+void cpu_nmi(Cpu6502 *c) {
+    setflag(c->bit_fields, PIN_NMI);
+}
+
+void cpu_set_irq(Cpu6502 *c, bool asserted) {
+    setunsetflag(c->bit_fields, PIN_IRQ, asserted);
+}
+
+// Polled at instruction boundaries
+bool _cpu_interrupt_pending(Cpu6502 *c) {
+    return (c->bit_fields & PIN_NMI) != 0
+        || ((c->bit_fields & PIN_IRQ) != 0 && (c->p & STAT_I_INTERRUPT) == 0);
+}
+
+// Where BRK's sequence returns to: past BRK and its padding byte, or for an
+// interrupt the instruction it was taken in place of.
+memaddr _cpu_brk_return(Cpu6502 *c) {
+    return (c->bit_fields & CPU_IN_INTERRUPT) ? c->pc : c->pc + 2;
+}
+
+// An NMI that's pending by the time the vector is fetched takes over the
+// sequence, whether it started as BRK, IRQ or NMI.
+memaddr _cpu_brk_vector(Cpu6502 *c) {
+    if (c->bit_fields & PIN_NMI) {
+        unsetflag(c->bit_fields, PIN_NMI);
+        return 0xFFFA;
+    }
+    return 0xFFFE;
+}
+
+#ifdef CPU_OPCODE_STATS
+// Folds the instruction in ir, which took `cycles`, into the histogram. Past
+// the base cycles, an indexed read takes 1 for crossing a page and a branch 1
+// for being taken and 1 more for crossing.
+void _cpu_count_opcode(Cpu6502 *c, u64 cycles) {
+    CpuOpcodeStats *s = &c->opcode_stats;
+    s->boundary_cyc   = c->cyc;
+    if (c->bit_fields & CPU_IN_INTERRUPT) {
+        s->interrupts++;
+        s->interrupt_cycles += cycles;
+        return;
+    }
+
+    const DecodedInstruction *d     = decoded(c);
+    u64                       extra = cycles - d->cycles;
+    s->count[c->ir]++;
+    s->cycles[c->ir] += cycles;
+    if (extra == (d->access == CLASS_BRANCH ? 2 : 1)) {
+        s->page_crosses[c->ir]++;
+    }
+}
+#endif
+
+// guestprofile.c
+void _guest_calls_boundary(GuestCallGraph *g, Cpu6502 *c, memaddr pc);
+
+// Charges the cycles since the last boundary to the instruction that started
+// there; pc is the one starting now.
+void _cpu_profile_boundary(Cpu6502 *c, memaddr pc) {
+    GuestProfile *p = c->profile;
+    p->cycles[p->pc] += c->cyc - p->cyc;
+    p->cyc = c->cyc;
+    p->pc  = pc;
+    if (p->calls) {
+        _guest_calls_boundary(p->calls, c, pc);
+    }
+}
+
+// A byte of code for the trace, read around whatever's mapped there as
+// mem_get_read_block does, through the last block it came from
+u8 _cpu_trace_peek(Cpu6502 *c, CpuTrace *t, memaddr addr) {
+    const MemoryBlock *b = t->block;
+    if (!b || (memaddr)(addr - b->range_low) > (memaddr)(b->range_high - b->range_low)) {
+        b        = mem_get_read_block(c->memmap, addr);
+        t->block = b;
+        if (!b) {
+            return 0;
+        }
+    }
+    return b->values[(memaddr)(addr - b->range_low)];
+}
+
+// opcode at pc, whose operand the engine has already decoded, is about to run
+// from the state c is in, cyc being when it was fetched. It's once per
+// instruction, so p is worked out in place rather than by calling cpu_get_p,
+// and nothing here calls out, so it costs the engines no more than the stores.
+void _cpu_trace_store(Cpu6502 *c, CpuTrace *t, u64 cyc, memaddr pc, u8 opcode, u16 operand) {
+    CpuTraceRecord *r = &t->records[t->n++ & t->mask];
+    r->cyc            = cyc;
+    r->pc             = pc;
+    r->bytes[0]       = opcode;
+    r->bytes[1]       = operand;
+    r->bytes[2]       = operand >> 8;
+    r->x              = c->x;
+    r->y              = c->y;
+    r->a              = c->a;
+    r->sp             = c->sp;
+    r->p              = cpu_p_of(c->p, c->nz);
+}
+
+// The same for engines that haven't fetched the operand yet: it's read as a
+// cached block holds it, both bytes at once when they're in the block the
+// last one came from.
+void _cpu_trace_record(Cpu6502 *c, u64 cyc, memaddr pc, u8 opcode) {
+    CpuTrace          *t       = c->trace;
+    const MemoryBlock *b       = t->block;
+    u8                 size    = DECODED_INSTRUCTIONS[opcode].size;
+    memaddr            offset  = b ? pc + 1 - b->range_low : 0;
+    u16                operand = 0;
+    if (size == 1) {
+        // no operand
+    }
+    else if (b && offset < (memaddr)(b->range_high - b->range_low)) {
+        operand = b->values[offset] | (size > 2 ? b->values[offset + 1] << 8 : 0);
+    }
+    else {
+        operand = _cpu_trace_peek(c, t, pc + 1);
+        if (size > 2) {
+            operand |= _cpu_trace_peek(c, t, pc + 2) << 8;
+        }
+    }
+    _cpu_trace_store(c, t, cyc, pc, opcode, operand);
+}
+
+// The next clock fetches the opcode at pc.
+void _cpu_end_instruction(Cpu6502 *c, memaddr pc) {
+#ifdef CPU_OPCODE_STATS
+    _cpu_count_opcode(c, c->cyc - c->opcode_stats.boundary_cyc);
+#endif
+    if (c->profile) {
+        _cpu_profile_boundary(c, pc);
+    }
+    c->pc       = pc;
+    c->tcu      = 0;
+    c->addr_bus = pc;
+    setflag(c->bit_fields, PIN_READ);
+}
+
+#define s(name) void *_cpu_##name(Cpu6502 *c);
+CPU_STAGES(s)
+#undef s
+
+#define s(name) _cpu_##name,
+void *(*const CPU_STAGE_FNS[CPU_STAGE_COUNT])(Cpu6502 *) = {CPU_STAGES(s)};
+#undef s
+
+#define s(name) #name,
+const char *const CPU_STAGE_NAMES[CPU_STAGE_COUNT] = {CPU_STAGES(s)};
+#undef s
 
 void cpu_pulse(Cpu6502 *c) {
     tracef("cpu_pulse \n");
@@ -59,8 +454,11 @@ void cpu_pulse(Cpu6502 *c) {
 
 void cpu_resb(Cpu6502 *c) {
     tracef("cpu_resb \n");
+    cpu_set_p(c, cpu_get_p(c)); // so p can be poked directly until it runs
     setflag(c->p, STAT___IGNORE | STAT_I_INTERRUPT);
-    unsetflag(c->p, STAT_D_DECIMAL);
+#if CPU_VARIANT != CPU_VARIANT_NMOS
+    unsetflag(c->p, STAT_D_DECIMAL); // undefined on the NMOS 6502
+#endif
 
     // we skip the whole 2-cycle set pc part (for now anyway)
     // by hacky coincidence, not defining this sets it to $0000 which is how I set up the rom for testing
@@ -71,827 +469,692 @@ void cpu_resb(Cpu6502 *c) {
     c->tcu      = 0;
     c->cyc      = 0;
     setflag(c->bit_fields, PIN_READ);
+    unsetflag(c->bit_fields, PIN_NMI | PIN_IRQ | CPU_IN_INTERRUPT); // pending interrupts are dropped
     c->on_next_clock = (void *(*)(void *))(_cpu_fetch_opcode);
+    c->profile       = NULL;
+    c->trace         = NULL;
+#ifdef CPU_OPCODE_STATS
+    cpu_opcode_stats_reset(c);
+#endif
     infof("Reset CPU. PC set to $%04x ($fffc: $%02x, $fffd: $%02x)\n", c->pc, lo, hi);
 }
 
-void *_cpu_fetch_opcode(Cpu6502 *c) {
-    c->ir = c->data_bus;
-    c->addr_bus++;
-    return _cpu_fetch_lo;
-}
+#define stage(name)      void *_cpu_##name(Cpu6502 *c)
+#define next_stage(name) return _cpu_##name
+#define same_stage()     return c->on_next_clock
+#define run_stage(name)  return _cpu_##name(c)
+#include "headers/cpu6502_stages.h"
+#undef stage
+#undef next_stage
+#undef same_stage
+#undef run_stage
 
-void *_cpu_fetch_opcode_add1(Cpu6502 *c) {
-    c->addr_bus = c->pc;
-    c->tcu      = 0;
-    setflag(c->bit_fields, PIN_READ);
-    return _cpu_fetch_opcode;
-}
-void *_cpu_fetch_opcode_add2(Cpu6502 *c __attribute__((unused))) { return _cpu_fetch_opcode_add1; }
-
-void *_cpu_fetch_lo(Cpu6502 *c) {
-    int op_a = (c->ir & 0b11100000) >> 5;
-    int op_b = (c->ir & 0b00011100) >> 2;
-    int op_c = (c->ir & 0b00000011) >> 0;
-
-    // tracef("_cpu_fetch_lo ir: $%02X (a: %i b: %i c: %i) lo: $%02X (%i) \n",
-    //                           c->ir, op_a, op_b, op_c,        lo,  lo);
-
-    if (op_b == 1) { // zpg
-        if (op_a == 4) { // ST_ ops
-            c->addr_bus = c->data_bus & 0x00FF;
-            switch (c->ir) {
-                case 0x84: // STY
-                    c->data_bus = c->y;
-                    break;
-                case 0x85: // STA
-                    c->data_bus = c->a;
-                    break;
-                case 0x86: // STX
-                    c->data_bus = c->x;
-                    break;
-            }
-            unsetflag(c->bit_fields, PIN_READ);
-            return _cpu_write_zpg_fetch;
-        }
-        else {
-            c->addr_bus = c->data_bus  & 0x00FF;
-            return _cpu_read_addr;
-        }
+#define _CPU_NO_STOP_PC 0x10000
+
+// Computed-goto build of the cycle engine. Every stage from cpu6502_stages.h
+// becomes a label in this one function, so running a cycle is a direct jump
+// instead of an indirect call through on_next_clock. Bus activity is identical
+// to calling cpu_pulse the same number of times.
+//
+// Runs up to `cycles`, stopping early at an instruction boundary where pc is
+// stop_pc or until() returns true.
+CpuStopReason _cpu_run_threaded(Cpu6502 *c, u64 cycles, u32 stop_pc, CpuStopCallback until, void *ctx) {
+#define s(name) &&threaded_##name,
+    static void *const labels[] = {CPU_STAGES(s)};
+#undef s
+
+    CpuStage cur = cpu_get_stage(c);
+    if (cur == CPU_STAGE_COUNT) {
+        cur = CPU_STAGE_fetch_opcode;
     }
 
-    switch (op_c) {
-        case 0:
-        {
-            switch (op_b) {
-                case 0:
-                    switch (op_a) {
-                        case 0: // BRK
-                            c->addr_bus = 0x0100 | c->sp;
-                            c->data_bus = (c->pc + 2) >> 8; // pc hi
-                            c->sp--;
-                            setflag(c->p, STAT_I_INTERRUPT);
-                            unsetflag(c->bit_fields, PIN_READ);
-                            return _cpu_write_brk_write_pclo;
-                        case 1: // JSR abs
-                            c->addr_bus++;
-                            return _cpu_fetch_hi;
-                        case 2: // RTI
-                            c->sp++;
-                            c->addr_bus = 0x0100 | c->sp;
-                            return _cpu_read_rti_read_pclo;
-                        case 3: // RTS
-                            c->sp++;
-                            c->addr_bus = 0x0100 | c->sp;
-                            return _cpu_read_rts_read_pchi;
-                        case 5: // LDY
-                            c->y = c->data_bus;
-                            _cpu_update_NZ_flags(c, c->y);
-                            break;
-                        case 6: // CPY
-                            compare(c, c->y);
-                            break;
-                        case 7: // CPX
-                            compare(c, c->x);
-                            break;
-                    }
-                    c->tcu = 0;
-                    c->pc += 2;
-                    c->addr_bus = c->pc;
-                    return _cpu_fetch_opcode;
-                case 1: // zpg
-                    c->addr_bus = c->data_bus & 0x00FF;
-                    if (c->ir == 0x84) { // STY
-                        c->data_bus = c->y;
-                        return _cpu_write_zpg_fetch;
-                    }
-                    return _cpu_read_addr;
-                case 2: // impl
-                    switch (op_a) {
-                        case 0: // PHP
-                            c->addr_bus = c->sp + 0x100;
-                            c->data_bus = c->p | STAT_B_BREAK | STAT___IGNORE;
-                            unsetflag(c->bit_fields, PIN_READ);
-                            return _cpu_push;
-                        case 1: // PLP
-                            c->sp++;
-                            c->addr_bus = c->sp + 0x100;
-                            return _cpu_read_addr;
-                        case 2: // PHA
-                            c->addr_bus = c->sp + 0x100;
-                            c->data_bus = c->a;
-                            unsetflag(c->bit_fields, PIN_READ);
-                            return _cpu_push;
-                        case 3: // PLA
-                            c->sp++;
-                            c->addr_bus = c->sp + 0x100;
-                            return _cpu_read_addr;
-                        case 4: // DEY
-                            c->y--;
-                            _cpu_update_NZ_flags(c, c->y);
-                            break;
-                        case 5: // TAY
-                            c->y = c->a;
-                            _cpu_update_NZ_flags(c, c->y);
-                            break;
-                        case 6: // INY
-                            c->y++;
-                            _cpu_update_NZ_flags(c, c->y);
-                            break;
-                        case 7: // INX
-                            c->x++;
-                            _cpu_update_NZ_flags(c, c->x);
-                            break;
-                    }
-                    c->tcu = 0;
-                    c->pc++;
-                    c->addr_bus = c->pc;
-                    return _cpu_fetch_opcode;
-                case 3: // abs (+ JMP ind)
-                case 7: // abs,X
-                    c->addr_bus++;
-                    return _cpu_fetch_hi;
-                case 4: // rel
-                {
-                    bool branch = false;
-                    switch (op_a) {
-                        case 0: // BPL
-                            branch = (c->p & STAT_N_NEGATIVE) == 0;
-                            break;
-                        case 1: // BMI
-                            branch = (c->p & STAT_N_NEGATIVE) == STAT_N_NEGATIVE;
-                            break;
-                        case 2: // BVC
-                            branch = (c->p & STAT_V_OVERFLOW) == 0;
-                            break;
-                        case 3: // BVS
-                            branch = (c->p & STAT_V_OVERFLOW) == STAT_V_OVERFLOW;
-                            break;
-                        case 4: // BCC
-                            branch = (c->p & STAT_C_CARRY) == 0;
-                            break;
-                        case 5: // BCS
-                            branch = (c->p & STAT_C_CARRY) == STAT_C_CARRY;
-                            break;
-                        case 6: // BNE
-                            branch = (c->p & STAT_Z_ZERO) == 0;
-                            break;
-                        case 7: // BEQ
-                            branch = (c->p & STAT_Z_ZERO) == STAT_Z_ZERO;
-                            break;
-                    }
-                    c->pc += 2; // next instruction
-                    if (branch) {
-                        return _cpu_rel_addr_inc;
-                    }
-                    c->addr_bus = c->pc;
-                    c->tcu      = 0;
-                    return _cpu_fetch_opcode;
-                }
-                case 5: // zpg,X
-                    c->addr_bus = (c->data_bus + c->x) & 0x00FF;
-                    return _cpu_read_addr;
-                case 6: // impl
-                    switch (op_a) {
-                        case 0: // CLC
-                            unsetflag(c->p, STAT_C_CARRY);
-                            break;
-                        case 1: // SEC
-                            setflag(c->p, STAT_C_CARRY);
-                            break;
-                        case 2: // CLI
-                            unsetflag(c->p, STAT_I_INTERRUPT);
-                            break;
-                        case 3: // SEI
-                            setflag(c->p, STAT_I_INTERRUPT);
-                            break;
-                        case 4: // TYA
-                            c->a = c->y;
-                            _cpu_update_NZ_flags(c, c->a);
-                            break;
-                        case 5: // CLV
-                            unsetflag(c->p, STAT_V_OVERFLOW);
-                            break;
-                        case 6: // CLD
-                            unsetflag(c->p, STAT_D_DECIMAL);
-                            break;
-                        case 7: // SED
-                            setflag(c->p, STAT_D_DECIMAL);
-                            break;
-                    }
-                    c->tcu = 0;
-                    c->pc++;
-                    c->addr_bus = c->pc;
-                    return _cpu_fetch_opcode;
-            }
-            break;
-        }
-        case 1:
-        {
-            switch (op_b) {
-                case 0: // X,ind
-                    c->addr_bus = (c->data_bus + c->x) & 0x00FF; // no carry
-                    return _cpu_read_ind_read_addrhi;
-                case 2: // imm
-                    switch (op_a) {
-                        case 0: // ORA
-                            c->a |= c->data_bus;
-                            break;
-                        case 1: // AND
-                            c->a &= c->data_bus;
-                            break;
-                        case 2: // EOR
-                            c->a ^= c->data_bus;
-                            break;
-                        case 7: // SBC
-                            c->data_bus = ~c->data_bus;
-                            // FALLTHROUGH!!!
-                        case 3: // ADC
-                        {
-                            u16 a1 = (u16)(c->a) + (u16)(c->data_bus) + (u16)((c->p & STAT_C_CARRY) == STAT_C_CARRY);
-                            setunsetflag(c->p, STAT_C_CARRY, a1 > 0xFF);
-                            setunsetflag(c->p, STAT_V_OVERFLOW,
-                                  (~((u16)(c->a) ^ (u16)(c->data_bus)))
-                                & ((u16)(c->a) ^ a1)
-                                & 0x0080);
-                            c->a = a1 & 0xFF;
-                            break;
-                        }
-                        case 5: // LDA
-                            c->a = c->data_bus;
-                            break;
-                        case 6: // CMP
-                            compare(c, c->a);
-                            // need to skip setNZ below
-                            c->tcu = 0;
-                            c->pc += 2;
-                            c->addr_bus = c->pc;
-                            return _cpu_fetch_opcode;
-                    }
-                    _cpu_update_NZ_flags(c, c->a);
-                    c->tcu = 0;
-                    c->pc += 2;
-                    c->addr_bus = c->pc;
-                    return _cpu_fetch_opcode;
-                case 3: // abs
-                case 6: // abs,Y
-                case 7: // abs,X
-                    c->addr_bus++;
-                    return _cpu_fetch_hi;
-                case 4: // ind,Y
-                    c->addr_bus = c->data_bus;
-                    return _cpu_read_ind_read_addrhi;
-                case 5: // zpg,X
-                    break;
-            }
-            break;
+    CpuStopReason reason = CPU_STOP_CYCLES;
+    while (cycles--) {
+        c->cyc++;
+        c->tcu++;
+        if ((c->bit_fields & PIN_READ) == PIN_READ) {
+            c->data_bus = mem_read_addr(c->memmap, c->addr_bus);
         }
-        case 2:
-        {
-            switch (op_b) {
-                case 0: // imm
-                    if (op_a == 5) { // LDX
-                        c->x   = c->data_bus;
-                        c->tcu = 0;
-                        c->pc += 2;
-                        c->addr_bus = c->pc;
-                        _cpu_update_NZ_flags(c, c->x);
-                        return _cpu_fetch_opcode;
-                    }
-                    break;
-                case 1: // STX zpg
-                    c->addr_bus = c->data_bus & 0x00FF;
-                    c->data_bus = c->x;
-                    unsetflag(c->bit_fields, PIN_READ);
-                    return _cpu_write_zpg_fetch;
-                case 2: // impl
-                    switch (op_a) {
-                        case 0: // ASL
-                            setunsetflag(c->p, STAT_C_CARRY, (c->a & 0x80) == 0x80);
-                            c->a <<= 1;
-                            _cpu_update_NZ_flags(c, c->a);
-                            break;
-                        case 1: // ROL
-                        {
-                            u8 c0 = c->p & STAT_C_CARRY;
-                            setunsetflag(c->p, STAT_C_CARRY, (c->a & 0x80) == 0x80);
-                            c->a = c->a << 1 | c0;
-                            _cpu_update_NZ_flags(c, c->a);
-                            break;
-                        }
-                        case 2: // LSR
-                            setunsetflag(c->p, STAT_C_CARRY, c->a & 0x01);
-                            c->a >>= 1;
-                            _cpu_update_NZ_flags(c, c->a);
-                            break;
-                        case 3: // ROR
-                        {
-                            u8 c0 = c->p & STAT_C_CARRY;
-                            c->p = (c->p & ~STAT_C_CARRY) | (c->a & STAT_C_CARRY);
-                            c->a = c->a >> 1 | c0 << 7;
-                            _cpu_update_NZ_flags(c, c->a);
-                            break;
-                        }
-                            // setunsetflag(c->p, STAT_C_CARRY, c->a & 0x01);
-                            // c->a >>=1;
-                            // if ((c->p & STAT_C_CARRY) == STAT_C_CARRY) {
-                            //     c->a |= 0x80;
-                            // }
-                            // _cpu_update_NZ_flags(c, c->a);
-                            break;
-                        case 4: // TXA
-                            c->a = c->x;
-                            _cpu_update_NZ_flags(c, c->a);
-                            break;
-                        case 5: // TAX
-                            c->x = c->a;
-                            _cpu_update_NZ_flags(c, c->x);
-                            break;
-                        case 6: // DEX
-                            c->x--;
-                            _cpu_update_NZ_flags(c, c->x);
-                            break;
-                        case 7: // NOP
-                            break;
-                    }
-                    c->tcu = 0;
-                    c->pc++;
-                    c->addr_bus = c->pc;
-                    return _cpu_fetch_opcode;
-                case 3: // abs
-                case 7: // abs,X
-                    c->addr_bus++;
-                    return _cpu_fetch_hi;
-                //   4
-                case 5: // zpg,X zpg,Y
-                    break;
-                case 6: // impl
-                    switch (op_a) {
-                        case 4: // TXS
-                            c->sp = c->x;
-                            break;
-                        case 5: // TSX
-                            c->x = c->sp + 0x100;
-                            _cpu_update_NZ_flags(c, c->x);
-                            break;
-                    }
-                    c->tcu = 0;
-                    c->pc++;
-                    c->addr_bus = c->pc;
-                    return _cpu_fetch_opcode;
-            }
-            break;
+        else {
+            mem_write_addr(c->memmap, c->addr_bus, c->data_bus);
         }
-    }
 
-    return c->on_next_clock;
-}
+        u8 pd = c->data_bus;
+        goto *labels[cur];
 
-void *_cpu_fetch_hi(Cpu6502 *c) {
-    c->addr_bus = c->pd | (c->data_bus << 8);
+#define stage(name)      threaded_##name:
+#define next_stage(name) do { cur = CPU_STAGE_##name; goto end_cycle; } while (0)
+#define same_stage()     goto end_cycle
+#define run_stage(name)  goto threaded_##name
+#include "headers/cpu6502_stages.h"
+#undef stage
+#undef next_stage
+#undef same_stage
+#undef run_stage
 
-    int op_a = (c->ir & 0b11100000) >> 5;
-    int op_b = (c->ir & 0b00011100) >> 2;
-    int op_c = (c->ir & 0b00000011) >> 0;
+    end_cycle:
+        c->pd = pd;
 
-    memaddr addr_no_add = c->addr_bus;
-    switch (op_b) {
-        // case 3: // abs
-            // Do nothing
-        case 6: // abs,Y
-            c->addr_bus += c->y;
-            break;
-        case 7: // abs,X
-            if (c->ir == 0xBE) { // LDX abs,Y
-                c->addr_bus += c->y;
+        if (c->tcu == 0) {
+            if (c->pc == stop_pc) {
+                reason = CPU_STOP_PC;
                 break;
             }
-            c->addr_bus += c->x;
-            break;
-    }
-
-    if (c->ir == 0x4C) { // JMP
-        c->pc  = c->addr_bus;
-        c->tcu = 0;
-        return _cpu_fetch_opcode;
+            if (until && until(c, ctx)) {
+                reason = CPU_STOP_CALLBACK;
+                break;
+            }
+        }
     }
 
-    if (c->ir == 0x20) { // JSR
-        c->jsr_juggle_addr_because_im_lazy = (c->data_bus << 8) | (c->pd);
-        c->addr_bus = 0x0100 | c->sp;
-        c->sp--;
-        c->data_bus = (c->pc + 2) >> 8;
-        unsetflag(c->bit_fields, PIN_READ);
-        return _cpu_write_jsr_write_pclo;
-    }
+    cpu_set_stage(c, cur);
+    return reason;
+}
 
-    if ((addr_no_add & 0xFF00) != (c->addr_bus & 0xFF00)) {
-        return _cpu_page_boundary;
-    }
+void cpu_run_threaded(Cpu6502 *c, u64 cycles) {
+    _cpu_run_threaded(c, cycles, _CPU_NO_STOP_PC, NULL, NULL);
+}
 
-    if (op_a == 4) { // ST_
-        switch (op_c) {
-            case 0: // STY
-                c->data_bus = c->y;
-                break;
-            case 1: // STA
-                c->data_bus = c->a;
-                break;
-            case 2: // STX
-                c->data_bus = c->x;
-                break;
-            case 3: // SAX, etc
-                break;
-        }
+CpuStopReason cpu_run_cycles(Cpu6502 *c, u64 n) {
+    return _cpu_run_threaded(c, n, _CPU_NO_STOP_PC, NULL, NULL);
+}
 
-        unsetflag(c->bit_fields, PIN_READ); // write
-        return _cpu_write_then_fetch_add3;
-    }
-
-    return _cpu_read_addr; // Fetch ADDR value and perform operation after read
-}
-
-void *_cpu_read_addr(Cpu6502 *c) {
-    int op_a = (c->ir & 0b11100000) >> 5;
-    int op_b = (c->ir & 0b00011100) >> 2;
-    int op_c = (c->ir & 0b00000011) >> 0;
-
-    switch (op_c) {
-        case 0:
-            if (op_b == 1 || op_b == 3) {
-                switch (op_a) {
-                    case 1: // BIT
-                    {
-                        u8 bits = STAT_N_NEGATIVE | STAT_V_OVERFLOW;
-                        c->p = (c->p & ~bits) | (c->data_bus & bits);
-                        setunsetflag(c->p, STAT_Z_ZERO, ((c->data_bus & c->a) == 0));
-                        break;
-                    }
-                    case 5: // LDY
-                        c->y = c->data_bus;
-                        _cpu_update_NZ_flags(c, c->y);
-                        break;
-                    case 6: // CPY
-                        compare(c, c->y);
-                        break;
-                    case 7: // CPX
-                        compare(c, c->x);
-                        break;
-                }
-                c->tcu = 0;
-                c->pc += 2;
-                c->addr_bus = c->pc;
-                return _cpu_fetch_opcode;
-            }
-            switch (c->ir) {
-                case 0x28: // PLP
-                case 0x68: // PLA
-                    c->pd = c->data_bus;
-                    return _cpu_pop;
-                case 0x6C: // JMP ind
-                    c->addr_bus++;
-                    return _cpu_read_addr_ind;
-                case 0xBC: // LDY abs,X
-                    c->y   = c->data_bus;
-                    c->tcu = 0;
-                    c->pc += 3;
-                    c->addr_bus = c->pc;
-                    return _cpu_fetch_opcode;
-            }
-            break;
-        case 1:
-            // X,ind and ind,Y have already been decoded by this point
-            switch (op_a) {
-                case 0: // ORA
-                    c->a |= c->data_bus;
-                    _cpu_update_NZ_flags(c, c->a);
-                    break;
-                case 1: // AND
-                    c->a &= c->data_bus;
-                    _cpu_update_NZ_flags(c, c->a);
-                    break;
-                case 2: // EOR
-                    c->a ^= c->data_bus;
-                    _cpu_update_NZ_flags(c, c->a);
-                    break;
-                case 3: // ADC
-                    break;
-                case 5: // LDA
-                    c->a = c->data_bus;
-                    _cpu_update_NZ_flags(c, c->a);
-                    break;
-                case 6: // CMP
-                    compare(c, c->a);
-                    break;
-                case 7: // SBC
-                    break;
-            }
-            switch (op_b) {
-                // case 2: imm
-                case 0: // X,ind
-                case 1: // zpg
-                case 4: // ind,Y
-                case 5: // zpg,X
-                    c->pc += 2;
-                    break;
-                case 3: // abs
-                case 6: // abs,Y
-                case 7: // abs,X
-                    c->pc += 3;
-                    break;
-            }
-            c->tcu      = 0;
-            c->addr_bus = c->pc;
-            return _cpu_fetch_opcode;
-        case 2:
-            switch (op_a) {
-                case 0: // ASL
-                    break;
-                case 1: // ROL
-                    break;
-                case 2: // LSR
-                    break;
-                case 3: // ROR
-                    break;
-                case 4: // STX
-                    c->data_bus = c->x;
-                    break;
-                case 5: // LDX
-                    c->x = c->data_bus;
-                    _cpu_update_NZ_flags(c, c->x);
-                    break;
-                case 6: // DEC
-                    break;
-                case 7: // INC
-                    break;
-            }
-            switch (op_b) {
-                case 1: // zpg
-                case 5: // zpg,X
-                    c->pc += 2;
-                    break;
-                case 3: // abs
-                case 7: // abs,X (abs, Y)
-                    c->pc += 3;
-                    break;
-            }
-            c->tcu      = 0;
-            c->addr_bus = c->pc;
-            return _cpu_fetch_opcode;
-    }
-    return c->on_next_clock;
+CpuStopReason cpu_run_until_pc(Cpu6502 *c, memaddr addr, u64 max_cycles) {
+    return _cpu_run_threaded(c, max_cycles, addr, NULL, NULL);
 }
 
-void *_cpu_page_boundary(Cpu6502 *c) {
-    c->tcu      = 0;
-    c->addr_bus = c->pc;
-    return _cpu_fetch_opcode;
+CpuStopReason cpu_run_until(Cpu6502 *c, CpuStopCallback until, void *ctx, u64 max_cycles) {
+    return _cpu_run_threaded(c, max_cycles, _CPU_NO_STOP_PC, until, ctx);
 }
 
-void *_cpu_read_addr_ind(Cpu6502 *c) {
-    c->addr_bus = (c->pd << 8) | c->data_bus;
 
-    if (c->ir == 0x6C) { // JMP ind
-        c->tcu = 0;
-        c->pc  = c->addr_bus;
-        return _cpu_fetch_opcode;
+CpuStage cpu_get_stage(Cpu6502 *c) {
+    for (uint i = 0; i < CPU_STAGE_COUNT; i++) {
+        if ((void *)CPU_STAGE_FNS[i] == (void *)c->on_next_clock) {
+            return i;
+        }
     }
+    return CPU_STAGE_COUNT;
+}
 
-    return c->on_next_clock;
+void cpu_set_stage(Cpu6502 *c, CpuStage stage) {
+    c->on_next_clock = stage < CPU_STAGE_COUNT ? (void *(*)(void *))CPU_STAGE_FNS[stage] : NULL;
 }
 
-void *_cpu_push(Cpu6502 *c) {
-    c->tcu = 0;
-    c->pc++;
-    c->addr_bus = c->pc;
-    c->sp--;
-    setflag(c->bit_fields, PIN_READ);
-    return _cpu_fetch_opcode;
+const char *cpu_stage_name(CpuStage stage) {
+    return stage < CPU_STAGE_COUNT ? CPU_STAGE_NAMES[stage] : "?";
 }
 
-void *_cpu_pop(Cpu6502 *c) {
-    switch (c->ir) {
-        case 0x28: // PLP
-        {
-            u8 keep = c->p & (STAT_B_BREAK | STAT___IGNORE);
-            c->p = c->pd & ~STAT___IGNORE & ~STAT___IGNORE;
-            c->p |= keep;
-            break;
-        }
-        case 0x68: // PLA
-        {
-            c->a = c->pd;
-            _cpu_update_NZ_flags(c, c->a);
-            break;
-        }
+
+// State snapshots
+//
+// Fields are written byte by byte, multi-byte ones little endian, so the blob
+// doesn't depend on the host's struct layout. nz is kept as it is rather than
+// folded into p, so a restored CPU is identical to the saved one.
+
+enum {
+    _CPU_STATE_VERSION   = 0,
+    _CPU_STATE_IR        = 1,
+    _CPU_STATE_TCU       = 2,
+    _CPU_STATE_STAGE     = 3,
+    _CPU_STATE_PC        = 4, // 2 bytes
+    _CPU_STATE_A         = 6,
+    _CPU_STATE_X         = 7,
+    _CPU_STATE_Y         = 8,
+    _CPU_STATE_SP        = 9,
+    _CPU_STATE_P         = 10,
+    _CPU_STATE_PD        = 11,
+    _CPU_STATE_NZ        = 12, // 2 bytes
+    _CPU_STATE_JSR       = 14, // 2 bytes, jsr_juggle_addr_because_im_lazy
+    _CPU_STATE_ADDR_BUS  = 16, // 2 bytes
+    _CPU_STATE_DATA_BUS  = 18,
+    _CPU_STATE_BIT_FIELD = 19,
+    _CPU_STATE_CYC       = 20, // 8 bytes
+    _CPU_STATE_END       = 28,
+};
+
+_Static_assert(_CPU_STATE_END <= CPU_STATE_SIZE, "CpuState is too small");
+
+void _cpu_state_put(u8 *bytes, int at, u64 val, int size) {
+    for (int i = 0; i < size; i++) {
+        bytes[at + i] = val >> (8 * i);
     }
-    c->pc++;
-    c->tcu      = 0;
-    c->addr_bus = c->pc;
-    return _cpu_fetch_opcode;
 }
 
-void *_cpu_write_then_fetch_add3(Cpu6502 *c) {
-    c->pc += 3;
-    c->tcu      = 0;
-    c->addr_bus = c->pc;
-    setflag(c->bit_fields, PIN_READ); // read
-    return _cpu_fetch_opcode;
+u64 _cpu_state_get(const u8 *bytes, int at, int size) {
+    u64 val = 0;
+    for (int i = 0; i < size; i++) {
+        val |= (u64)bytes[at + i] << (8 * i);
+    }
+    return val;
 }
 
-void *_cpu_write_brk_write_pclo(Cpu6502 *c) {
-    c->addr_bus = 0x0100 | c->sp;
-    c->data_bus = 0xFF & (c->pc + 2);
-    c->sp--;
-    return _cpu_write_brk_write_sr;
+void cpu_save_state(Cpu6502 *c, CpuState *state) {
+    u8 *b = state->bytes;
+    memset(b, 0, CPU_STATE_SIZE);
+    b[_CPU_STATE_VERSION]   = CPU_STATE_VERSION;
+    b[_CPU_STATE_IR]        = c->ir;
+    b[_CPU_STATE_TCU]       = c->tcu;
+    b[_CPU_STATE_STAGE]     = cpu_get_stage(c);
+    b[_CPU_STATE_A]         = c->a;
+    b[_CPU_STATE_X]         = c->x;
+    b[_CPU_STATE_Y]         = c->y;
+    b[_CPU_STATE_SP]        = c->sp;
+    b[_CPU_STATE_P]         = c->p;
+    b[_CPU_STATE_PD]        = c->pd;
+    b[_CPU_STATE_DATA_BUS]  = c->data_bus;
+    b[_CPU_STATE_BIT_FIELD] = c->bit_fields;
+    _cpu_state_put(b, _CPU_STATE_PC, c->pc, 2);
+    _cpu_state_put(b, _CPU_STATE_NZ, c->nz, 2);
+    _cpu_state_put(b, _CPU_STATE_JSR, c->jsr_juggle_addr_because_im_lazy, 2);
+    _cpu_state_put(b, _CPU_STATE_ADDR_BUS, c->addr_bus, 2);
+    _cpu_state_put(b, _CPU_STATE_CYC, c->cyc, 8);
 }
 
-void *_cpu_write_brk_write_sr(Cpu6502 *c) {
-    c->addr_bus = 0x0100 | c->sp;
-    c->data_bus = c->p & STAT_B_BREAK;
-    c->sp--;
-    return _cpu_write_brk_read_pclo;
+bool cpu_load_state(Cpu6502 *c, const CpuState *state) {
+    const u8 *b = state->bytes;
+    if (b[_CPU_STATE_VERSION] != CPU_STATE_VERSION || b[_CPU_STATE_STAGE] > CPU_STAGE_COUNT) {
+        return false;
+    }
+    c->ir                              = b[_CPU_STATE_IR];
+    c->tcu                             = b[_CPU_STATE_TCU];
+    c->a                               = b[_CPU_STATE_A];
+    c->x                               = b[_CPU_STATE_X];
+    c->y                               = b[_CPU_STATE_Y];
+    c->sp                              = b[_CPU_STATE_SP];
+    c->p                               = b[_CPU_STATE_P];
+    c->pd                              = b[_CPU_STATE_PD];
+    c->data_bus                        = b[_CPU_STATE_DATA_BUS];
+    c->bit_fields                      = b[_CPU_STATE_BIT_FIELD];
+    c->pc                              = _cpu_state_get(b, _CPU_STATE_PC, 2);
+    c->nz                              = _cpu_state_get(b, _CPU_STATE_NZ, 2);
+    c->jsr_juggle_addr_because_im_lazy = _cpu_state_get(b, _CPU_STATE_JSR, 2);
+    c->addr_bus                        = _cpu_state_get(b, _CPU_STATE_ADDR_BUS, 2);
+    c->cyc                             = _cpu_state_get(b, _CPU_STATE_CYC, 8);
+    cpu_set_stage(c, b[_CPU_STATE_STAGE]);
+    return true;
 }
 
-void *_cpu_write_brk_read_pclo(Cpu6502 *c) {
-    c->addr_bus = 0xFFFE;
-    setflag(c->bit_fields, PIN_READ);
-    return _cpu_read_brk_read_pchi;
-}
 
-void *_cpu_read_brk_read_pchi(Cpu6502 *c) {
-    c->addr_bus = 0xFFFF;
-    return _cpu_read_brk_fetch;
-}
+// Whole-instruction stepper
+//
+// cpu_step executes an entire opcode per call. Operands are fetched straight
+// through the memory map and only the architecturally visible accesses are
+// made (no dummy reads/writes), so it is much cheaper than cpu_pulse but not
+// bus accurate. Cycle counts still include page-cross and branch penalties.
 
-void *_cpu_read_brk_fetch(Cpu6502 *c) {
-    c->pc       = (c->data_bus << 8) | c->pd;
-    c->addr_bus = c->pc;
-    c->tcu      = 0;
-    return _cpu_fetch_opcode;
+#define _step_read(c, addr)         mem_read_addr((c)->memmap, (addr))
+#define _step_write(c, addr, value) mem_write_addr((c)->memmap, (addr), (value))
+
+void _cpu_step_push(Cpu6502 *c, u8 value) {
+    _step_write(c, 0x0100 | c->sp, value);
+    c->sp--;
 }
 
-void *_cpu_read_rti_read_pclo(Cpu6502 *c) {
-    c->p = c->data_bus & (~STAT_B_BREAK);
+u8 _cpu_step_pull(Cpu6502 *c) {
     c->sp++;
-    c->addr_bus = 0x0100 | c->sp;
-    return _cpu_read_rti_read_pchi;
+    return _step_read(c, 0x0100 | c->sp);
 }
 
-void *_cpu_read_rti_read_pchi(Cpu6502 *c) {
-    c->sp++;
-    c->addr_bus = 0x0100 | c->sp;
-    return _cpu_read_rti_fetch;
+void _cpu_step_pull_p(Cpu6502 *c) {
+    _cpu_pull_p(c, _cpu_step_pull(c));
 }
 
-void *_cpu_read_rti_fetch(Cpu6502 *c) {
-    c->pc       = (c->data_bus << 8) | c->pd;
-    c->addr_bus = c->pc;
-    c->tcu      = 0;
-    return _cpu_fetch_opcode;
+u8 _cpu_step_branch(Cpu6502 *c, memaddr addr, bool cond) {
+    if (!cond) {
+        return 0;
+    }
+    bool crossed = (c->pc & 0xFF00) != (addr & 0xFF00);
+    c->pc        = addr;
+    return crossed ? 2 : 1;
 }
 
-void *_cpu_read_rts_read_pchi(Cpu6502 *c) {
-    c->sp++;
-    c->addr_bus = 0x0100 | c->sp;
-    return _cpu_read_rts_fetch;
+// BRK and NMI/IRQ alike: pushes ret and p, then jumps through the vector
+void _cpu_step_vector(Cpu6502 *c, memaddr ret, u8 p) {
+    _cpu_step_push(c, ret >> 8);
+    _cpu_step_push(c, ret & 0xFF);
+    _cpu_step_push(c, p);
+    setflag(c->p, STAT_I_INTERRUPT);
+#if CPU_VARIANT == CPU_VARIANT_65C02
+    unsetflag(c->p, STAT_D_DECIMAL);
+#endif
+    memaddr vector = _cpu_brk_vector(c);
+    c->pc          = _step_read(c, vector) | (_step_read(c, vector + 1) << 8);
 }
 
-void *_cpu_read_rts_fetch(Cpu6502 *c) {
-    c->pc = (c->data_bus << 8) | c->pd;
-    c->pc++; // RTS adds 1 to the pushed pc
-    return _cpu_fetch_opcode_add2;
+// NMI/IRQ taken at an instruction boundary
+void _cpu_step_interrupt(Cpu6502 *c) {
+    _cpu_step_vector(c, c->pc, cpu_get_p(c) | STAT___IGNORE);
+    c->cyc += 7;
+    setflag(c->bit_fields, CPU_IN_INTERRUPT); // so it isn't taken for a BRK
+#ifdef CPU_OPCODE_STATS
+    _cpu_count_opcode(c, 7);
+#endif
+    if (c->profile) {
+        _cpu_profile_boundary(c, c->pc);
+    }
+    unsetflag(c->bit_fields, CPU_IN_INTERRUPT);
 }
 
-void *_cpu_read_zpg(Cpu6502 *c) {
-    int op_c = (c->ir & 0b00000011) >> 0;
+// Runs ir, the opcode at pc, with its operand bytes already fetched: resolves
+// the effective address, executes it by its access class with the same ALU
+// ops as the cycle engine (_cpu_alu, _cpu_modify, _cpu_implied), and advances
+// pc and cyc.
+void _cpu_step_execute(Cpu6502 *c, memaddr pc, u16 operand) {
+    const DecodedInstruction *d = &DECODED_INSTRUCTIONS[c->ir];
 
-    switch (op_c) {
-        case 0: // ASL
+    memaddr addr    = 0;
+    bool    crossed = false;
+    c->pc           = pc + d->size;
+    switch (d->mode) {
+        case AM_A:
+        case AM_impl:
+            break;
+        case AM_imm:
+            addr = pc + 1;
+            break;
+        case AM_zpg:
+        case AM_abs:
+            addr = operand;
+            break;
+        case AM_zpgX:
+            addr = (operand + c->x) & 0x00FF;
+            break;
+        case AM_zpgY:
+            addr = (operand + c->y) & 0x00FF;
+            break;
+        case AM_rel:
+            addr = c->pc + (int8_t)operand;
+            break;
+        case AM_absX:
+        case AM_absY:
+            addr    = operand + (d->mode == AM_absX ? c->x : c->y);
+            crossed = (operand & 0xFF00) != (addr & 0xFF00);
+            break;
+        case AM_ind:
+#if CPU_VARIANT == CPU_VARIANT_65C02
+            addr = _step_read(c, operand) | (_step_read(c, (memaddr)(operand + 1)) << 8);
+#else
+            // the high byte is fetched without carrying into the pointer's page
+            addr = _step_read(c, operand) | (_step_read(c, (operand & 0xFF00) | ((operand + 1) & 0x00FF)) << 8);
+#endif
+            break;
+        case AM_absXind:
         {
-            u8 carry    = c->data_bus >> 7 == 0x01;
-            c->data_bus = c->data_bus << 1;
-            setunsetflag(c->p, STAT_C_CARRY, carry);
-            _cpu_update_NZ_flags(c, c->data_bus);
+            memaddr ptr = operand + c->x;
+            addr        = _step_read(c, ptr) | (_step_read(c, (memaddr)(ptr + 1)) << 8);
             break;
         }
-        case 1: // ROL
+        case AM_zpgind:
+            addr = _step_read(c, (u8)operand) | (_step_read(c, (u8)(operand + 1)) << 8);
+            break;
+        case AM_Xind:
         {
-            u8 carry    = c->data_bus >> 7 & 0x01;
-            c->data_bus = (c->data_bus << 1) | carry;
-            setunsetflag(c->p, STAT_C_CARRY, carry);
-            _cpu_update_NZ_flags(c, c->data_bus);
+            u8 zp = operand + c->x;
+            addr  = _step_read(c, zp) | (_step_read(c, (u8)(zp + 1)) << 8);
             break;
         }
-        case 2: // LSR
+        case AM_indY:
         {
-            u8 carry    = c->data_bus & 0x01;
-            c->data_bus = c->data_bus >> 1;
-            setunsetflag(c->p, STAT_C_CARRY, carry);
-            _cpu_update_NZ_flags(c, c->data_bus);
+            u8      zp   = operand;
+            memaddr base = _step_read(c, zp) | (_step_read(c, (u8)(zp + 1)) << 8);
+            addr         = base + c->y;
+            crossed      = (base & 0xFF00) != (addr & 0xFF00);
             break;
         }
-        case 3: // ROR
+    }
+
+    u8 cycles = d->cycles;
+    switch (d->access) {
+        case CLASS_IMPLIED:
+            _cpu_implied(c, d);
+            break;
+        case CLASS_READ:
+            _cpu_alu(c, d, _step_read(c, addr));
+            cycles += crossed;
+            break;
+        case CLASS_WRITE:
+            _step_write(c, addr, *_cpu_reg(c, d->reg));
+            break;
+        case CLASS_RMW:
+            if (d->mode == AM_A) {
+                c->a = _cpu_modify(c, d->alu, c->a);
+            }
+            else {
+                _step_write(c, addr, _cpu_modify(c, d->alu, _step_read(c, addr)));
+            }
+            break;
+        case CLASS_BRANCH:
         {
-            u8 carry    = c->data_bus & 0x01;
-            c->data_bus = (c->data_bus >> 1) | (carry << 7);
-            setunsetflag(c->p, STAT_C_CARRY, carry);
-            _cpu_update_NZ_flags(c, c->data_bus);
+            u8 p    = d->flag & (STAT_N_NEGATIVE | STAT_Z_ZERO) ? cpu_get_p(c) : c->p;
+            cycles += _cpu_step_branch(c, addr, ((p & d->flag) != 0) == (d->alu == ALU_BRANCH_SET));
             break;
         }
-        case 4: // STX
-            c->data_bus = c->x;
+        case CLASS_JMP:
+            c->pc = addr;
+            break;
+        case CLASS_JSR:
+        {
+            memaddr ret = c->pc - 1; // last byte of the JSR
+            _cpu_step_push(c, ret >> 8);
+            _cpu_step_push(c, ret & 0xFF);
+            c->pc = addr;
             break;
-        case 5: // LDX
-            c->x = c->data_bus;
-            _cpu_update_NZ_flags(c, c->x);
-            return _cpu_write_zpg_fetch(c); // cuz I'm lazy
-        case 6: // DEC
-            c->data_bus--;
-            _cpu_update_NZ_flags(c, c->x);
+        }
+        case CLASS_RTS:
+        {
+            u8 lo = _cpu_step_pull(c);
+            u8 hi = _cpu_step_pull(c);
+            c->pc = ((hi << 8) | lo) + 1;
             break;
-        case 7: // INC
-            c->data_bus++;
-            _cpu_update_NZ_flags(c, c->x);
+        }
+        case CLASS_RTI:
+        {
+            _cpu_step_pull_p(c);
+            u8 lo = _cpu_step_pull(c);
+            u8 hi = _cpu_step_pull(c);
+            c->pc = (hi << 8) | lo;
+            break;
+        }
+        case CLASS_BRK: // skips its padding byte
+            _cpu_step_vector(c, c->pc + 1, cpu_get_p(c) | STAT_B_BREAK | STAT___IGNORE);
+            break;
+        case CLASS_PUSH:
+            _cpu_step_push(c, d->reg == REG_P ? cpu_get_p(c) | STAT_B_BREAK | STAT___IGNORE : *_cpu_reg(c, d->reg));
+            break;
+        case CLASS_PULL:
+            if (d->reg == REG_P) {
+                _cpu_step_pull_p(c);
+            }
+            else {
+                *_cpu_reg(c, d->reg) = _cpu_step_pull(c);
+                _cpu_update_NZ_flags(c, *_cpu_reg(c, d->reg));
+            }
             break;
     }
 
-    // data_bus = data_bus;
-
-    return _cpu_write_zpg_fetch;
+    c->cyc += cycles;
+#ifdef CPU_OPCODE_STATS
+    _cpu_count_opcode(c, cycles);
+#endif
+    if (c->profile) {
+        _cpu_profile_boundary(c, c->pc);
+    }
 }
 
-void *_cpu_write_zpg_fetch(Cpu6502 *c) {
-    c->pc += 2;
+// Leaves the bus where cpu_pulse expects it at an instruction boundary.
+void _cpu_step_end(Cpu6502 *c) {
     c->tcu      = 0;
     c->addr_bus = c->pc;
     setflag(c->bit_fields, PIN_READ);
-    return _cpu_fetch_opcode;
+    c->on_next_clock = (void *(*)(void *))(_cpu_fetch_opcode);
 }
 
-void *_cpu_write_jsr_write_pclo(Cpu6502 *c) {
-    c->addr_bus = 0x0100 | c->sp;
-    c->sp--;
-    c->data_bus = (c->pc + 2) & 0xFF;
-    return _cpu_write_jsr_missing_extra_cycle;
+u8 cpu_step(Cpu6502 *c) {
+    u64 cyc_start = c->cyc;
+
+    // finish whatever instruction cpu_pulse is in the middle of
+    while (c->tcu != 0) {
+        cpu_pulse(c);
+    }
+
+    if (_cpu_interrupt_pending(c)) {
+        _cpu_step_interrupt(c);
+        _cpu_step_end(c);
+        return c->cyc - cyc_start;
+    }
+
+    memaddr pc      = c->pc;
+    u16     operand = 0;
+    c->ir           = _step_read(c, pc);
+
+    switch (DECODED_INSTRUCTIONS[c->ir].mode) {
+        case AM_A:
+        case AM_impl:
+        case AM_imm: // read by the op itself
+            break;
+        case AM_abs:
+        case AM_absX:
+        case AM_absY:
+        case AM_ind:
+        case AM_absXind:
+            operand = _step_read(c, pc + 1) | (_step_read(c, pc + 2) << 8);
+            break;
+        default:
+            operand = _step_read(c, pc + 1);
+            break;
+    }
+
+    if (c->trace) {
+        _cpu_trace_record(c, c->cyc, pc, c->ir);
+    }
+    _cpu_step_execute(c, pc, operand);
+    _cpu_step_end(c);
+
+    return c->cyc - cyc_start;
 }
 
-void *_cpu_write_jsr_fetch(Cpu6502 *c) {
-    c->pc       = c->jsr_juggle_addr_because_im_lazy;
-    c->addr_bus = c->pc;
-    c->tcu      = 0;
-    setflag(c->bit_fields, PIN_READ);
-    return _cpu_fetch_opcode;
+u64 cpu_run_instructions(Cpu6502 *c, u64 n) {
+    u64 cyc_start = c->cyc;
+    while (n--) {
+        cpu_step(c);
+    }
+    return c->cyc - cyc_start;
 }
 
-void *_cpu_write_jsr_missing_extra_cycle(Cpu6502 *c __attribute__((unused))) {
-    return _cpu_write_jsr_fetch;
+// Interprets b, which starts at pc, stopping early once `cycles` have passed
+// since cyc_start.
+void _cpu_run_block(Cpu6502 *c, BlockCache *bc, const CachedBlock *b, u64 cyc_start, u64 cycles) {
+    CpuTrace *trace = c->trace;
+    for (uint i = 0; i < b->n_instructions && c->cyc - cyc_start < cycles; i++) {
+        const CachedInstruction *ins = b->instructions + i;
+        c->ir                        = ins->opcode;
+        if (trace) {
+            _cpu_trace_store(c, trace, c->cyc, c->pc, ins->opcode, ins->operand);
+        }
+        _cpu_step_execute(c, c->pc, ins->operand);
+
+        // it may have just written over the rest of itself, or switched its
+        // bank out
+        if (!b->valid || (b->writable && !block_cache_is_valid(bc, b))) {
+            break;
+        }
+    }
 }
 
-void *_cpu_read_ind_read_addrhi(Cpu6502 *c) {
-    int op_b = (c->ir & 0b00011100) >> 2;
-    if (op_b == 0) { // X,ind
-        c->addr_bus = (c->pd + c->x + 1) & 0x00FF; // without carry
+u64 cpu_run_blocks(Cpu6502 *c, BlockCache *bc, u64 cycles) {
+    u64 cyc_start = c->cyc;
+
+    while (c->tcu != 0) {
+        cpu_pulse(c);
     }
-    else if (op_b == 4) { // ind,Y
-        c->addr_bus = (c->pd + 1) & 0xFF;
+
+    while (c->cyc - cyc_start < cycles) {
+        if (_cpu_interrupt_pending(c)) {
+            _cpu_step_interrupt(c);
+            continue;
+        }
+        _cpu_run_block(c, bc, block_cache_get(bc, c->pc), cyc_start, cycles);
     }
-    return _cpu_read_ind_read_val;
+
+    _cpu_step_end(c);
+    return c->cyc - cyc_start;
 }
 
-void *_cpu_read_ind_read_val(Cpu6502 *c) {
-    int op_a = (c->ir & 0b11100000) >> 5;
-    int op_b = (c->ir & 0b00011100) >> 2;
+bool cpu_trace_start(Cpu6502 *c, CpuTrace *t, CpuTraceRecord *records, u32 capacity) {
+    if (capacity == 0 || (capacity & (capacity - 1)) != 0) {
+        return false;
+    }
+    t->records = records;
+    t->mask    = capacity - 1;
+    t->n       = 0;
+    t->block   = NULL;
+    c->trace   = t;
+    return true;
+}
+
+void cpu_trace_stop(Cpu6502 *c) {
+    c->trace = NULL;
+}
 
-    if (op_b == 0) { // X,ind
-        c->addr_bus = (c->data_bus << 8) | c->pd;
+u64 cpu_trace_count(CpuTrace *t) {
+    return t->n < (u64)t->mask + 1 ? t->n : (u64)t->mask + 1;
+}
+
+const CpuTraceRecord *cpu_trace_get(CpuTrace *t, u64 i) {
+    return &t->records[(t->n - cpu_trace_count(t) + i) & t->mask];
+}
+
+void cpu_trace_format(const CpuTraceRecord *r, char *line, size_t size) {
+    const DecodedInstruction *d   = &DECODED_INSTRUCTIONS[r->bytes[0]];
+    u8                        lo  = r->bytes[1];
+    u16                       abs = lo | (r->bytes[2] << 8);
+
+    char bytes[9];
+    switch (d->size) {
+        case 1:
+            snprintf(bytes, sizeof(bytes), "%02X", r->bytes[0]);
+            break;
+        case 2:
+            snprintf(bytes, sizeof(bytes), "%02X %02X", r->bytes[0], lo);
+            break;
+        default:
+            snprintf(bytes, sizeof(bytes), "%02X %02X %02X", r->bytes[0], lo, r->bytes[2]);
+            break;
     }
-    else if (op_b == 4) { // ind,Y
-        c->addr_bus = (c->data_bus + c->y);
-        u16 before  = c->addr_bus;
-        c->addr_bus += c->y;
-        if ((c->addr_bus & 0xFF00) != (before & 0xFF00)) {
-            return _cpu_page_boundary;
-        }
+
+    char operand[16];
+    switch (d->mode) {
+        case AM_impl:
+            operand[0] = '\0';
+            break;
+        case AM_A:
+            snprintf(operand, sizeof(operand), " A");
+            break;
+        case AM_imm:
+            snprintf(operand, sizeof(operand), " #$%02X", lo);
+            break;
+        case AM_zpg:
+            snprintf(operand, sizeof(operand), " $%02X", lo);
+            break;
+        case AM_zpgX:
+            snprintf(operand, sizeof(operand), " $%02X,X", lo);
+            break;
+        case AM_zpgY:
+            snprintf(operand, sizeof(operand), " $%02X,Y", lo);
+            break;
+        case AM_zpgind:
+            snprintf(operand, sizeof(operand), " ($%02X)", lo);
+            break;
+        case AM_Xind:
+            snprintf(operand, sizeof(operand), " ($%02X,X)", lo);
+            break;
+        case AM_indY:
+            snprintf(operand, sizeof(operand), " ($%02X),Y", lo);
+            break;
+        case AM_abs:
+            snprintf(operand, sizeof(operand), " $%04X", abs);
+            break;
+        case AM_absX:
+            snprintf(operand, sizeof(operand), " $%04X,X", abs);
+            break;
+        case AM_absY:
+            snprintf(operand, sizeof(operand), " $%04X,Y", abs);
+            break;
+        case AM_ind:
+            snprintf(operand, sizeof(operand), " ($%04X)", abs);
+            break;
+        case AM_absXind:
+            snprintf(operand, sizeof(operand), " ($%04X,X)", abs);
+            break;
+        case AM_rel:
+            snprintf(operand, sizeof(operand), " $%04X", (u16)(r->pc + 2 + (int8_t)lo));
+            break;
     }
 
-    if (op_a == 4) { // STA
-        c->data_bus = c->a;
-        unsetflag(c->bit_fields, PIN_READ);
-        return _cpu_write_zpg_fetch;
+    char text[32];
+    snprintf(text, sizeof(text), "%s%s", CPU_MNEMONICS[r->bytes[0]], operand);
+    u64 dots = r->cyc * 3; // no odd frame skipped, as nestest doesn't render
+    snprintf(line, size, "%04X  %-8s  %-31s A:%02X X:%02X Y:%02X P:%02X SP:%02X PPU:%3lu,%3lu CYC:%lu",
+             r->pc, bytes, text, r->a, r->x, r->y, r->p, r->sp, dots / 341 % 262, dots % 341, r->cyc);
+}
+
+void cpu_trace_dump(CpuTrace *t, FILE *f) {
+    char line[128];
+    for (u64 i = 0; i < cpu_trace_count(t); i++) {
+        cpu_trace_format(cpu_trace_get(t, i), line, sizeof(line));
+        fprintf(f, "%s\n", line);
     }
+}
 
-    return _cpu_read_addr;
+#ifdef CPU_OPCODE_STATS
+void cpu_opcode_stats_reset(Cpu6502 *c) {
+    memset(&c->opcode_stats, 0, sizeof(c->opcode_stats));
+    c->opcode_stats.boundary_cyc = c->cyc;
 }
 
+int _cpu_opcode_stat_cmp(const void *a, const void *b) {
+    const CpuOpcodeStat *x = a;
+    const CpuOpcodeStat *y = b;
+    return x->cycles < y->cycles ? 1 : x->cycles > y->cycles ? -1 : x->opcode - y->opcode;
+}
 
-void *_cpu_rel_addr_inc(Cpu6502 *c) {
-    u16 pc_before = c->pc;
-    c->pc += c->data_bus;
+int cpu_opcode_stats_top(Cpu6502 *c, CpuOpcodeStat *top, int n) {
+    CpuOpcodeStat all[0x100];
+    int           n_ran = 0;
+    for (int i = 0; i < 0x100; i++) {
+        if (c->opcode_stats.count[i] == 0) {
+            continue;
+        }
+        all[n_ran++] = (CpuOpcodeStat) {
+            opcode: i,
+            count: c->opcode_stats.count[i],
+            cycles: c->opcode_stats.cycles[i],
+            page_crosses: c->opcode_stats.page_crosses[i],
+        };
+    }
+    qsort(all, n_ran, sizeof(all[0]), _cpu_opcode_stat_cmp);
 
-    if ((pc_before & 0xFF00) != (c->pc & 0xFF00)) {
-        return _cpu_page_boundary;
+    if (n > n_ran) {
+        n = n_ran;
     }
+    memcpy(top, all, n * sizeof(all[0]));
+    return n;
+}
+
+void cpu_opcode_stats_print(Cpu6502 *c, FILE *f, int n) {
+    static const char *const modes[] = {
+        [AM_A] = "A",
+        [AM_abs] = "abs",
+        [AM_absX] = "abs,X",
+        [AM_absY] = "abs,Y",
+        [AM_imm] = "#",
+        [AM_impl] = "",
+        [AM_ind] = "(abs)",
+        [AM_Xind] = "(zpg,X)",
+        [AM_indY] = "(zpg),Y",
+        [AM_rel] = "rel",
+        [AM_zpg] = "zpg",
+        [AM_zpgX] = "zpg,X",
+        [AM_zpgY] = "zpg,Y",
+        [AM_zpgind] = "(zpg)",
+        [AM_absXind] = "(abs,X)",
+    };
 
-    return _cpu_page_boundary(c);
-}
\ No newline at end of file
+    CpuOpcodeStat top[0x100];
+    u64           total = 0;
+    for (int i = 0; i < 0x100; i++) {
+        total += c->opcode_stats.cycles[i];
+    }
+    total += c->opcode_stats.interrupt_cycles;
+    n = cpu_opcode_stats_top(c, top, n < 0x100 ? n : 0x100);
+
+    fprintf(f, "  %-15s %12s %13s %6s %13s\n", "opcode", "count", "cycles", "share", "page crosses");
+    for (int i = 0; i < n; i++) {
+        fprintf(f, "  $%02X %-3s %-7s %12lu %13lu %5.1f%% %13lu\n",
+                top[i].opcode, CPU_MNEMONICS[top[i].opcode], modes[DECODED_INSTRUCTIONS[top[i].opcode].mode],
+                top[i].count, top[i].cycles, total ? 100.0 * top[i].cycles / total : 0.0, top[i].page_crosses);
+    }
+    fprintf(f, "  %-15s %12lu %13lu\n", "interrupts", c->opcode_stats.interrupts, c->opcode_stats.interrupt_cycles);
+}
+#endif
@@ -0,0 +1,328 @@
+#include "headers/cpulanes.h"
+#include "headers/instructions.h"
+#include "string.h"
+
+// cpu6502.c internals
+void _cpu_step_end(Cpu6502 *c);
+
+void cpu_lanes_init(CpuLanes *l, int n_lanes) {
+    memset(l, 0, sizeof(CpuLanes));
+    l->n_lanes = n_lanes;
+}
+
+void cpu_lanes_load(CpuLanes *l, int lane, Cpu6502 *c) {
+    l->a[lane]      = c->a;
+    l->x[lane]      = c->x;
+    l->y[lane]      = c->y;
+    l->sp[lane]     = c->sp;
+    l->p[lane]      = cpu_get_p(c);
+    l->pc[lane]     = c->pc;
+    l->ir[lane]     = c->ir;
+    l->pins[lane]   = c->bit_fields & (PIN_NMI | PIN_IRQ);
+    l->cyc[lane]    = c->cyc;
+    l->memmap[lane] = c->memmap;
+}
+
+void cpu_lanes_store(CpuLanes *l, int lane, Cpu6502 *c) {
+    c->a      = l->a[lane];
+    c->x      = l->x[lane];
+    c->y      = l->y[lane];
+    c->sp     = l->sp[lane];
+    c->pc     = l->pc[lane];
+    c->ir     = l->ir[lane];
+    setunsetflag(c->bit_fields, PIN_NMI, l->pins[lane] & PIN_NMI);
+    setunsetflag(c->bit_fields, PIN_IRQ, l->pins[lane] & PIN_IRQ);
+    c->cyc    = l->cyc[lane];
+    c->memmap = l->memmap[lane];
+    cpu_set_p(c, l->p[lane]);
+    _cpu_step_end(c);
+}
+
+// N from bit 7 of val, Z if it's 0, in every lane
+#define _lanes_nz(p, val)                                                 \
+    (((p) & (u8) ~(STAT_N_NEGATIVE | STAT_Z_ZERO)) | ((val)&STAT_N_NEGATIVE) \
+     | ((LaneVec)((val) == 0) & STAT_Z_ZERO))
+
+LaneVec *_lanes_reg(CpuLanes *l, CpuRegister r) {
+    switch (r) {
+        case REG_A:
+            return &l->a;
+        case REG_X:
+            return &l->x;
+        case REG_Y:
+            return &l->y;
+        case REG_SP:
+            return &l->sp;
+        default:
+            return NULL;
+    }
+}
+
+// binary only, like _cpu_adc_binary. Vectors are passed by pointer, as the ABI for
+// passing them by value depends on whether AVX is enabled.
+void _lanes_adc(CpuLanes *l, const LaneVec *operand) {
+    LaneVec val   = *operand;
+    LaneVec t     = l->a + val;
+    LaneVec sum   = t + (l->p & STAT_C_CARRY);
+    LaneVec carry = (LaneVec)((t < l->a) | (sum < t)) & STAT_C_CARRY;
+    LaneVec v     = ((~(l->a ^ val) & (l->a ^ sum)) >> 1) & STAT_V_OVERFLOW;
+
+    l->a = sum;
+    l->p = (l->p & (u8) ~(STAT_C_CARRY | STAT_V_OVERFLOW)) | carry | v;
+    l->p = _lanes_nz(l->p, l->a);
+}
+
+// _cpu_modify for every lane, in place
+void _lanes_modify(CpuLanes *l, AluOp alu, LaneVec *operand) {
+    LaneVec val   = *operand;
+    LaneVec c0    = l->p & STAT_C_CARRY;
+    LaneVec carry = c0;
+    switch (alu) {
+        case ALU_ASL:
+            carry = val >> 7;
+            val <<= 1;
+            break;
+        case ALU_LSR:
+            carry = val & 0x01;
+            val >>= 1;
+            break;
+        case ALU_ROL:
+            carry = val >> 7;
+            val   = (val << 1) | c0;
+            break;
+        case ALU_ROR:
+            carry = val & 0x01;
+            val   = (val >> 1) | (c0 << 7);
+            break;
+        case ALU_INC:
+            val += 1;
+            break;
+        case ALU_DEC:
+            val -= 1;
+            break;
+        default:
+            return;
+    }
+    l->p     = (l->p & (u8)~STAT_C_CARRY) | carry;
+    l->p     = _lanes_nz(l->p, val);
+    *operand = val;
+}
+
+// _cpu_alu for every lane
+void _lanes_alu(CpuLanes *l, const DecodedInstruction *d, const LaneVec *operand) {
+    LaneVec  val = *operand;
+    LaneVec *reg = _lanes_reg(l, d->reg);
+    switch (d->alu) {
+        case ALU_ORA:
+            *reg |= val;
+            l->p = _lanes_nz(l->p, *reg);
+            break;
+        case ALU_AND:
+            *reg &= val;
+            l->p = _lanes_nz(l->p, *reg);
+            break;
+        case ALU_EOR:
+            *reg ^= val;
+            l->p = _lanes_nz(l->p, *reg);
+            break;
+        case ALU_ADC:
+            _lanes_adc(l, &val);
+            break;
+        case ALU_SBC:
+            val = ~val;
+            _lanes_adc(l, &val);
+            break;
+        case ALU_CMP:
+        {
+            LaneVec carry = (LaneVec)(*reg >= val) & STAT_C_CARRY;
+            l->p          = (l->p & (u8)~STAT_C_CARRY) | carry;
+            l->p          = _lanes_nz(l->p, *reg - val);
+            break;
+        }
+        case ALU_BIT:
+            l->p = (l->p & (u8) ~(STAT_N_NEGATIVE | STAT_V_OVERFLOW | STAT_Z_ZERO))
+                 | (val & (STAT_N_NEGATIVE | STAT_V_OVERFLOW))
+                 | ((LaneVec)((val & l->a) == 0) & STAT_Z_ZERO);
+            break;
+        case ALU_LD:
+            *reg = val;
+            l->p = _lanes_nz(l->p, *reg);
+            break;
+        case ALU_MOV:
+            *reg = val;
+            break;
+        default:
+            break;
+    }
+}
+
+void _lanes_implied(CpuLanes *l, const DecodedInstruction *d) {
+    switch (d->alu) {
+        case ALU_NONE:
+            break;
+        case ALU_CLEAR:
+            l->p &= (u8)~d->flag;
+            break;
+        case ALU_SET:
+            l->p |= d->flag;
+            break;
+        case ALU_LD:
+        case ALU_MOV:
+            _lanes_alu(l, d, _lanes_reg(l, d->src));
+            break;
+        default: // INX, DEY, ...
+            _lanes_modify(l, d->alu, _lanes_reg(l, d->reg));
+            break;
+    }
+}
+
+void _lanes_read(CpuLanes *l, memaddr addr, LaneVec *val) {
+    for (int i = 0; i < l->n_lanes; i++) {
+        (*val)[i] = mem_read_addr(l->memmap[i], addr);
+    }
+}
+
+void _lanes_write(CpuLanes *l, memaddr addr, const LaneVec *val) {
+    for (int i = 0; i < l->n_lanes; i++) {
+        mem_write_addr(l->memmap[i], addr, (*val)[i]);
+    }
+}
+
+// What lockstep handles: everything else goes lane by lane
+bool _lanes_supported(const DecodedInstruction *d) {
+    switch (d->access) {
+        case CLASS_IMPLIED:
+        case CLASS_BRANCH:
+            return true;
+        case CLASS_READ:
+            return (d->mode == AM_imm || d->mode == AM_zpg || d->mode == AM_abs) && d->alu != ALU_BIT_IMM;
+        case CLASS_WRITE:
+            return (d->mode == AM_zpg || d->mode == AM_abs) && d->reg != REG_ZERO;
+        case CLASS_RMW:
+            return (d->mode == AM_A || d->mode == AM_zpg || d->mode == AM_abs) && d->alu != ALU_TSB && d->alu != ALU_TRB;
+        case CLASS_JMP:
+            return d->mode == AM_abs;
+        default:
+            return false;
+    }
+}
+
+void _lanes_step_each(CpuLanes *l) {
+    Cpu6502 c;
+    memset(&c, 0, sizeof(c));
+    for (int i = 0; i < l->n_lanes; i++) {
+        cpu_lanes_store(l, i, &c);
+        cpu_step(&c);
+        cpu_lanes_load(l, i, &c);
+    }
+    l->diverged++;
+}
+
+bool cpu_lanes_step(CpuLanes *l) {
+    memaddr pc = l->pc[0];
+    for (int i = 0; i < l->n_lanes; i++) {
+        bool irq = (l->pins[i] & PIN_IRQ) && (l->p[i] & STAT_I_INTERRUPT) == 0;
+        if (l->pc[i] != pc || (l->pins[i] & PIN_NMI) || irq) {
+            _lanes_step_each(l);
+            return false;
+        }
+    }
+
+    u8                        ir = mem_read_addr(l->memmap[0], pc);
+    const DecodedInstruction *d  = &DECODED_INSTRUCTIONS[ir];
+    if (!_lanes_supported(d)) {
+        _lanes_step_each(l);
+        return false;
+    }
+#if CPU_HAS_DECIMAL
+    // _lanes_adc is binary
+    if (d->alu == ALU_ADC || d->alu == ALU_SBC) {
+        for (int i = 0; i < l->n_lanes; i++) {
+            if (l->p[i] & STAT_D_DECIMAL) {
+                _lanes_step_each(l);
+                return false;
+            }
+        }
+    }
+#endif
+
+    // the opcode and any address bytes have to match; immediates may differ
+    u16 operand = 0;
+    if (d->size > 1) {
+        operand = mem_read_addr(l->memmap[0], pc + 1);
+    }
+    if (d->size > 2) {
+        operand |= mem_read_addr(l->memmap[0], pc + 2) << 8;
+    }
+    for (int i = 1; i < l->n_lanes; i++) {
+        u16 lane_operand = 0;
+        if (d->size > 1 && d->mode != AM_imm) {
+            lane_operand = mem_read_addr(l->memmap[i], pc + 1);
+        }
+        if (d->size > 2) {
+            lane_operand |= mem_read_addr(l->memmap[i], pc + 2) << 8;
+        }
+        if (mem_read_addr(l->memmap[i], pc) != ir || (d->mode != AM_imm && lane_operand != operand)) {
+            _lanes_step_each(l);
+            return false;
+        }
+    }
+
+    memaddr next   = pc + d->size;
+    u8      cycles = d->cycles;
+    LaneVec val    = {0};
+    switch (d->access) {
+        case CLASS_IMPLIED:
+            _lanes_implied(l, d);
+            break;
+        case CLASS_READ:
+            _lanes_read(l, d->mode == AM_imm ? pc + 1 : operand, &val);
+            _lanes_alu(l, d, &val);
+            break;
+        case CLASS_WRITE:
+            _lanes_write(l, operand, _lanes_reg(l, d->reg));
+            break;
+        case CLASS_RMW:
+            if (d->mode == AM_A) {
+                _lanes_modify(l, d->alu, &l->a);
+            }
+            else {
+                _lanes_read(l, operand, &val);
+                _lanes_modify(l, d->alu, &val);
+                _lanes_write(l, operand, &val);
+            }
+            break;
+        case CLASS_BRANCH:
+        {
+            LaneVec taken = (LaneVec)((l->p & d->flag) != 0);
+            if (d->alu == ALU_BRANCH_CLEAR) {
+                taken = ~taken;
+            }
+            for (int i = 1; i < l->n_lanes; i++) {
+                if (taken[i] != taken[0]) {
+                    _lanes_step_each(l);
+                    return false;
+                }
+            }
+            if (taken[0]) {
+                memaddr target = next + (int8_t)operand;
+                cycles += (next & 0xFF00) != (target & 0xFF00) ? 2 : 1;
+                next = target;
+            }
+            break;
+        }
+        case CLASS_JMP:
+            next = operand;
+            break;
+        default:
+            break;
+    }
+
+    for (int i = 0; i < l->n_lanes; i++) {
+        l->pc[i] = next;
+        l->ir[i] = ir;
+        l->cyc[i] += cycles;
+    }
+    l->lockstep++;
+    return true;
+}
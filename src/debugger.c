@@ -0,0 +1,174 @@
+#include "headers/debugger.h"
+#include "string.h"
+
+void debugger_init(Debugger *d, Cpu6502 *c) {
+    memset(d, 0, sizeof(Debugger));
+    d->cpu = c;
+}
+
+// The memory map is only told about the debugger while it has watchpoints,
+// and only routes the pages with some to it, so the others cost nothing.
+// Pages lo to hi are the ones whose watchpoints changed.
+void _debugger_attach(Debugger *d, uint lo, uint hi) {
+    MemoryMap *m = d->cpu->memmap;
+    m->debugger  = d->n_set[BREAK_READ] || d->n_set[BREAK_WRITE] ? d : NULL;
+    mem_hook_pages(m, lo, hi);
+}
+
+bool _debugger_bit(Debugger *d, BreakKind kind, memaddr addr) {
+    return (d->bits[kind][addr >> 6] >> (addr & 63)) & 1;
+}
+
+ConditionalBreak *_debugger_condition(Debugger *d, BreakKind kind, memaddr addr) {
+    for (uint i = 0; i < d->n_conditions; i++) {
+        if (d->conditions[i].kind == kind && d->conditions[i].addr == addr) {
+            return d->conditions + i;
+        }
+    }
+    return NULL;
+}
+
+void _debugger_drop_condition(Debugger *d, BreakKind kind, memaddr addr) {
+    ConditionalBreak *cb = _debugger_condition(d, kind, addr);
+    if (cb) {
+        *cb = d->conditions[--d->n_conditions];
+    }
+}
+
+bool debugger_set(Debugger *d, BreakKind kind, memaddr addr, const BreakCondition *condition) {
+    ConditionalBreak *cb = _debugger_condition(d, kind, addr);
+    if (condition) {
+        if (!cb) {
+            if (d->n_conditions == DEBUGGER_MAX_CONDITIONS) {
+                return false;
+            }
+            cb = d->conditions + d->n_conditions++;
+        }
+        *cb = (ConditionalBreak) {kind: kind, addr: addr, condition: *condition};
+    }
+    else if (cb) {
+        _debugger_drop_condition(d, kind, addr);
+    }
+
+    if (!_debugger_bit(d, kind, addr)) {
+        d->bits[kind][addr >> 6] |= (u64)1 << (addr & 63);
+        d->n_set[kind]++;
+    }
+    _debugger_attach(d, addr >> 8, addr >> 8);
+    return true;
+}
+
+void debugger_clear(Debugger *d, BreakKind kind, memaddr addr) {
+    if (_debugger_bit(d, kind, addr)) {
+        d->bits[kind][addr >> 6] &= ~((u64)1 << (addr & 63));
+        d->n_set[kind]--;
+        _debugger_drop_condition(d, kind, addr);
+    }
+    _debugger_attach(d, addr >> 8, addr >> 8);
+}
+
+void debugger_clear_all(Debugger *d) {
+    memset(d->bits, 0, sizeof(d->bits));
+    memset(d->n_set, 0, sizeof(d->n_set));
+    d->n_conditions = 0;
+    _debugger_attach(d, 0, 0xFF);
+}
+
+bool debugger_is_set(Debugger *d, BreakKind kind, memaddr addr) {
+    return _debugger_bit(d, kind, addr);
+}
+
+bool debugger_watches_page(Debugger *d, BreakKind kind, uint page) {
+    const u64 *bits = d->bits[kind] + page * (0x100 / 64);
+    return (bits[0] | bits[1] | bits[2] | bits[3]) != 0;
+}
+
+bool _debugger_holds(Debugger *d, const BreakCondition *cond, u8 value) {
+    Cpu6502 *c = d->cpu;
+    u8       operand;
+    switch (cond->operand) {
+        case BREAK_ON_A:
+            operand = c->a;
+            break;
+        case BREAK_ON_X:
+            operand = c->x;
+            break;
+        case BREAK_ON_Y:
+            operand = c->y;
+            break;
+        case BREAK_ON_SP:
+            operand = c->sp;
+            break;
+        case BREAK_ON_P:
+            operand = cpu_get_p(c);
+            break;
+        default:
+            operand = value;
+            break;
+    }
+    switch (cond->compare) {
+        case BREAK_EQ:
+            return operand == cond->value;
+        case BREAK_NE:
+            return operand != cond->value;
+        case BREAK_LT:
+            return operand < cond->value;
+        case BREAK_GE:
+            return operand >= cond->value;
+        case BREAK_ANY:
+            return (operand & cond->value) != 0;
+        default:
+            return false;
+    }
+}
+
+// Only called once the address's bit is known to be set.
+bool _debugger_hit(Debugger *d, BreakKind kind, memaddr addr, u8 value) {
+    ConditionalBreak *cb = d->n_conditions ? _debugger_condition(d, kind, addr) : NULL;
+    if (cb && !_debugger_holds(d, &cb->condition, value)) {
+        return false;
+    }
+    d->hit = (BreakHit) {pending: true, kind: kind, addr: addr, value: value, pc: d->cpu->pc, cyc: d->cpu->cyc};
+    return true;
+}
+
+// The opcode at addr without going through mem_read_addr, which would set off
+// read watchpoints.
+u8 _debugger_peek(Debugger *d, memaddr addr) {
+    MemoryBlock *b = mem_get_read_block(d->cpu->memmap, addr);
+    return b ? b->values[addr - b->range_low] : 0;
+}
+
+bool debugger_check(Cpu6502 *c, void *ctx) {
+    Debugger *d = ctx;
+    if (d->hit.pending) {
+        d->hit.pending = false;
+        return true;
+    }
+    if (_debugger_bit(d, BREAK_EXEC, c->pc) && _debugger_hit(d, BREAK_EXEC, c->pc, _debugger_peek(d, c->pc))) {
+        d->hit.pending = false;
+        return true;
+    }
+    return false;
+}
+
+CpuStopReason debugger_run(Debugger *d, u64 max_cycles) {
+    // a hit from an instruction that's over happened while stepping outside
+    // the debugger; one from the instruction under way stops at its end
+    if (d->cpu->tcu == 0) {
+        d->hit.pending = false;
+    }
+    return cpu_run_until(d->cpu, debugger_check, d, max_cycles);
+}
+
+void debugger_on_read(Debugger *d, memaddr addr, u8 value) {
+    if (_debugger_bit(d, BREAK_READ, addr)) {
+        _debugger_hit(d, BREAK_READ, addr, value);
+    }
+}
+
+void debugger_on_write(Debugger *d, memaddr addr, u8 value) {
+    if (_debugger_bit(d, BREAK_WRITE, addr)) {
+        _debugger_hit(d, BREAK_WRITE, addr, value);
+    }
+}
@@ -0,0 +1,551 @@
+#include "../headers/common.h"
+#include "../headers/cpu6502.h"
+#include "../headers/guestprofile.h"
+#include "../headers/jit.h"
+#include "../headers/log.h"
+#include "../headers/ppu.h"
+#include "../headers/ram.h"
+#include "../headers/rom.h"
+#include "stdio.h"
+#include "string.h"
+#include "time.h"
+
+// Throughput comparison of the cores on nestest:
+//   cpu_pulse         one indirect call through on_next_clock per clock
+//   cpu_run_threaded  computed-goto build of the same stages
+//   cpu_step          whole instructions, fetched through the memory map
+//   cpu_run_blocks    whole instructions out of the predecoded block cache
+//   cpu_run_jit       hot blocks compiled to x86-64
+// Before timing anything each pair is run side by side and compared. Saving
+// and loading CPU state is checked and timed too, and so is a PPU caught up
+// lazily against one run after every cycle, and the guest profiler's and the
+// execution trace's cost. So are memory deltas (mem_snapshot_delta), taken
+// every DELTA_INTERVAL cycles as a search or rewind would.
+
+const char *ROM_FILE = "./example/nestest-prg.rom";
+
+// The unofficial opcode tests start here, after ~14.5K cycles of official
+// ones. The core has no unofficial opcodes, so later on the run goes off the
+// rails; it's timed only up to this point, where make nestest stops too.
+#define ADDR_OFFICIAL_END 0xC6BD
+#define MAX_CYCLES        100000
+#define TARGET_CYCLES     50000000
+#define DELTA_INTERVAL    1000
+
+typedef struct {
+    Cpu6502      cpu;
+    MemoryMap    mem;
+    PPURegisters ppu;
+    Ram          ram;
+    u8           ram_mem[0x0800];
+    BlockCache   cache;
+    Jit          jit;
+    Cpu6502      cpu_after_reset; // so repeated runs don't log a reset each time
+    Scheduler    sched;
+} Machine;
+
+void machine_init(Machine *m, Rom *rom) {
+    m->mem.n_read_blocks  = 0;
+    m->mem.n_write_blocks = 0;
+    m->mem.n_io           = 0;
+    m->mem.block_cache    = NULL;
+    m->mem.debugger       = NULL;
+    mem_add_rom(&m->mem, rom, "ROM");
+
+    m->ram.map_offset = 0x0000;
+    m->ram.size       = sizeof(m->ram_mem);
+    m->ram.value      = m->ram_mem;
+    mem_add_ram(&m->mem, &m->ram, "RAM");
+
+    mem_add_ppu(&m->mem, &m->ppu);
+    block_cache_init(&m->cache, &m->mem);
+    jit_init(&m->jit, &m->cache);
+
+    memset(&m->cpu, 0, sizeof(m->cpu));
+    m->cpu.sp     = 0xFD;
+    m->cpu.memmap = &m->mem;
+    cpu_resb(&m->cpu);
+    m->cpu_after_reset = m->cpu;
+}
+
+void machine_reset(Machine *m) {
+    memset(m->ram_mem, 0, sizeof(m->ram_mem));
+    memset(&m->ppu, 0, sizeof(m->ppu));
+    block_cache_flush(&m->cache); // RAM was just changed behind its back
+    mem_dirty_all(&m->mem);
+    m->ppu.status = 0xA2;
+    m->cpu        = m->cpu_after_reset;
+}
+
+double now_s() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Cycles to the end of the official opcode tests, or 0 if the run never gets
+// there.
+u64 nestest_length(Machine *m) {
+    machine_reset(m);
+    if (cpu_run_until_pc(&m->cpu, ADDR_OFFICIAL_END, MAX_CYCLES) != CPU_STOP_PC) {
+        return 0;
+    }
+    return m->cpu.cyc;
+}
+
+#define cpu_field_mismatch(f) (a->f != b->f)
+bool cpus_differ(Cpu6502 *a, Cpu6502 *b) {
+    return cpu_field_mismatch(ir) || cpu_field_mismatch(tcu) || cpu_field_mismatch(pc)
+        || cpu_field_mismatch(x) || cpu_field_mismatch(y) || cpu_field_mismatch(a)
+        || cpu_field_mismatch(sp) || cpu_get_p(a) != cpu_get_p(b) || cpu_field_mismatch(pd)
+        || cpu_field_mismatch(cyc) || cpu_field_mismatch(bit_fields)
+        || cpu_field_mismatch(addr_bus) || cpu_field_mismatch(data_bus)
+        || cpu_field_mismatch(on_next_clock);
+}
+
+bool machines_differ(Machine *a, Machine *b) {
+    return cpus_differ(&a->cpu, &b->cpu) || memcmp(a->ram_mem, b->ram_mem, sizeof(a->ram_mem)) != 0;
+}
+
+bool verify(Machine *a, Machine *b, u64 cycles) {
+    machine_reset(a);
+    machine_reset(b);
+    for (u64 i = 0; i < cycles; i++) {
+        cpu_pulse(&a->cpu);
+        cpu_run_threaded(&b->cpu, 1);
+        if (machines_differ(a, b)) {
+            printf("Mismatch on cycle %lu: pulse PC $%04x bus $%04x=$%02x, threaded PC $%04x bus $%04x=$%02x\n",
+                   i + 1,
+                   a->cpu.pc, a->cpu.addr_bus, a->cpu.data_bus,
+                   b->cpu.pc, b->cpu.addr_bus, b->cpu.data_bus);
+            return false;
+        }
+    }
+
+    // and once more as a single batch
+    machine_reset(b);
+    cpu_run_threaded(&b->cpu, cycles);
+    if (machines_differ(a, b)) {
+        printf("Mismatch after a %lu cycle batch\n", cycles);
+        return false;
+    }
+    return true;
+}
+
+// Both stop on the first instruction boundary at or after `cycles`.
+bool verify_blocks(Machine *a, Machine *b, u64 cycles) {
+    machine_reset(a);
+    machine_reset(b);
+    while (a->cpu.cyc < cycles) {
+        cpu_step(&a->cpu);
+    }
+    cpu_run_blocks(&b->cpu, &b->cache, cycles);
+    if (machines_differ(a, b)) {
+        printf("Mismatch: cpu_step PC $%04x cycle %lu, cpu_run_blocks PC $%04x cycle %lu\n",
+               a->cpu.pc, a->cpu.cyc, b->cpu.pc, b->cpu.cyc);
+        return false;
+    }
+    return true;
+}
+
+// The JIT stops on block boundaries, so cpu_step is run up to wherever it stopped.
+bool verify_jit(Machine *a, Machine *b, u64 cycles) {
+    machine_reset(a);
+    machine_reset(b);
+    cpu_run_jit(&b->cpu, &b->jit, cycles);
+    while (a->cpu.cyc < b->cpu.cyc) {
+        cpu_step(&a->cpu);
+    }
+    if (machines_differ(a, b)) {
+        printf("Mismatch: cpu_step PC $%04x cycle %lu, cpu_run_jit PC $%04x cycle %lu\n",
+               a->cpu.pc, a->cpu.cyc, b->cpu.pc, b->cpu.cyc);
+        return false;
+    }
+    return true;
+}
+
+// Every engine charges the same cycles to the same instructions, all of them.
+bool verify_profile(Machine *a, Machine *b, u64 cycles) {
+    static GuestProfile step, other;
+    machine_reset(a);
+    guest_profile_clear(&step);
+    guest_profile_attach(&a->cpu, &step);
+    while (a->cpu.cyc < cycles) {
+        cpu_step(&a->cpu);
+    }
+    if (guest_profile_total(&step) != a->cpu.cyc) {
+        printf("cpu_step charged %lu of %lu cycles\n", guest_profile_total(&step), a->cpu.cyc);
+        return false;
+    }
+
+    const char *engines[] = {"cpu_run_threaded", "cpu_run_blocks", "cpu_run_jit"};
+    for (int i = 0; i < 3; i++) {
+        machine_reset(b);
+        guest_profile_clear(&other);
+        guest_profile_attach(&b->cpu, &other);
+        switch (i) {
+            case 0:
+                cpu_run_threaded(&b->cpu, a->cpu.cyc); // ends on the same boundary
+                break;
+            case 1:
+                cpu_run_blocks(&b->cpu, &b->cache, cycles);
+                break;
+            case 2:
+                cpu_run_jit(&b->cpu, &b->jit, cycles);
+                break;
+        }
+        if (memcmp(step.cycles, other.cycles, sizeof(step.cycles)) != 0) {
+            printf("%s's profile differs from cpu_step's\n", engines[i]);
+            return false;
+        }
+    }
+    return true;
+}
+
+// Every engine traces the same instructions in the same states.
+bool verify_trace(Machine *a, Machine *b, u64 cycles) {
+#define TRACE_CAPACITY (1 << 16)
+    static CpuTraceRecord step_records[TRACE_CAPACITY], other_records[TRACE_CAPACITY];
+    CpuTrace              step, other;
+    machine_reset(a);
+    cpu_trace_start(&a->cpu, &step, step_records, TRACE_CAPACITY);
+    while (a->cpu.cyc < cycles) {
+        cpu_step(&a->cpu);
+    }
+
+    const char *engines[] = {"cpu_run_threaded", "cpu_run_blocks", "cpu_run_jit"};
+    for (int i = 0; i < 3; i++) {
+        machine_reset(b);
+        cpu_trace_start(&b->cpu, &other, other_records, TRACE_CAPACITY);
+        switch (i) {
+            case 0:
+                cpu_run_threaded(&b->cpu, a->cpu.cyc);
+                break;
+            case 1:
+                cpu_run_blocks(&b->cpu, &b->cache, cycles);
+                break;
+            case 2:
+                cpu_run_jit(&b->cpu, &b->jit, cycles);
+                break;
+        }
+        if (other.n != step.n || memcmp(step_records, other_records, sizeof(step_records)) != 0) {
+            printf("%s's trace differs from cpu_step's\n", engines[i]);
+            return false;
+        }
+    }
+    return true;
+}
+
+// Gives the PPU the CPU's clock; machine_reset takes it away again.
+void machine_attach_ppu(Machine *m) {
+    scheduler_init(&m->sched, &m->cpu);
+    ppu_attach(&m->ppu, &m->cpu, &m->sched);
+}
+
+void run_ppu_lockstep(Machine *m, u64 cycles) {
+    for (u64 i = 0; i < cycles; i++) {
+        cpu_pulse(&m->cpu);
+        ppu_catch_up(&m->ppu);
+        scheduler_run_due(&m->sched);
+    }
+}
+
+bool verify_ppu(Machine *a, Machine *b, u64 cycles) {
+    machine_reset(a);
+    machine_reset(b);
+    machine_attach_ppu(a);
+    machine_attach_ppu(b);
+    run_ppu_lockstep(a, cycles);
+    scheduler_run(&b->sched, cycles);
+    ppu_catch_up(&b->ppu);
+    if (machines_differ(a, b) || a->ppu.frame != b->ppu.frame || a->ppu.scanline != b->ppu.scanline
+        || a->ppu.dot != b->ppu.dot || a->ppu.status != b->ppu.status) {
+        printf("Mismatch: lockstep PC $%04x frame %lu scanline %u, catch-up PC $%04x frame %lu scanline %u\n",
+               a->cpu.pc, a->ppu.frame, a->ppu.scanline, b->cpu.pc, b->ppu.frame, b->ppu.scanline);
+        return false;
+    }
+    return true;
+}
+
+// A full delta at reset and one every DELTA_INTERVAL cycles after, restored in
+// order over garbage, rebuild RAM as it was when each was taken.
+bool verify_delta(Machine *a, u64 cycles) {
+    uint      n_max    = cycles / DELTA_INTERVAL + 2;
+    MemDelta *deltas   = calloc(n_max, sizeof(MemDelta));
+    u8       *expected = malloc(n_max * sizeof(a->ram_mem));
+    uint      n        = 0;
+    bool      ok       = true;
+
+    machine_reset(a);
+    do {
+        if (n > 0) {
+            cpu_run_cycles(&a->cpu, DELTA_INTERVAL);
+        }
+        mem_snapshot_delta(&a->mem, deltas + n);
+        memcpy(expected + n * sizeof(a->ram_mem), a->ram_mem, sizeof(a->ram_mem));
+        n++;
+    } while (a->cpu.cyc < cycles && n < n_max);
+
+    memset(a->ram_mem, 0xA5, sizeof(a->ram_mem));
+    for (uint i = 0; i < n && ok; i++) {
+        mem_restore_delta(&a->mem, deltas + i);
+        if (memcmp(a->ram_mem, expected + i * sizeof(a->ram_mem), sizeof(a->ram_mem)) != 0) {
+            printf("Mismatch: RAM rebuilt from %u deltas differs from cycle %u's\n", i + 1, i * DELTA_INTERVAL);
+            ok = false;
+        }
+    }
+
+    for (uint i = 0; i < n; i++) {
+        mem_delta_free(deltas + i);
+    }
+    free(deltas);
+    free(expected);
+    return ok;
+}
+
+// A snapshot taken on any clock, mid-instruction or not, restores the same CPU.
+bool verify_state(Machine *a, u64 cycles) {
+    machine_reset(a);
+    for (u64 i = 0; i < cycles; i++) {
+        cpu_pulse(&a->cpu);
+
+        CpuState state;
+        Cpu6502  restored;
+        memset(&restored, 0xA5, sizeof(restored));
+        cpu_save_state(&a->cpu, &state);
+        if (!cpu_load_state(&restored, &state) || cpus_differ(&a->cpu, &restored)
+            || restored.jsr_juggle_addr_because_im_lazy != a->cpu.jsr_juggle_addr_because_im_lazy
+            || restored.nz != a->cpu.nz) {
+            printf("Mismatch on cycle %lu: PC $%04x restored as $%04x, stage %s restored as %s\n",
+                   i + 1, a->cpu.pc, restored.pc,
+                   cpu_stage_name(cpu_get_stage(&a->cpu)), cpu_stage_name(cpu_get_stage(&restored)));
+            return false;
+        }
+    }
+    return true;
+}
+
+void report(const char *name, u64 cycles, double secs, double baseline) {
+    printf("  %-18s %10.2f Mcycles/s  (%.3fs)", name, cycles / secs / 1e6, secs);
+    if (baseline > 0) {
+        printf("  x%.2f", baseline / secs);
+    }
+    printf("\n");
+}
+
+int main() {
+    Rom rom;
+    if (!rom_load(&rom, ROM_FILE)) {
+        fprintf(stderr, "Failed to open nestest ROM\n");
+        return 1;
+    }
+
+    static Machine a, b;
+    machine_init(&a, &rom);
+    machine_init(&b, &rom);
+
+    u64 run_cycles = nestest_length(&a);
+    if (!run_cycles) {
+        printf("nestest never reached the end of its official opcode tests ($%04x)\n", ADDR_OFFICIAL_END);
+        return 1;
+    }
+    u64 runs = TARGET_CYCLES / run_cycles + 1;
+    printf("nestest: %lu cycles per run, %lu runs\n", run_cycles, runs);
+
+    if (!verify(&a, &b, run_cycles)) {
+        printf("cpu_run_threaded does not match cpu_pulse\n");
+        return 1;
+    }
+    printf("cpu_run_threaded matches cpu_pulse cycle for cycle\n");
+
+    if (!verify_blocks(&a, &b, run_cycles)) {
+        printf("cpu_run_blocks does not match cpu_step\n");
+        return 1;
+    }
+    printf("cpu_run_blocks matches cpu_step\n");
+
+    bool jit = b.jit.arena != NULL;
+    if (jit && !verify_jit(&a, &b, run_cycles)) {
+        printf("cpu_run_jit does not match cpu_step\n");
+        return 1;
+    }
+    printf(jit ? "cpu_run_jit matches cpu_step\n" : "cpu_run_jit not available here\n");
+
+    if (!verify_state(&a, run_cycles)) {
+        printf("cpu_load_state does not restore what cpu_save_state saved\n");
+        return 1;
+    }
+    printf("cpu_save_state/cpu_load_state round trip on every cycle\n");
+
+    if (!verify_ppu(&a, &b, run_cycles)) {
+        printf("PPU catch-up does not match running it every cycle\n");
+        return 1;
+    }
+    printf("PPU catch-up matches running it every cycle\n");
+
+    if (!verify_profile(&a, &b, run_cycles)) {
+        return 1;
+    }
+    printf("guest profiles match cpu_step's\n");
+
+    if (!verify_trace(&a, &b, run_cycles)) {
+        return 1;
+    }
+    printf("traces match cpu_step's\n");
+
+    if (!verify_delta(&a, run_cycles)) {
+        return 1;
+    }
+    printf("memory deltas rebuild RAM every %d cycles\n", DELTA_INTERVAL);
+
+    double start = now_s();
+    for (u64 r = 0; r < runs; r++) {
+        machine_reset(&a);
+        for (u64 i = 0; i < run_cycles; i++) {
+            cpu_pulse(&a.cpu);
+        }
+    }
+    double pulse_s = now_s() - start;
+
+    start = now_s();
+    for (u64 r = 0; r < runs; r++) {
+        machine_reset(&b);
+        cpu_run_threaded(&b.cpu, run_cycles);
+    }
+    double threaded_s = now_s() - start;
+
+    start = now_s();
+    for (u64 r = 0; r < runs; r++) {
+        machine_reset(&a);
+        while (a.cpu.cyc < run_cycles) {
+            cpu_step(&a.cpu);
+        }
+    }
+    double step_s = now_s() - start;
+
+    b.cache.hits   = 0;
+    b.cache.misses = 0;
+    start          = now_s();
+    for (u64 r = 0; r < runs; r++) {
+        machine_reset(&b);
+        cpu_run_blocks(&b.cpu, &b.cache, run_cycles);
+    }
+    double blocks_s = now_s() - start;
+
+    double jit_s = 0;
+    if (jit) {
+        start = now_s();
+        for (u64 r = 0; r < runs; r++) {
+            machine_reset(&b);
+            cpu_run_jit(&b.cpu, &b.jit, run_cycles);
+        }
+        jit_s = now_s() - start;
+    }
+
+    start = now_s();
+    for (u64 r = 0; r < runs; r++) {
+        machine_reset(&a);
+        machine_attach_ppu(&a);
+        run_ppu_lockstep(&a, run_cycles);
+    }
+    double ppu_lockstep_s = now_s() - start;
+
+    start = now_s();
+    for (u64 r = 0; r < runs; r++) {
+        machine_reset(&b);
+        machine_attach_ppu(&b);
+        scheduler_run(&b.sched, run_cycles);
+    }
+    double ppu_catch_up_s = now_s() - start;
+    // the last run's, before the next loop resets b's PPU
+    u64 catch_ups = b.ppu.catch_ups;
+    u64 frames    = b.ppu.frame;
+
+    static GuestProfile profile;
+    start = now_s();
+    for (u64 r = 0; r < runs; r++) {
+        machine_reset(&b);
+        guest_profile_attach(&b.cpu, &profile);
+        cpu_run_threaded(&b.cpu, run_cycles);
+    }
+    double threaded_profiled_s = now_s() - start;
+
+    start = now_s();
+    for (u64 r = 0; r < runs; r++) {
+        machine_reset(&b);
+        guest_profile_attach(&b.cpu, &profile);
+        cpu_run_blocks(&b.cpu, &b.cache, run_cycles);
+    }
+    double blocks_profiled_s = now_s() - start;
+
+    static CpuTraceRecord records[TRACE_CAPACITY];
+    CpuTrace              trace;
+    start = now_s();
+    for (u64 r = 0; r < runs; r++) {
+        machine_reset(&b);
+        cpu_trace_start(&b.cpu, &trace, records, TRACE_CAPACITY);
+        cpu_run_threaded(&b.cpu, run_cycles);
+    }
+    double threaded_traced_s = now_s() - start;
+
+    start = now_s();
+    for (u64 r = 0; r < runs; r++) {
+        machine_reset(&b);
+        cpu_trace_start(&b.cpu, &trace, records, TRACE_CAPACITY);
+        cpu_run_blocks(&b.cpu, &b.cache, run_cycles);
+    }
+    double blocks_traced_s = now_s() - start;
+
+    MemDelta delta       = {0};
+    u64      n_deltas    = 0;
+    u64      delta_bytes = 0;
+    start                = now_s();
+    for (u64 r = 0; r < runs; r++) {
+        machine_reset(&b);
+        mem_snapshot_delta(&b.mem, &delta); // the full one
+        while (b.cpu.cyc < run_cycles) {
+            cpu_run_blocks(&b.cpu, &b.cache, DELTA_INTERVAL);
+            mem_snapshot_delta(&b.mem, &delta);
+            n_deltas++;
+            delta_bytes += delta.size;
+        }
+    }
+    double blocks_delta_s = now_s() - start;
+    mem_delta_free(&delta);
+
+    // snapshot and restore mid-instruction, as rewind would
+    machine_reset(&a);
+    cpu_run_cycles(&a.cpu, 3);
+    CpuState state;
+    u64      snapshots = runs * 100000;
+    start              = now_s();
+    for (u64 i = 0; i < snapshots; i++) {
+        cpu_save_state(&a.cpu, &state);
+        cpu_load_state(&a.cpu, &state);
+    }
+    double state_s = now_s() - start;
+
+    report("cpu_pulse", runs * run_cycles, pulse_s, 0);
+    report("cpu_run_threaded", runs * run_cycles, threaded_s, pulse_s);
+    report("cpu_step", runs * run_cycles, step_s, pulse_s);
+    report("cpu_run_blocks", runs * run_cycles, blocks_s, pulse_s);
+    printf("block cache: %lu hits, %lu misses\n", b.cache.hits, b.cache.misses);
+    if (jit) {
+        report("cpu_run_jit", runs * run_cycles, jit_s, pulse_s);
+        printf("jit: %lu blocks compiled, %lu native runs\n", b.jit.compiled, b.jit.native_runs);
+    }
+    report("threaded + profile", runs * run_cycles, threaded_profiled_s, threaded_s);
+    report("blocks + profile", runs * run_cycles, blocks_profiled_s, blocks_s);
+    report("threaded + trace", runs * run_cycles, threaded_traced_s, threaded_s);
+    report("blocks + trace", runs * run_cycles, blocks_traced_s, blocks_s);
+    report("blocks + deltas", runs * run_cycles, blocks_delta_s, blocks_s);
+    report("PPU lockstep", runs * run_cycles, ppu_lockstep_s, pulse_s);
+    report("PPU catch-up", runs * run_cycles, ppu_catch_up_s, pulse_s);
+    printf("PPU: caught up %lu times in %lu frames per run of %.2f frames\n", catch_ups, frames,
+           (double)run_cycles * PPU_DOTS_PER_CYCLE / (PPU_SCANLINES * PPU_DOTS_PER_SCANLINE));
+    printf("cpu state: %.1fns per save and load (%d bytes)\n", state_s / snapshots * 1e9, CPU_STATE_SIZE);
+    printf("memory deltas: %.1f bytes per snapshot every %d cycles, of %lu bytes of RAM\n",
+           (double)delta_bytes / n_deltas, DELTA_INTERVAL, sizeof(a.ram_mem));
+
+    return 0;
+}
@@ -15,7 +15,8 @@ typedef enum {
 //     TV_DUAL = 1,// 3
 // } TVSystem;
 
-// TODO: Create direct load as well instead of bin -> ascii -> bin
+// Only for NROM: banked cartridges are loaded as they are, with
+// mapper_load_ines (mapper.h).
 int main(int argc, char *argv[]) {
     if (argc < 3) {
         fprintf(stderr, "Usage: ines2rom <src> <prg-dest>\n");
@@ -94,7 +95,7 @@ int main(int argc, char *argv[]) {
         return 1;
     }
     if (mapper != 0) {
-        fprintf(stderr, "Unsupported Mapper.\n");
+        fprintf(stderr, "Mapper %i switches banks, which a flat PRG ROM can't: load the iNES itself with mapper_load_ines.\n", mapper);
         return 1;
     }
 
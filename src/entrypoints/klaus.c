@@ -0,0 +1,124 @@
+#include "../headers/common.h"
+#include "../headers/cpu6502.h"
+#include "../headers/jit.h"
+#include "../headers/log.h"
+#include "../headers/ram.h"
+#include "../headers/rom.h"
+#include "stdio.h"
+#include "string.h"
+#include "time.h"
+
+// Klaus Dormann's 6502 functional test. The image covers the whole address
+// space and modifies its own code, so it's all loaded as RAM. The test ends in
+// a `JMP *` or `BNE *` trap: $3469 is success, anything else is the failing
+// check. The BCD checks start at $346F; they fail on a core without decimal
+// mode like the 2A03, which passes there. The NMOS and 65C02 builds have to
+// get through them.
+
+const char *ROM_FILE = "./example/klaus2m5_functional_test.rom";
+
+#define ADDR_START      0x0400
+#define ADDR_SUCCESS    0x3469
+#define ADDR_DECIMAL    0x346F // chkdad and friends
+#define MAX_CYCLES      200000000
+#define CYCLES_PER_CALL 10000
+
+// Configured by flags:
+bool use_cpu_pulse  = false; // cycle by cycle on the threaded engine (cpu_run_cycles)
+bool use_cpu_blocks = false; // whole instructions out of the predecoded block cache
+bool use_cpu_jit    = false; // hot blocks compiled to native code
+
+int main(int argc, char *argv[]) {
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--pulse") == 0 || strcmp(argv[i], "-p") == 0) {
+            use_cpu_pulse = true;
+        }
+        if (strcmp(argv[i], "--blocks") == 0 || strcmp(argv[i], "-b") == 0) {
+            use_cpu_blocks = true;
+        }
+        if (strcmp(argv[i], "--jit") == 0 || strcmp(argv[i], "-j") == 0) {
+            use_cpu_jit = true;
+        }
+    }
+
+    Rom rom;
+    if (!rom_load(&rom, ROM_FILE)) {
+        printf("\033[31m[Fatal] Failed to open klaus2m5 ROM\033[0;39m\n");
+        return 2;
+    }
+
+    MemoryMap mem;
+    mem.n_read_blocks  = 0;
+    mem.n_write_blocks = 0;
+    mem.n_io           = 0;
+    mem.block_cache    = NULL;
+    mem.debugger       = NULL;
+
+    static u8 ram_mem[0x10000];
+    memcpy(ram_mem + rom.map_offset, rom.value, rom.rom_size);
+    Ram ram;
+    ram.map_offset = 0x0000;
+    ram.size       = sizeof(ram_mem);
+    ram.value      = ram_mem;
+    mem_add_ram(&mem, &ram, "RAM");
+
+    static BlockCache block_cache;
+    static Jit        jit;
+    block_cache_init(&block_cache, &mem);
+    if (use_cpu_jit && !jit_init(&jit, &block_cache)) {
+        printf("JIT not available here, interpreting blocks instead\n");
+    }
+
+    Cpu6502 cpu;
+    memset(&cpu, 0, sizeof(cpu));
+    cpu.sp     = 0xFD;
+    cpu.memmap = &mem;
+    cpu_resb(&cpu);
+    cpu.pc       = ADDR_START;
+    cpu.addr_bus = ADDR_START; // where the cycle engine fetches from
+
+    // run in batches; the CPU is trapped once a single instruction doesn't move pc
+    clock_t start   = clock();
+    bool    trapped = false;
+    while (!trapped && cpu.cyc < MAX_CYCLES) {
+        if (use_cpu_jit) {
+            cpu_run_jit(&cpu, &jit, CYCLES_PER_CALL);
+        }
+        else if (use_cpu_blocks) {
+            cpu_run_blocks(&cpu, &block_cache, CYCLES_PER_CALL);
+        }
+        else if (use_cpu_pulse) {
+            // the batch can end mid-instruction, and the trap check starts
+            // at a boundary
+            cpu_run_cycles(&cpu, CYCLES_PER_CALL);
+            while (cpu.tcu != 0) {
+                cpu_pulse(&cpu);
+            }
+        }
+        else {
+            cpu_run_instructions(&cpu, CYCLES_PER_CALL / 4);
+        }
+
+        u16 pc = cpu.pc;
+        cpu_step(&cpu);
+        trapped = cpu.pc == pc;
+    }
+    double secs = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+    if (cpu.pc == ADDR_SUCCESS) {
+        printf("\033[32m[Success]");
+    }
+    else if (trapped && cpu.pc >= ADDR_DECIMAL && !CPU_HAS_DECIMAL) {
+        printf("\033[33m[Trapped] In the decimal mode checks");
+    }
+    else if (trapped) {
+        printf("\033[31m[Trapped] Failed check");
+    }
+    else {
+        printf("\033[31m[Stopped] Still running");
+    }
+    printf(" @ $%04X after %lu cycles (%.2f Mcycles/s)\033[0;39m\n", cpu.pc, cpu.cyc, cpu.cyc / secs / 1e6);
+    printf("A:%02X X:%02X Y:%02X P:%02X SP:%02X\n", cpu.a, cpu.x, cpu.y, cpu_get_p(&cpu), cpu.sp);
+
+    return cpu.pc == ADDR_SUCCESS || (cpu.pc >= ADDR_DECIMAL && !CPU_HAS_DECIMAL) ? 0 : 1;
+}
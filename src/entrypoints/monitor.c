@@ -1,19 +1,24 @@
 
 #include "../headers/cpu6502.h"
+#include "../headers/debugger.h"
 #include "../headers/disasm.h"
+#include "../headers/guestprofile.h"
 #include "../headers/log.h"
+#include "../headers/ppu.h"
 #include "../headers/ram.h"
 #include "../headers/rom.h"
 #include "execinfo.h"
 #include "ncurses.h"
 #include "signal.h"
 #include "stdio.h"
+#include "string.h"
 #include "time.h"
 #include "../headers/profile.h"
 
 #define NES_MODE 1
 
 #define DEBUG_START 0 // normal resb logic
+#define RUN_BATCH_CYCLES 10000 // between redraws and key checks while running
 // #define DEBUG_START 0xCEEE
 
 // const char *ROM_FILE = "./example/scratch.rom";
@@ -27,6 +32,9 @@ void ncurses_cleanup() {
 }
 void run_monitor(Cpu6502 *cpu);
 
+Debugger     *dbg;
+PPURegisters *ppu_registers; // NULL outside NES_MODE
+
 int main() {
     if (!init_logging("monitor.log"))
         exit(EXIT_FAILURE);
@@ -39,7 +47,9 @@ int main() {
     MemoryMap mem;
     mem.n_read_blocks  = 0;
     mem.n_write_blocks = 0;
-    mem._ppu           = NULL;
+    mem.n_io           = 0;
+    mem.block_cache    = NULL;
+    mem.debugger       = NULL;
 
     Rom rom;
     if (!rom_load(&rom, ROM_FILE)) {
@@ -70,6 +80,7 @@ int main() {
     PPURegisters ppu;
     ppu.status = 0xA2; // just to make sure I can actually read from here
     mem_add_ppu(&mem, &ppu);
+    ppu_registers = &ppu;
 #endif
 
     Cpu6502 cpu;
@@ -82,16 +93,31 @@ int main() {
         cpu.addr_bus = DEBUG_START;
     }
 
+    static GuestProfile guest_profile; // where the ROM spent its cycles, printed on exit
+    guest_profile_attach(&cpu, &guest_profile);
+
+    static Debugger debugger;
+    debugger_init(&debugger, &cpu);
+    dbg = &debugger;
+
     signal(SIGINT, ncurses_cleanup);
     run_monitor(&cpu);
     ncurses_cleanup();
+
+#ifdef CPU_OPCODE_STATS
+    cpu_opcode_stats_print(&cpu, stdout, 20);
+#endif
+    guest_profile_print_flat(&guest_profile, &mem, stdout, 20);
 }
 
 void draw(Cpu6502 *cpu);
 
-bool run_until_addr = false;
-u16  addr_to_stop;
-bool run_to_addr();
+bool running     = false;
+bool run_to_temp = false; // run_to is only a breakpoint for this run
+u16  run_to;
+bool prompt_addr(const char *label, u16 *addr, bool *entered);
+bool toggle_break(BreakKind kind, const char *label);
+void stop_running();
 
 int           WIN_MEM_LINES;
 int           WIN_STACK_LINES;
@@ -163,13 +189,7 @@ void run_monitor(Cpu6502 *cpu) {
     while (1) {
     noredraw:
 
-        if (run_until_addr) {
-            if (addr_to_stop == cpu->pc && cpu->tcu == 0) {
-                run_until_addr = false;
-                timeout(-1);
-                goto noredraw;
-            }
-
+        if (running) {
             // timeout(cpu->pc == lastpc ? 0 : 250);
             timeout(0);
 
@@ -180,18 +200,18 @@ void run_monitor(Cpu6502 *cpu) {
             }
             if (ch == 0x1b) // ESC
             {
-                run_until_addr = false;
-                timeout(-1);
+                stop_running();
                 goto noredraw;
             }
 
-            cpu_pulse(cpu);
-            if (cpu->tcu == 0) {
-                draw(cpu);
+            if (debugger_run(dbg, RUN_BATCH_CYCLES) == CPU_STOP_CALLBACK) {
+                stop_running();
             }
+            draw(cpu);
         }
         else {
             ch = getchar();
+            bool entered;
             switch (ch) {
             case 0x03:
                 raise(SIGINT);
@@ -200,7 +220,33 @@ void run_monitor(Cpu6502 *cpu) {
                 cpu_pulse(cpu);
                 break;
             case 'r':
-                if (!run_to_addr()) {
+                if (!prompt_addr("Run until PC: $", &run_to, &entered)) {
+                    raise(SIGINT);
+                    return;
+                }
+                if (entered) {
+                    run_to_temp = !debugger_is_set(dbg, BREAK_EXEC, run_to);
+                    debugger_set(dbg, BREAK_EXEC, run_to, NULL);
+                    running = true;
+                }
+                break;
+            case 'c':
+                running = true;
+                break;
+            case 'b':
+                if (!toggle_break(BREAK_EXEC, "Break at PC: $")) {
+                    raise(SIGINT);
+                    return;
+                }
+                break;
+            case 'w':
+                if (!toggle_break(BREAK_WRITE, "Watch writes: $")) {
+                    raise(SIGINT);
+                    return;
+                }
+                break;
+            case 'R':
+                if (!toggle_break(BREAK_READ, "Watch reads: $")) {
                     raise(SIGINT);
                     return;
                 }
@@ -215,17 +261,48 @@ void run_monitor(Cpu6502 *cpu) {
     }
 }
 
-bool run_to_addr() {
+void stop_running() {
+    running = false;
+    timeout(-1);
+    if (run_to_temp) {
+        debugger_clear(dbg, BREAK_EXEC, run_to);
+        run_to_temp = false;
+    }
+}
+
+// Sets a breakpoint of this kind at the address asked for, or clears it if
+// there's one already. False on ^C.
+bool toggle_break(BreakKind kind, const char *label) {
+    u16  addr;
+    bool entered;
+    if (!prompt_addr(label, &addr, &entered)) {
+        return false;
+    }
+    if (entered) {
+        if (debugger_is_set(dbg, kind, addr)) {
+            debugger_clear(dbg, kind, addr);
+        }
+        else {
+            debugger_set(dbg, kind, addr, NULL);
+        }
+    }
+    return true;
+}
+
+// Reads up to 4 hex digits into addr; entered is false if ESC was pressed or
+// nothing was typed. False on ^C.
+bool prompt_addr(const char *label, u16 *addr, bool *entered) {
     wrefresh(stdscr);
     WINDOW *prompt = newwin(3, 32, 10, 10);
     box(prompt, 0, 0);
 
     mvwaddstr(prompt, 2, 2, " ESC ");
     mvwaddstr(prompt, 2, 23, " ENTER ");
-    mvwaddstr(prompt, 1, 2, "Run until PC: $");
-    const int startloc = 17;
+    mvwaddstr(prompt, 1, 2, label);
+    const int startloc = 2 + strlen(label);
 
-    addr_to_stop = 0;
+    *addr    = 0;
+    *entered = false;
 
     int i = 0;
     while (1) {
@@ -238,33 +315,35 @@ bool run_to_addr() {
             raise(SIGINT);
             return false;
         case 0x7F:
-            i--;
-            addr_to_stop >>= 4;
-            mvwaddch(prompt, 1, startloc + i, ' ');
-            wmove(prompt, 1, startloc + i);
+            if (i > 0) {
+                i--;
+                *addr >>= 4;
+                mvwaddch(prompt, 1, startloc + i, ' ');
+                wmove(prompt, 1, startloc + i);
+            }
             break;
         case '\r':
         case '\n':
-            run_until_addr = i > 0;
+            *entered = i > 0;
             return true;
         default:
             if (i < 4) {
                 if (c >= '0' && c <= '9') {
                     i++;
-                    addr_to_stop <<= 4;
-                    addr_to_stop += c - '0';
+                    *addr <<= 4;
+                    *addr += c - '0';
                     waddch(prompt, c);
                 }
                 else if (c >= 'A' && c <= 'F') {
                     i++;
-                    addr_to_stop <<= 4;
-                    addr_to_stop += c - 'A' + 0xA;
+                    *addr <<= 4;
+                    *addr += c - 'A' + 0xA;
                     waddch(prompt, c);
                 }
                 else if (c >= 'a' && c <= 'f') {
                     i++;
-                    addr_to_stop <<= 4;
-                    addr_to_stop += c - 'a' + 0xA;
+                    *addr <<= 4;
+                    *addr += c - 'a' + 0xA;
                     waddch(prompt, c);
                 }
             }
@@ -299,7 +378,7 @@ void draw(Cpu6502 *cpu) {
     draw_instructions(mem_get_read_block(cpu->memmap, cpu->pc), cpu->pc);
 
     draw_cpu_registers(cpu);
-    draw_ppu_registers(cpu->memmap->_ppu);
+    draw_ppu_registers(ppu_registers);
 
     tracef("end draw\n");
 
@@ -367,11 +446,12 @@ void draw_instructions(MemoryBlock *b, memaddr pc) {
         u16         offset = alignment_addr - b->range_low;
         Disassembly dis    = disasm(disassembler, b->values + offset, b->range_high - alignment_addr, WIN_INST_LINES);
         for (int i = 0; i < dis.countInst; i++) {
-            wattron(win_instructions, COLOR_PAIR(COLOR_ADDRESS_LABEL));
-            u16 addr = dis.offsets[i] + alignment_addr;
+            u16 addr  = dis.offsets[i] + alignment_addr;
+            int color = debugger_is_set(dbg, BREAK_EXEC, addr) ? COLOR_FANCY : COLOR_ADDRESS_LABEL;
+            wattron(win_instructions, COLOR_PAIR(color));
             sprintf(addr_buff, "$%04x: ", addr);
             mvwaddstr(win_instructions, 1 + i, 2, addr_buff);
-            wattroff(win_instructions, COLOR_PAIR(COLOR_ADDRESS_LABEL));
+            wattroff(win_instructions, COLOR_PAIR(color));
 
             wattron(win_instructions, COLOR_PAIR(COLOR_UNIMPORTANT_BYTES));
             waddstr(win_instructions, dis.bytes[i]);
@@ -466,11 +546,12 @@ void draw_cpu_registers(Cpu6502 *cpu) {
     mvwaddch(win_registers, SP_LINE_INDEX + 1, COL_REG_WIDTH_3_4, ACS_TTEE);
 
     const int P_LINE_INDEX = SP_LINE_INDEX + 2;
+    u8 p = cpu_get_p(cpu);
     sprintf(buff, " N: %i  |  V: %i  |  _: %i  |  B: %i",
-        (cpu->p >> 7) & 0b1,
-        (cpu->p >> 6) & 0b1,
-        (cpu->p >> 5) & 0b1,
-        (cpu->p >> 4) & 0b1);
+        (p >> 7) & 0b1,
+        (p >> 6) & 0b1,
+        (p >> 5) & 0b1,
+        (p >> 4) & 0b1);
     mvwaddstr(win_registers, P_LINE_INDEX, 2, buff);
     mvwaddch( win_registers, P_LINE_INDEX, COL_REG_WIDTH_1_4, ACS_VLINE);
     mvwaddch( win_registers, P_LINE_INDEX, COL_REG_WIDTH_2_4, ACS_VLINE);
@@ -486,10 +567,10 @@ void draw_cpu_registers(Cpu6502 *cpu) {
 
 
     sprintf(buff, " D: %i  |  I: %i  |  Z: %i  |  C: %i",
-        (cpu->p >> 3) & 0b1,
-        (cpu->p >> 2) & 0b1,
-        (cpu->p >> 1) & 0b1,
-        (cpu->p >> 0) & 0b1);
+        (p >> 3) & 0b1,
+        (p >> 2) & 0b1,
+        (p >> 1) & 0b1,
+        (p >> 0) & 0b1);
     mvwaddstr(win_registers, P_LINE_INDEX + 2, 2, buff);
     mvwaddch( win_registers, P_LINE_INDEX + 2, COL_REG_WIDTH_1_4, ACS_VLINE);
     mvwaddch( win_registers, P_LINE_INDEX + 2, COL_REG_WIDTH_2_4, ACS_VLINE);
@@ -503,6 +584,12 @@ void draw_cpu_registers(Cpu6502 *cpu) {
     mvwaddch(win_registers, P_LINE_INDEX + 3, COL_REG_WIDTH_3_4, ACS_BTEE);
     mvwaddch(win_registers, P_LINE_INDEX + 3, COL_REG_WIDTH, ACS_RTEE);
 
+    const char *HIT_KINDS[BREAK_KINDS] = {"exec", "read", "write"};
+    if (dbg->hit.cyc) {
+        sprintf(buff, "Hit %s $%04x = $%02x @ $%04x", HIT_KINDS[dbg->hit.kind], dbg->hit.addr, dbg->hit.value, dbg->hit.pc);
+        mvwaddstr(win_registers, P_LINE_INDEX + 4, 2, buff);
+    }
+
     wrefresh(win_registers);
 }
 
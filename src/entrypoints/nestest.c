@@ -2,14 +2,23 @@
 #include "../headers/common.h"
 #include "../headers/cpu6502.h"
 #include "../headers/disasm.h"
+#include "../headers/guestprofile.h"
+#include "../headers/jit.h"
 #include "../headers/log.h"
+#include "../headers/mapper.h"
+#include "../headers/ppu.h"
 #include "../headers/ram.h"
 #include "../headers/rom.h"
 #include "execinfo.h"
+#include "fcntl.h"
 #include "ncurses.h"
 #include "signal.h"
 #include "stdio.h"
+#include "string.h"
+#include "sys/mman.h"
+#include "sys/stat.h"
 #include "time.h"
+#include "unistd.h"
 #include "../headers/profile.h"
 
 #define STOP_AFTER 1
@@ -17,6 +26,8 @@ const clock_t CLOCKS_PER_MS = (CLOCKS_PER_SEC / 1000);
 
 #define COLOR 1
 const char *ROM_FILE = "./example/nestest-prg.rom";
+const char *NES_FILE = "./example/nestest.nes"; // the cartridge ROM_FILE was converted from
+const char *LOG_FILE = "./example/nestest.log"; // the reference run, from Nintendulator
 
 void fatal(const char *msg);
 
@@ -577,9 +588,340 @@ struct test_t tests_group3[] = {
     {0x15, "RRA abs,x failure"},
 };
 
-#define ADDR_ERR_CODE 0x00
+// The unofficial opcode tests start at ADDR_OFFICIAL_END, after ~14.5K cycles
+// of official ones. This core doesn't implement unofficial opcodes, so the run
+// would go off the rails there and never get back to the test routine's final
+// RTS: it stops before them, as bench does. MAX_CYCLES is only for a run that
+// doesn't get that far.
+#define ADDR_ERR_CODE     0x00
+#define ADDR_OFFICIAL_END 0xC6BD
+#define MAX_CYCLES        100000
+
+// Configured by flags:
+bool use_cpu_step   = false; // whole-instruction stepping instead of cycle-by-cycle
+bool use_cpu_blocks = false; // whole instructions out of the predecoded block cache
+bool use_cpu_jit    = false; // hot blocks compiled to native code
+bool use_profile    = false; // where the ROM spends its cycles, see guestprofile.h
+bool use_calls      = false; // its call graph, for speedscope
+bool use_trace      = false; // every instruction, in nestest.log's layout
+bool use_nes        = false; // the iNES cartridge through its mapper, instead of the converted PRG
+const char *log_file = NULL;  // compare against this log instead of checking error codes
+
+BlockCache block_cache;
+Jit        jit;
+
+void run_cpu(Cpu6502 *cpu) {
+    if (use_cpu_step) {
+        cpu_step(cpu);
+    }
+    else if (use_cpu_blocks) {
+        cpu_run_blocks(cpu, &block_cache, 1);
+    }
+    else if (use_cpu_jit) {
+        cpu_run_jit(cpu, &jit, 1);
+    }
+    else {
+        cpu_pulse(cpu);
+    }
+}
+
+typedef struct {
+    MemoryMap *mem;
+    u16        pc_last; // the instruction that just ran
+    bool       native;  // or the block it starts, run as native code by --jit
+    u8         status_prev;
+    int        group;
+} NestestState;
+
+// Called after every instruction: reports a new error code and returns true
+// once the official opcode tests are over or pc stops moving.
+bool check_instruction(Cpu6502 *cpu, void *ctx) {
+    NestestState *s = ctx;
+
+    u8 status = mem_read_addr(s->mem, ADDR_ERR_CODE);
+
+    switch (s->pc_last) {
+        case 0xCFC3:
+        case 0xD955: // both store a pointer in $00, not an error code
+            goto false_positive;
+    }
+
+    if (status != s->status_prev && status != 0) {
+        const char *msg = "Unknown";
+
+        struct test_t *group_arr = NULL;
+        size_t group_size = 0;
+        switch (s->group) {
+            case 1:
+                group_arr = tests_group1;
+                group_size = GROUP1_LEN;
+                break;
+            case 2:
+                group_arr = tests_group2;
+                group_size = GROUP2_LEN;
+                break;
+            case 3:
+                group_arr = tests_group3;
+                group_size = GROUP3_LEN;
+                break;
+        }
+
+        if (group_arr) {
+            for (unsigned int i = 0; i < group_size; i++) {
+                if (group_arr[i].err_code == status) {
+                    msg = group_arr[i].msg;
+                    break;
+                }
+            }
+        }
+
+        printf("\033[31m"
+            "[Failed] Test %02X (G%i) %s $%04X: %s"
+            "\033[0;39m\n", status, s->group, s->native ? "in the block at" : "@", s->pc_last, msg);
+    }
+
+false_positive:
+    switch (cpu->pc) {
+        case 0xC623:
+            s->group = 2;
+            break;
+        case 0xC652:
+            s->group = 3;
+            break;
+    }
+
+    s->status_prev = status;
+
+    if (cpu->pc == ADDR_OFFICIAL_END || cpu->pc == s->pc_last) {
+        return true;
+    }
+    s->pc_last = cpu->pc;
+    return false;
+}
+
+// nestest.log, mmap'd and checked a line at a time against the CPU at each
+// instruction boundary it stops at
+typedef struct {
+    MemoryMap  *mem;
+    const char *name;
+    const char *data;
+    size_t      size;
+    size_t      line;     // offset of the next line to check
+    size_t      line_end; // and of its end
+    u64         line_no;  // from 1
+#define LOG_CONTEXT 5 // lines shown before a mismatch
+    size_t      context[LOG_CONTEXT]; // offsets of the lines before it, as a ring
+    u64         matched;
+    bool        mismatch;
+} LogCompare;
+
+// Columns of nestest.log, which cpu_trace_format follows
+#define LOG_COL_BYTES 6
+#define LOG_COL_A     48
+#define LOG_COL_CYC   86
+
+void log_seek(LogCompare *l, size_t line) {
+    const char *end = memchr(l->data + line, '\n', l->size - line);
+    l->line         = line;
+    l->line_end     = end ? (size_t)(end - l->data) : l->size;
+}
+
+void log_next_line(LogCompare *l) {
+    l->context[l->line_no % LOG_CONTEXT] = l->line;
+    l->line_no++;
+    log_seek(l, l->line_end < l->size ? l->line_end + 1 : l->size);
+}
+
+// The line at offset `line` without its line ending
+int log_line_len(LogCompare *l, size_t line) {
+    const char *end = memchr(l->data + line, '\n', l->size - line);
+    size_t      len = (end ? (size_t)(end - l->data) : l->size) - line;
+    if (len > 0 && l->data[line + len - 1] == '\r') {
+        len--;
+    }
+    return len;
+}
+
+void log_report(LogCompare *l, Cpu6502 *cpu, const char *what) {
+    printf("\033[31m[Mismatch] %s at %s line %lu\033[0;39m\n", what, l->name, l->line_no);
+    u64 first = l->line_no > LOG_CONTEXT ? l->line_no - LOG_CONTEXT : 1;
+    for (u64 n = first; n < l->line_no; n++) {
+        size_t line = l->context[n % LOG_CONTEXT];
+        printf("           %.*s\n", log_line_len(l, line), l->data + line);
+    }
+    printf("  expected %.*s\n", log_line_len(l, l->line), l->data + l->line);
+
+    CpuTraceRecord r = {cyc: cpu->cyc, pc: cpu->pc, a: cpu->a, x: cpu->x, y: cpu->y, p: cpu_get_p(cpu), sp: cpu->sp};
+    for (int i = 0; i < 3; i++) {
+        r.bytes[i] = mem_read_addr(l->mem, cpu->pc + i);
+    }
+    char got[128];
+    cpu_trace_format(&r, got, sizeof(got));
+    printf("       got %s\n", got);
+}
+
+// The opcode and operand the line lists, against memory at pc
+bool log_bytes_match(LogCompare *l, const char *line, memaddr pc) {
+    for (int i = 0; i < 3; i++) {
+        const char *byte = line + LOG_COL_BYTES + 3 * i;
+        if (byte[0] != ' ' && hex(byte, 0, 2) != mem_read_addr(l->mem, pc + i)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Called at instruction boundaries: true once the log has run out or the CPU
+// has strayed from it. The JIT runs whole blocks between boundaries, so the
+// lines of the instructions inside them are skipped.
+bool check_log(Cpu6502 *cpu, void *ctx) {
+    LogCompare *l = ctx;
+    const char *line;
+    u64         cyc;
+    for (;;) {
+        if (l->line >= l->size) {
+            return true;
+        }
+        line = l->data + l->line;
+        if (log_line_len(l, l->line) == 0) {
+            log_next_line(l);
+            continue;
+        }
+        if (l->line_end - l->line <= LOG_COL_CYC + 4 || memcmp(line + LOG_COL_A, "A:", 2) != 0
+            || memcmp(line + LOG_COL_CYC, "CYC:", 4) != 0) {
+            log_report(l, cpu, "Unrecognised line");
+            l->mismatch = true;
+            return true;
+        }
+        cyc = dec(line, LOG_COL_CYC + 4, l->line_end - l->line - LOG_COL_CYC - 4);
+        if (!use_cpu_jit || cyc >= cpu->cyc) {
+            break;
+        }
+        log_next_line(l);
+    }
+
+    // in the order a wrong one is most telling: a bad branch shows in PC first
+    const char *what = NULL;
+    if (hex(line, 0, 4) != cpu->pc) {
+        what = "PC";
+    }
+    else if (!log_bytes_match(l, line, cpu->pc)) {
+        what = "Instruction bytes";
+    }
+    else if (hex(line, LOG_COL_A + 2, 2) != cpu->a) {
+        what = "A";
+    }
+    else if (hex(line, LOG_COL_A + 7, 2) != cpu->x) {
+        what = "X";
+    }
+    else if (hex(line, LOG_COL_A + 12, 2) != cpu->y) {
+        what = "Y";
+    }
+    else if (hex(line, LOG_COL_A + 17, 2) != cpu_get_p(cpu)) {
+        what = "P";
+    }
+    else if (hex(line, LOG_COL_A + 23, 2) != cpu->sp) {
+        what = "SP";
+    }
+    else if (cyc != cpu->cyc) {
+        what = "CYC";
+    }
+    if (what) {
+        log_report(l, cpu, what);
+        l->mismatch = true;
+        return true;
+    }
+
+    l->matched++;
+    log_next_line(l);
+    return false;
+}
+
+// Runs nestest against the log from reset; true if every line matched.
+bool compare_log(Cpu6502 *cpu, MemoryMap *mem, const char *file_name) {
+    int fd = open(file_name, O_RDONLY);
+    if (fd < 0) {
+        printf("\033[31m[Fatal] Failed to open %s\033[0;39m\n", file_name);
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        printf("\033[31m[Fatal] %s is empty or unreadable\033[0;39m\n", file_name);
+        close(fd);
+        return false;
+    }
+    char *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        printf("\033[31m[Fatal] Failed to map %s\033[0;39m\n", file_name);
+        return false;
+    }
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+
+    LogCompare l;
+    memset(&l, 0, sizeof(l));
+    l.mem      = mem;
+    l.name     = file_name;
+    l.data     = data;
+    l.size     = st.st_size;
+    l.line_no  = 1;
+    log_seek(&l, 0);
+
+    clock_t start = clock();
+    bool    done  = check_log(cpu, &l);
+    if (use_cpu_step || use_cpu_blocks || use_cpu_jit) {
+        while (!done && cpu->cyc <= MAX_CYCLES) {
+            run_cpu(cpu);
+            done = check_log(cpu, &l);
+        }
+    }
+    else if (!done) {
+        done = cpu_run_until(cpu, check_log, &l, MAX_CYCLES + 1 - cpu->cyc) == CPU_STOP_CALLBACK;
+    }
+    clock_t elapsed = clock() - start;
+
+    munmap(data, st.st_size);
+    if (!done) {
+        printf("\033[31m[Stopped] Still running after %i cycles @ $%04X, at %s line %lu\033[0;39m\n",
+               MAX_CYCLES, cpu->pc, file_name, l.line_no);
+        return false;
+    }
+    if (l.mismatch) {
+        return false;
+    }
+    printf("\033[32m[Passed] %lu instructions match %s (%.1fms)\033[0;39m\n", l.matched, file_name,
+           (double)elapsed / CLOCKS_PER_MS);
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--step") == 0 || strcmp(argv[i], "-s") == 0) {
+            use_cpu_step = true;
+        }
+        if (strcmp(argv[i], "--blocks") == 0 || strcmp(argv[i], "-b") == 0) {
+            use_cpu_blocks = true;
+        }
+        if (strcmp(argv[i], "--jit") == 0 || strcmp(argv[i], "-j") == 0) {
+            use_cpu_jit = true;
+        }
+        if (strcmp(argv[i], "--profile") == 0 || strcmp(argv[i], "-p") == 0) {
+            use_profile = true;
+        }
+        if (strcmp(argv[i], "--calls") == 0 || strcmp(argv[i], "-c") == 0) {
+            use_calls = true;
+        }
+        if (strcmp(argv[i], "--trace") == 0 || strcmp(argv[i], "-t") == 0) {
+            use_trace = true;
+        }
+        if (strcmp(argv[i], "--nes") == 0 || strcmp(argv[i], "-n") == 0) {
+            use_nes = true;
+        }
+        if (strcmp(argv[i], "--log") == 0 || strcmp(argv[i], "-l") == 0) {
+            log_file = i + 1 < argc && argv[i + 1][0] != '-' ? argv[++i] : LOG_FILE;
+        }
+    }
 
-int main() {
     if (!init_logging("monitor.log"))
         exit(EXIT_FAILURE);
 
@@ -590,47 +932,81 @@ int main() {
     MemoryMap mem;
     mem.n_read_blocks  = 0;
     mem.n_write_blocks = 0;
-    mem._ppu           = NULL;
+    mem.n_io           = 0;
+    mem.block_cache    = NULL;
+    mem.debugger       = NULL;
 
-    Rom rom;
-    if (!rom_load(&rom, ROM_FILE)) {
-
-        fatal("Failed to open nestest ROM");
+    Rom    rom;
+    Mapper cart;
+    if (use_nes) {
+        if (!mapper_load_ines(&cart, NES_FILE)) {
+            fatal("Failed to open nestest iNES");
+        }
+    }
+    else {
+        if (!rom_load(&rom, ROM_FILE)) {
+            fatal("Failed to open nestest ROM");
+        }
+        mem_add_rom(&mem, &rom, "ROM");
     }
-    mem_add_rom(&mem, &rom, "ROM");
-
-
-    Ram zpg_ram;
-    zpg_ram.map_offset = 0x0000;
-    zpg_ram.size       = 0x100;
-    zpg_ram.value      = malloc(zpg_ram.size);
-    mem_add_ram(&mem, &zpg_ram, "ZPG");
 
-    Ram stack_ram;
-    stack_ram.map_offset = 0x0100;
-    stack_ram.size       = 0x0100;
-    stack_ram.value      = malloc(stack_ram.size);
-    mem_add_ram(&mem, &stack_ram, "STACK");
 
-    Ram ram;
-    ram.map_offset = 0x0200;
-    ram.size       = 0x0600;
-    ram.value      = malloc(ram.size);
-    mem_add_ram(&mem, &ram, "RAM");
+    Ram ram; // the NES's 2KB, mirrored up to $1FFF
+    ram.map_offset = 0x0000;
+    ram.size       = 0x0800;
+    ram.value      = calloc(ram.size, 1);
+    mem_add_ram_mirrored(&mem, &ram, "RAM", 0x1FFF);
 
     PPURegisters ppu;
     ppu.status = 0xA2; // just to make sure I can actually read from here
     mem_add_ppu(&mem, &ppu);
+    block_cache_init(&block_cache, &mem);
+    if (use_cpu_jit && !jit_init(&jit, &block_cache)) {
+        printf("JIT not available here, interpreting blocks instead\n");
+    }
 
+    // powered up as in nestest.log: registers and RAM zeroed, and the reset
+    // sequence's 7 cycles already on the clock
     Cpu6502 cpu;
-    cpu.p = 0;
+    memset(&cpu, 0, sizeof(cpu));
     cpu.sp = 0xFD;
     cpu.memmap   = &mem;
-    cpu.addr_bus = rom.map_offset;
+    if (use_nes && !mapper_attach(&cart, &cpu)) {
+        fatal("Failed to map nestest's cartridge");
+    }
+    cpu.addr_bus = use_nes ? 0x8000 : rom.map_offset;
     cpu_resb(&cpu);
+    cpu.cyc = 7;
+    if (use_nes) {
+        // the cartridge resets into the interactive menu; the automated run
+        // starts at $C000, where the converted PRG's vector was pointed
+        cpu.pc       = 0xC000;
+        cpu.addr_bus = cpu.pc;
+    }
+
+    static GuestProfile   guest_profile;
+    static GuestCallGraph guest_calls;
+    if (use_profile || use_calls) {
+        guest_profile_attach(&cpu, &guest_profile);
+    }
+    if (use_calls && !guest_calls_start(&guest_profile, &guest_calls, &cpu)) {
+        fatal("Failed to set up call graph tracing");
+    }
+
+    static CpuTraceRecord trace_records[1 << 16]; // the whole of MAX_CYCLES
+    CpuTrace              trace;
+    if (use_trace) {
+        cpu_trace_start(&cpu, &trace, trace_records, 1 << 16);
+    }
 
     init_profiler();
 
+    bool matched = true;
+    if (log_file) {
+        matched = compare_log(&cpu, &mem, log_file);
+        goto report;
+    }
+
     /*
     nestest is all the proof you need that you shouldn't trust documentation and also
     seemingly proves that no one uses it or bothers to mention how it doesn't actually
@@ -642,76 +1018,78 @@ int main() {
 
     // init test (wait for error code to get 0'd)
     do {
-        cpu_pulse(&cpu);
+        run_cpu(&cpu);
     } while (mem_read_addr(&mem, ADDR_ERR_CODE));
 
-    u16 pc_last = 0xFFFF;
-    u8 status_prev = 0;
-    int group = 1;
-    while (cpu.pc != pc_last || cpu.tcu != 0) {
-        if (cpu.tcu == 0) {
-            pc_last = cpu.pc;
-        }
-        cpu_pulse(&cpu);
-
-        u8 status = mem_read_addr(&mem, ADDR_ERR_CODE);
+    NestestState state;
+    state.mem         = &mem;
+    state.pc_last     = cpu.pc;
+    state.native      = false;
+    state.status_prev = mem_read_addr(&mem, ADDR_ERR_CODE);
+    state.group       = 1;
 
-        switch (pc_last) {
-            case 0xCFC3:
-                goto false_positive;
+    CpuStopReason stop;
+    if (use_cpu_step || use_cpu_blocks || use_cpu_jit) {
+        stop = CPU_STOP_CYCLES;
+        while (cpu.cyc <= MAX_CYCLES) {
+            u64 native_runs = jit.native_runs;
+            run_cpu(&cpu);
+            state.native = jit.native_runs != native_runs;
+            if (check_instruction(&cpu, &state)) {
+                stop = CPU_STOP_CALLBACK;
+                break;
+            }
         }
+    }
+    else {
+        stop = cpu_run_until(&cpu, check_instruction, &state, MAX_CYCLES + 1 - cpu.cyc);
+    }
 
-        if (status != status_prev && status != 0) {
-            const char *msg = "Unknown";
-
-            struct test_t *group_arr;
-            size_t group_size;
-            switch (group) {
-                case 1:
-                    group_arr = tests_group1;
-                    group_size = GROUP1_LEN;
-                    break;
-                case 2:
-                    group_arr = tests_group2;
-                    group_size = GROUP2_LEN;
-                    break;
-                case 3:
-                    group_arr = tests_group3;
-                    group_size = GROUP3_LEN;
-                    break;
-            }
+    if (stop == CPU_STOP_CYCLES) {
+        printf("\033[31m"
+            "[Stopped] Still running after %i cycles @ $%04X"
+            "\033[0;39m\n", MAX_CYCLES, cpu.pc);
+    }
+    else if (cpu.pc == ADDR_OFFICIAL_END) {
+        printf("\033[32m"
+            "[Done] Official opcode tests over @ $%04X after %lu cycles"
+            "\033[0;39m\n", cpu.pc, cpu.cyc);
+    }
+    else {
+        printf("\033[31m"
+            "[Stopped] Stuck @ $%04X after %lu cycles"
+            "\033[0;39m\n", cpu.pc, cpu.cyc);
+    }
 
-            if (group_arr) {
-                for (unsigned int i = 0; i < group_size; i++) {
-                    if (group_arr[i].err_code == status) {
-                        msg = group_arr[i].msg;
-                        break;
-                    }
-                }
-            }
+report:
+#ifdef CPU_OPCODE_STATS
+    cpu_opcode_stats_print(&cpu, stdout, 20);
+#endif
 
-            printf("\033[31m"
-                "[Failed] Test %02X (G%i) @ $%04X: %s"
-                "\033[0;39m\n", status, group, pc_last, msg);
+    if (use_profile) {
+        guest_profile_print_flat(&guest_profile, &mem, stdout, 20);
+        FILE *f = fopen("nestest.annotated.txt", "w");
+        if (f) {
+            guest_profile_print_annotated(&guest_profile, &mem, f, 0x0000, 0xFFFF);
+            fclose(f);
+            printf("Annotated disassembly in nestest.annotated.txt\n");
         }
-
-false_positive:
-        switch (cpu.pc) {
-            case 0xC623:
-                group = 2;
-                break;
-            case 0xC652:
-                group = 3;
-                break;
+    }
+    if (use_calls && guest_calls_write(&guest_profile, &cpu, "nestest", "nestest.calls.json")) {
+        printf("Call graph in nestest.calls.json (open it in speedscope)\n");
+    }
+    if (use_trace) {
+        FILE *f = fopen("nestest.trace.log", "w");
+        if (f) {
+            cpu_trace_dump(&trace, f);
+            fclose(f);
+            printf("Trace of the last %lu instructions in nestest.trace.log\n", cpu_trace_count(&trace));
         }
-
-        status_prev = status;
     }
 
-
     end_profiler("nestest.profile.json");
 
-    return 0;
+    return matched ? 0 : 1;
 }
 
 
@@ -721,3 +1099,33 @@ void fatal(const char *msg)
     printf("\033[31m[Fatal] %s\033[0;39m\n", msg);
     exit(2);
 }
+
+// Fixed-width fields of a log line, up to len digits; they stop early at
+// anything else.
+u64 hex(const char *line, int start, int len) {
+    u64 val = 0;
+    for (int i = start; i < start + len; i++) {
+        char c = line[i];
+        if (c >= '0' && c <= '9') {
+            val = val * 16 + c - '0';
+        }
+        else if (c >= 'A' && c <= 'F') {
+            val = val * 16 + c - 'A' + 10;
+        }
+        else if (c >= 'a' && c <= 'f') {
+            val = val * 16 + c - 'a' + 10;
+        }
+        else {
+            break;
+        }
+    }
+    return val;
+}
+
+u64 dec(const char *line, int start, int len) {
+    u64 val = 0;
+    for (int i = start; i < start + len && line[i] >= '0' && line[i] <= '9'; i++) {
+        val = val * 10 + line[i] - '0';
+    }
+    return val;
+}
@@ -1,10 +1,14 @@
 
 #include "../headers/cpu6502.h"
+#include "../headers/debugger.h"
 #include "../headers/disasm.h"
+#include "../headers/guestprofile.h"
 #include "../headers/log.h"
+#include "../headers/ppu.h"
 #include "../headers/ram.h"
 #include "../headers/rom.h"
 #include "../headers/profile.h"
+#include "../headers/rewind.h"
 
 #include <SDL2/SDL_error.h>
 #include <SDL2/SDL_events.h>
@@ -34,6 +38,8 @@
 #define BOTTOM_PADDING_FIX 0
 
 #define DEBUG_START 0 // normal resb logic
+#define CYCLES_PER_FRAME 29781 // NTSC, so free running goes at about NES speed
+#define REWIND_INTERVAL CYCLES_PER_FRAME // a snapshot a frame: about a second back
 // #define DEBUG_START 0xCEEE
 
 // const char *ROM_FILE = "./example/scratch.rom";
@@ -72,6 +78,9 @@ struct simstate_t
     bool exit;
     bool do_step;
     bool free_run;
+    bool toggle_break; // exec breakpoint at pc
+    bool back_cycle;
+    bool back_instruction;
 };
 
 struct monitor_t
@@ -88,7 +97,7 @@ struct boxbound_t
 };
 
 void user_input(struct simstate_t *s);
-void run_sim(struct simstate_t *state, struct simulation_t *sim);
+void run_sim(struct simstate_t *state, struct simulation_t *sim, Debugger *dbg, Rewind *rw);
 void render(struct simstate_t state, struct simulation_t sim, struct rendering_t *rend);
 
 SDL_Rect clamp(SDL_Rect rect, int w, int h);
@@ -182,7 +191,9 @@ int main() {
     {
         monitor.sim.mem.n_read_blocks  = 0;
         monitor.sim.mem.n_write_blocks = 0;
-        monitor.sim.mem._ppu           = NULL;
+        monitor.sim.mem.n_io           = 0;
+        monitor.sim.mem.block_cache    = NULL;
+        monitor.sim.mem.debugger       = NULL;
 
         if (!rom_load(&monitor.sim.rom, ROM_FILE)) {
             fprintf(stderr, "Failed parsing rom file.\n");
@@ -218,17 +229,36 @@ int main() {
         }
     }
 
+    static GuestProfile guest_profile; // where the ROM spent its cycles, printed on exit
+    guest_profile_attach(&monitor.sim.cpu, &guest_profile);
+
+    static Debugger debugger; // free running stops at its breakpoints
+    debugger_init(&debugger, &monitor.sim.cpu);
+
+    static Rewind history; // snapshots to step back through
+    if (!rewind_init(&history, &monitor.sim.cpu, REWIND_INTERVAL)
+        || !rewind_add_state(&history, &monitor.sim.ppu, sizeof(PPURegisters))) {
+        fprintf(stderr, "Failed to allocate rewind snapshots\n");
+        goto cleanup;
+    }
+
     monitor.state.exit = false;
 
     while (!monitor.state.exit)
     {
         user_input(&monitor.state);
-        run_sim(&monitor.state, &monitor.sim);
+        run_sim(&monitor.state, &monitor.sim, &debugger, &history);
         render(monitor.state, monitor.sim, &monitor.rend);
     }
 
     exit_code = 0;
 
+#ifdef CPU_OPCODE_STATS
+    cpu_opcode_stats_print(&monitor.sim.cpu, stdout, 20);
+#endif
+    guest_profile_print_flat(&guest_profile, &monitor.sim.mem, stdout, 20);
+    rewind_free(&history);
+
 cleanup:
     if (monitor.rend.font) TTF_CloseFont(monitor.rend.font);
     if (monitor.rend.main_rend) SDL_DestroyRenderer(monitor.rend.main_rend);
@@ -282,6 +312,20 @@ void user_input(struct simstate_t *s)
                     case SDLK_F5:
                         s->free_run = true;
                         break;
+                    case SDLK_F9:
+                        s->toggle_break = true;
+                        break;
+                    case SDLK_LEFT:
+                        s->free_run = false;
+                        if ((ev.key.keysym.mod & KMOD_CTRL) != 0)
+                        {
+                            s->back_instruction = true;
+                        }
+                        else
+                        {
+                            s->back_cycle = true;
+                        }
+                        break;
                     case SDLK_q:
                     case SDLK_c:
                         if ((ev.key.keysym.mod & KMOD_CTRL) != 0)
@@ -295,18 +339,47 @@ void user_input(struct simstate_t *s)
     }
 }
 
-void run_sim(struct simstate_t *state, struct simulation_t *sim)
+void run_sim(struct simstate_t *state, struct simulation_t *sim, Debugger *dbg, Rewind *rw)
 {
+    if (state->toggle_break)
+    {
+        state->toggle_break = false;
+
+        if (debugger_is_set(dbg, BREAK_EXEC, sim->cpu.pc))
+        {
+            debugger_clear(dbg, BREAK_EXEC, sim->cpu.pc);
+        }
+        else
+        {
+            debugger_set(dbg, BREAK_EXEC, sim->cpu.pc, NULL);
+        }
+    }
+
     if (state->free_run)
     {
-        cpu_pulse(&sim->cpu);
+        if (debugger_run(dbg, CYCLES_PER_FRAME) == CPU_STOP_CALLBACK)
+        {
+            state->free_run = false;
+            infof("Break @ $%04x\n", dbg->hit.addr);
+        }
     }
     else if (state->do_step)
     {
         state->do_step = false;
 
-        cpu_pulse(&sim->cpu);
+        cpu_run_cycles(&sim->cpu, 1);
+    }
+    else if (state->back_cycle || state->back_instruction)
+    {
+        bool back = state->back_cycle ? rewind_cycle(rw) : rewind_instruction(rw);
+        if (!back)
+        {
+            infof("Can't go back past $%04x (cycle %lu)\n", sim->cpu.pc, sim->cpu.cyc);
+        }
+        state->back_cycle       = false;
+        state->back_instruction = false;
     }
+    rewind_poll(rw);
 }
 
 void render(struct simstate_t state, struct simulation_t sim, struct rendering_t *rend)
@@ -566,6 +639,7 @@ subrender(cpu)
         Uint32 rgb_on  = SDL_MapRGB(final->format, 0x00, 0x80, 0x00);
         Uint32 rgb_off = SDL_MapRGB(final->format, 0x80, 0x00, 0x00);
         char flagchars[] = { 'N', 'V', '_', 'B', 'D', 'I', 'Z', 'C' };
+        u8   p           = cpu_get_p(&sim.cpu);
 
         int wline = rend->font_w;
 
@@ -587,7 +661,7 @@ subrender(cpu)
             snprintf(buff, nbuff, "%c", flagchars[i]);
             SDL_Surface *flag = TTF_RenderText_Blended(rend->font, buff, text_color);
 
-            bool on = ((sim.cpu.pd >> i) & 1) == 1;
+            bool on = ((p >> (7 - i)) & 1) == 1; // flagchars go from bit 7 down
 
             render_text_box(final,
                 flag,
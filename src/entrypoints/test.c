@@ -1,30 +1,53 @@
 #include "../headers/cpu6502.h"
+#include "../headers/cpulanes.h"
+#include "../headers/debugger.h"
 #include "../headers/disasm.h"
 #include "../headers/log.h"
+#include "../headers/mapper.h"
 #include "../headers/ram.h"
+#include "../headers/rewind.h"
 #include "../headers/rom.h"
 #include "execinfo.h"
+#include "pthread.h"
 #include "signal.h"
 #include "stdio.h"
 #include "stdlib.h"
+#include "string.h"
 #include "time.h"
+#include "unistd.h"
 #include <stdarg.h>
 #include "../headers/profile.h"
 
 // Configured by flags:
-bool print_errors_only = false;
-int  n_executions      = 1;
-
-#define MAX_CYCLES_PER_OP 6
+bool         print_errors_only = false;
+int          n_executions      = 1;
+bool         use_cpu_step      = false;
+bool         use_cpu_lanes     = false;
+int          n_jobs            = 0; // worker threads, 0 for one per core
+unsigned int seed;
+
+#define MAX_CYCLES_PER_OP 7
 #define RAM_OFFSET        0x0000
 #define ROM_OFFSET        0x4020
 #define ADDR_MAX          0xFFFF
+#define RUNS_PER_TASK     1000 // repetitions of a test handed to a worker at a time
+
+// Test setup, per worker thread. Tests write to the address space that ram_mem
+// and rom_mem point into: lane 0's, or with --lanes the lane being set up.
+__thread u8     *ram_mem;
+__thread u8     *rom_mem;
+__thread Cpu6502 cpu;
+__thread char    error_message[256]; // I'd prefer not to malloc/free for every test
+__thread u64     rand_state;
 
-// Test setup:
-u8      ram_mem[ROM_OFFSET - RAM_OFFSET];
-u8      rom_mem[ADDR_MAX - ROM_OFFSET];
-Cpu6502 cpu;
-char    error_message[256]; // I'd prefer not to malloc/free for every test
+// rand() for the tests: per thread and seeded per task, so results don't
+// depend on which worker ran what (xorshift64*)
+int test_rand() {
+    rand_state ^= rand_state >> 12;
+    rand_state ^= rand_state << 25;
+    rand_state ^= rand_state >> 27;
+    return (rand_state * 0x2545F4914F6CDD1DULL) >> 33;
+}
 
 void set_mem(u8 *mem, int count_bytes, ...) {
     va_list b;
@@ -48,6 +71,7 @@ void set_mem(u8 *mem, int count_bytes, ...) {
 typedef struct {
     bool is_success;
     bool is_header;
+    bool is_deterministic; // the same every run, so it only runs once a task
 } TestResult;
 
 typedef struct {
@@ -72,6 +96,8 @@ typedef struct {
     u8  bit_fields1;
     u16 addr_bus1;
 
+    const u8 *mem; // the address space it ran in, as it is afterwards
+
 } ExecutionResult;
 
 typedef struct {
@@ -92,19 +118,59 @@ typedef struct {
     u8   a;
     u8   sp;
     u16  pc_jump;
+
+    bool writes_mem;
+    u16  mem_addr;
+    u8   mem; // the byte at mem_addr afterwards
 } ExpectedExecutionResult;
 
 TestResult compare_execution(ExecutionResult         actual,
                              ExpectedExecutionResult expected);
 
+#define assert_equals(expected, actual, value_name)         \
+    if ((actual) != (expected)) {                           \
+        sprintf(error_message,                              \
+                "%s: Expected $%02x (%i), got $%02x (%i).", \
+                value_name,                                 \
+                expected, expected,                         \
+                actual, actual);                            \
+        return (TestResult) {is_success: false};            \
+    }
+
+// Everything else a worker thread needs to run tests.
+typedef struct {
+    u8        lane_mem[CPU_LANES][ADDR_MAX + 1];
+    MemoryMap lane_maps[CPU_LANES];
+    MemoryMap mapper_map; // the mapper tests', set up again by each
+
+    // --lanes: executions are queued up, one per lane, and run together once
+    // every lane is taken or the task is done.
+    CpuLanes                lanes;
+    ExecutionResult         lane_results[CPU_LANES];
+    ExpectedExecutionResult lane_expected[CPU_LANES];
+    int                     n_queued;
+} Worker;
+
+__thread Worker *worker;
+
+bool            stop_after_one(Cpu6502 *c, void *ctx);
+ExecutionResult start_execution();
 ExecutionResult run_cpu();
+TestResult      queue_lane(ExpectedExecutionResult expected);
+TestResult      run_lanes();
 
 TestResult test_execution(ExpectedExecutionResult expected) {
+    if (use_cpu_lanes) {
+        return queue_lane(expected);
+    }
     return compare_execution(run_cpu(), expected);
 }
 
 // pre-execute's
-#define rand_range(lo, hi) ((rand() % (((hi) % 0x100) - ((lo) % 0x100) + 1)) + ((lo) % 0x100))
+// rand_range is a byte: its bounds are taken mod $100, so they can wrap past
+// $FF. Addresses need rand_range16.
+#define rand_range(lo, hi) ((test_rand() % (((hi) % 0x100) - ((lo) % 0x100) + 1)) + ((lo) % 0x100))
+#define rand_range16(lo, hi) ((test_rand() % ((hi) - (lo) + 1)) + (lo))
 #define rand_range_signed(lo, hi) (0x80 + rand_range((lo) + 0x80, (hi) + 0x80)) % 0x100
 
 testcase(ADC_imm__N0) {
@@ -277,6 +343,69 @@ testcase(ADC_imm__V1_overflow) {
     });
 }
 
+// 0 to 99 as two BCD digits
+u8 to_bcd(int n) {
+    return (n / 10) << 4 | n % 10;
+}
+
+#if CPU_HAS_DECIMAL
+testcase(ADC_imm__decimal) {
+    int imm = rand_range(0, 99);
+    int a   = rand_range(0, 99);
+    set_mem(rom_mem, 2, 0x69, to_bcd(imm));
+    cpu.a = to_bcd(a);
+    setflag(cpu.p, STAT_D_DECIMAL);
+    unsetflag(cpu.p, STAT_C_CARRY);
+
+    return test_execution((ExpectedExecutionResult) {
+        num_cycles: 2,
+        instruction_size: 2,
+        updates_a: true,
+        a: to_bcd((a + imm) % 100),
+        flags_ignore: STAT_N_NEGATIVE | STAT_Z_ZERO | STAT_V_OVERFLOW,
+        flags_set: a + imm > 99 ? STAT_C_CARRY : 0,
+        flags_unset: a + imm > 99 ? 0 : STAT_C_CARRY,
+    });
+}
+
+testcase(SBC_imm__decimal) {
+    int imm = rand_range(0, 99);
+    int a   = rand_range(0, 99);
+    set_mem(rom_mem, 2, 0xE9, to_bcd(imm));
+    cpu.a = to_bcd(a);
+    setflag(cpu.p, STAT_D_DECIMAL | STAT_C_CARRY);
+
+    return test_execution((ExpectedExecutionResult) {
+        num_cycles: 2,
+        instruction_size: 2,
+        updates_a: true,
+        a: to_bcd((a - imm + 100) % 100),
+        flags_ignore: STAT_N_NEGATIVE | STAT_Z_ZERO | STAT_V_OVERFLOW,
+        flags_set: a >= imm ? STAT_C_CARRY : 0,
+        flags_unset: a >= imm ? 0 : STAT_C_CARRY,
+    });
+}
+#else
+// the 2A03 has D but no decimal mode
+testcase(ADC_imm__decimal_ignored) {
+    u8 imm = rand_range(0x00, 0xFF);
+    u8 a   = rand_range(0x00, 0xFF);
+    set_mem(rom_mem, 2, 0x69, imm);
+    cpu.a = a;
+    setflag(cpu.p, STAT_D_DECIMAL);
+    unsetflag(cpu.p, STAT_C_CARRY);
+
+    return test_execution((ExpectedExecutionResult) {
+        num_cycles: 2,
+        instruction_size: 2,
+        updates_a: true,
+        a: (a + imm) % 0x100,
+        flags_ignore: STAT_N_NEGATIVE | STAT_Z_ZERO | STAT_C_CARRY | STAT_V_OVERFLOW,
+        flags_set: STAT_D_DECIMAL,
+    });
+}
+#endif
+
 testcase(AND_imm__Z0N0) {
     u8 imm, a, r;
     do {
@@ -670,7 +799,7 @@ testcase(INX_impl__N1Z0_boundary) {
 }
 
 testcase(JMP_abs) {
-    u16 jmp_to = rand_range(0x4010, 0xFF00);
+    u16 jmp_to = rand_range16(0x4010, 0xFF00);
     set_mem(rom_mem, 3, (u8)0x4C, (u8)(jmp_to & 0xFF), (u8)(jmp_to >> 8));
 
     return test_execution((ExpectedExecutionResult) {
@@ -720,6 +849,88 @@ testcase(LDA_imm__N1Z0) {
     });
 }
 
+testcase(LDA_zpg) {
+    u8 zp  = rand_range(0x00, 0xFF);
+    u8 val = rand_range(0x01, 0x7F);
+    set_mem(rom_mem, 2, (u8)0xA5, zp);
+    ram_mem[zp] = val;
+
+    return test_execution((ExpectedExecutionResult) {
+        num_cycles: 3,
+        instruction_size: 2,
+        updates_a: true,
+        a: val,
+        flags_unset: STAT_N_NEGATIVE | STAT_Z_ZERO,
+    });
+}
+
+testcase(LDA_zpgX__wrap) {
+    u8 zp  = rand_range(0xC0, 0xFF);
+    u8 val = rand_range(0x01, 0x7F);
+    set_mem(rom_mem, 2, (u8)0xB5, zp);
+    cpu.x = rand_range(0x40, 0x7F);
+    ram_mem[(u8)(zp + cpu.x)] = val;
+
+    return test_execution((ExpectedExecutionResult) {
+        num_cycles: 4,
+        instruction_size: 2,
+        updates_a: true,
+        a: val,
+        flags_unset: STAT_N_NEGATIVE | STAT_Z_ZERO,
+    });
+}
+
+testcase(LDA_absX) {
+    u16 base = 0x0200 + rand_range(0x00, 0x7F);
+    u8  val  = rand_range(0x80, 0xFF);
+    set_mem(rom_mem, 3, (u8)0xBD, base & 0xFF, base >> 8);
+    cpu.x = rand_range(0x00, 0x7F);
+    ram_mem[base + cpu.x] = val;
+
+    return test_execution((ExpectedExecutionResult) {
+        num_cycles: 4,
+        instruction_size: 3,
+        updates_a: true,
+        a: val,
+        flags_set: STAT_N_NEGATIVE,
+        flags_unset: STAT_Z_ZERO,
+    });
+}
+
+testcase(LDA_absX__page_cross) {
+    u16 base = 0x0200 + rand_range(0x80, 0xFF);
+    u8  val  = rand_range(0x80, 0xFF);
+    set_mem(rom_mem, 3, (u8)0xBD, base & 0xFF, base >> 8);
+    cpu.x = rand_range(0x80, 0xFF);
+    ram_mem[base + cpu.x] = val;
+
+    return test_execution((ExpectedExecutionResult) {
+        num_cycles: 5,
+        instruction_size: 3,
+        updates_a: true,
+        a: val,
+        flags_set: STAT_N_NEGATIVE,
+        flags_unset: STAT_Z_ZERO,
+    });
+}
+
+testcase(LDA_indY__page_cross) {
+    u8 zp  = rand_range(0x00, 0xFE);
+    u8 val = rand_range(0x01, 0x7F);
+    set_mem(rom_mem, 2, (u8)0xB1, zp);
+    set_mem(ram_mem + zp, 2, 0xFF, 0x03);
+    cpu.y = rand_range(0x01, 0xFF);
+    ram_mem[0x03FF + cpu.y] = val;
+
+    return test_execution((ExpectedExecutionResult) {
+        num_cycles: 6,
+        instruction_size: 2,
+        updates_a: true,
+        a: val,
+        flags_unset: STAT_N_NEGATIVE | STAT_Z_ZERO,
+    });
+}
+
 testcase(LDX_imm__N0Z0) {
     u8 val = rand_range(0x01, 0x7F);
     set_mem(rom_mem, 2, (u8)0xA2, val);
@@ -808,6 +1019,241 @@ testcase(NOP_impl) {
     });
 }
 
+testcase(BRK_impl) {
+    u16 vector = test_rand() % 0x10000;
+    set_mem(rom_mem, 2, (u8)0x00, (u8)0xEA);
+    set_mem(rom_mem + 0xFFFE - ROM_OFFSET, 2, (u8)(vector & 0xFF), (u8)(vector >> 8));
+
+    return test_execution((ExpectedExecutionResult) {
+        num_cycles: 7,
+        updates_sp: true,
+        sp: cpu.sp - 3,
+        flags_set: STAT_I_INTERRUPT,
+        performs_jump: true,
+        pc_jump: vector,
+    });
+}
+
+// The NOP at pc isn't run, the interrupt is taken in its place
+testcase(NMI) {
+    u16 vector = test_rand() % 0x10000;
+    set_mem(rom_mem, 1, (u8)0xEA);
+    set_mem(rom_mem + 0xFFFA - ROM_OFFSET, 2, (u8)(vector & 0xFF), (u8)(vector >> 8));
+    cpu_nmi(&cpu);
+
+    return test_execution((ExpectedExecutionResult) {
+        num_cycles: 7,
+        updates_sp: true,
+        sp: cpu.sp - 3,
+        flags_set: STAT_I_INTERRUPT,
+        performs_jump: true,
+        pc_jump: vector,
+    });
+}
+
+testcase(IRQ) {
+    u16 vector = test_rand() % 0x10000;
+    set_mem(rom_mem, 1, (u8)0xEA);
+    set_mem(rom_mem + 0xFFFE - ROM_OFFSET, 2, (u8)(vector & 0xFF), (u8)(vector >> 8));
+    unsetflag(cpu.p, STAT_I_INTERRUPT);
+    cpu_set_irq(&cpu, true);
+
+    return test_execution((ExpectedExecutionResult) {
+        num_cycles: 7,
+        updates_sp: true,
+        sp: cpu.sp - 3,
+        flags_set: STAT_I_INTERRUPT,
+        performs_jump: true,
+        pc_jump: vector,
+    });
+}
+
+testcase(IRQ__masked) {
+    set_mem(rom_mem, 1, (u8)0xEA);
+    setflag(cpu.p, STAT_I_INTERRUPT);
+    cpu_set_irq(&cpu, true);
+
+    return test_execution((ExpectedExecutionResult) {
+        num_cycles: 2,
+        instruction_size: 1,
+    });
+}
+
+#if CPU_VARIANT == CPU_VARIANT_65C02
+testcase(BRA_rel) {
+    u8 offset = rand_range(0x00, 0x7F);
+    set_mem(rom_mem, 2, (u8)0x80, offset);
+
+    return test_execution((ExpectedExecutionResult) {
+        num_cycles: 3,
+        performs_jump: true,
+        pc_jump: ROM_OFFSET + 2 + offset,
+    });
+}
+
+testcase(BIT_imm__Z1) {
+    u8 a = rand_range(0x00, 0xFF);
+    set_mem(rom_mem, 2, (u8)0x89, (u8)~a);
+    cpu.a = a;
+
+    return test_execution((ExpectedExecutionResult) {
+        num_cycles: 2,
+        instruction_size: 2,
+        flags_set: STAT_Z_ZERO,
+    });
+}
+
+testcase(DEC_acc__N1Z0) {
+    u8 a = rand_range(0x81, 0xFF);
+    set_mem(rom_mem, 1, (u8)0x3A);
+    cpu.a = a;
+
+    return test_execution((ExpectedExecutionResult) {
+        num_cycles: 2,
+        instruction_size: 1,
+        updates_a: true,
+        a: a - 1,
+        flags_set: STAT_N_NEGATIVE,
+        flags_unset: STAT_Z_ZERO,
+    });
+}
+
+testcase(JMP_ind__page_end) {
+    u16 jmp_to = rand_range16(0x4010, 0xFF00);
+    u16 ptr    = rand_range(0x02, 0x3F) << 8 | 0xFF;
+    set_mem(rom_mem, 3, (u8)0x6C, (u8)(ptr & 0xFF), (u8)(ptr >> 8));
+    set_mem(ram_mem + ptr, 2, (u8)(jmp_to & 0xFF), (u8)(jmp_to >> 8));
+
+    return test_execution((ExpectedExecutionResult) {
+        num_cycles: 6,
+        performs_jump: true,
+        pc_jump: jmp_to,
+    });
+}
+
+testcase(JMP_absXind) {
+    u16 jmp_to = rand_range16(0x4010, 0xFF00);
+    u16 ptr    = rand_range16(0x0200, 0x3E00);
+    set_mem(rom_mem, 3, (u8)0x7C, (u8)(ptr & 0xFF), (u8)(ptr >> 8));
+    cpu.x = rand_range(0x00, 0xFF);
+    set_mem(ram_mem + ptr + cpu.x, 2, (u8)(jmp_to & 0xFF), (u8)(jmp_to >> 8));
+
+    return test_execution((ExpectedExecutionResult) {
+        num_cycles: 6,
+        performs_jump: true,
+        pc_jump: jmp_to,
+    });
+}
+
+testcase(LDA_zpgind) {
+    u8 zp  = rand_range(0x00, 0xFE);
+    u8 val = rand_range(0x01, 0x7F);
+    set_mem(rom_mem, 2, (u8)0xB2, zp);
+    set_mem(ram_mem + zp, 2, 0x00, 0x03);
+    ram_mem[0x0300] = val;
+
+    return test_execution((ExpectedExecutionResult) {
+        num_cycles: 5,
+        instruction_size: 2,
+        updates_a: true,
+        a: val,
+        flags_unset: STAT_N_NEGATIVE | STAT_Z_ZERO,
+    });
+}
+
+testcase(PHX_impl) {
+    set_mem(rom_mem, 1, (u8)0xDA);
+
+    return test_execution((ExpectedExecutionResult) {
+        num_cycles: 3,
+        instruction_size: 1,
+        updates_sp: true,
+        sp: cpu.sp - 1,
+    });
+}
+
+testcase(PLY_impl__N1Z0) {
+    u8 val = rand_range(0x80, 0xFF);
+    set_mem(rom_mem, 1, (u8)0x7A);
+    ram_mem[0x0100 | (u8)(cpu.sp + 1)] = val;
+
+    return test_execution((ExpectedExecutionResult) {
+        num_cycles: 4,
+        instruction_size: 1,
+        updates_y: true,
+        y: val,
+        updates_sp: true,
+        sp: cpu.sp + 1,
+        flags_set: STAT_N_NEGATIVE,
+        flags_unset: STAT_Z_ZERO,
+    });
+}
+
+testcase(STZ_absX) {
+    u16 addr = rand_range16(0x0200, 0x3E00);
+    set_mem(rom_mem, 3, (u8)0x9E, (u8)(addr & 0xFF), (u8)(addr >> 8));
+    cpu.x                 = rand_range(0x00, 0xFF);
+    ram_mem[addr + cpu.x] = rand_range(0x01, 0xFF);
+
+    return test_execution((ExpectedExecutionResult) {
+        num_cycles: 5,
+        instruction_size: 3,
+        writes_mem: true,
+        mem_addr: addr + cpu.x,
+        mem: 0x00,
+    });
+}
+
+testcase(TSB_zpg__Z1) {
+    u8 zp = rand_range(0x00, 0xFF);
+    set_mem(rom_mem, 2, (u8)0x04, zp);
+    ram_mem[zp] = ~cpu.a;
+
+    return test_execution((ExpectedExecutionResult) {
+        num_cycles: 5,
+        instruction_size: 2,
+        flags_set: STAT_Z_ZERO,
+    });
+}
+
+testcase(NOP_zpgX__undefined) {
+    set_mem(rom_mem, 2, (u8)0x54, (u8)rand_range(0x00, 0xFF));
+
+    return test_execution((ExpectedExecutionResult) {
+        num_cycles: 4,
+        instruction_size: 2,
+    });
+}
+#endif
+
+testcase(PHA_impl) {
+    set_mem(rom_mem, 1, (u8)0x48);
+
+    return test_execution((ExpectedExecutionResult) {
+        num_cycles: 3,
+        instruction_size: 1,
+        updates_sp: true,
+        sp: cpu.sp - 1,
+    });
+}
+
+testcase(PLA_impl__N1Z0) {
+    u8 val = rand_range(0x80, 0xFF);
+    set_mem(rom_mem, 1, (u8)0x68);
+    ram_mem[0x0100 | (u8)(cpu.sp + 1)] = val;
+
+    return test_execution((ExpectedExecutionResult) {
+        num_cycles: 4,
+        instruction_size: 1,
+        updates_a: true,
+        a: val,
+        updates_sp: true,
+        sp: cpu.sp + 1,
+        flags_set: STAT_N_NEGATIVE,
+        flags_unset: STAT_Z_ZERO,
+    });
+}
+
 testcase(SEC_impl) {
     set_mem(rom_mem, 1, (u8)0x38);
     unsetflag(cpu.p, STAT_C_CARRY);
@@ -1058,6 +1504,363 @@ testcase(TYA_imm__N1Z0) {
     });
 }
 
+// Runs the program at the reset vector under d until it stops, then takes the
+// debugger off the memory map again, as the map is shared with the next test.
+CpuStopReason run_debugger(Debugger *d, u64 *cycles) {
+    start_execution();
+    u64           cyc0   = cpu.cyc;
+    CpuStopReason reason = debugger_run(d, 100);
+    *cycles              = cpu.cyc - cyc0;
+    debugger_clear_all(d);
+    return reason;
+}
+
+testcase(BREAK_exec) {
+    set_mem(rom_mem, 5, 0xEA, 0xEA, 0xEA, 0xEA, 0xEA);
+
+    Debugger d;
+    debugger_init(&d, &cpu);
+    debugger_set(&d, BREAK_EXEC, ROM_OFFSET + 3, NULL);
+    u64           cycles;
+    CpuStopReason reason = run_debugger(&d, &cycles);
+
+    // about to fetch the opcode there, the NOPs before it done
+    assert_equals(CPU_STOP_CALLBACK, reason, "Stop reason");
+    assert_equals(ROM_OFFSET + 3, cpu.pc, "Program Counter");
+    assert_equals(cpu.pc, cpu.addr_bus, "Address Bus");
+    assert_equals(6, (int)cycles, "Cycles");
+    assert_equals(BREAK_EXEC, d.hit.kind, "Hit kind");
+    assert_equals(0xEA, d.hit.value, "Hit opcode");
+    return (TestResult) {is_success: true};
+}
+
+testcase(BREAK_read__condition) {
+    // INC $10, INC $10, LDA $10: only the LDA reads 2
+    set_mem(ram_mem + 0x10, 1, 0x00);
+    set_mem(rom_mem, 8, 0xE6, 0x10, 0xE6, 0x10, 0xA5, 0x10, 0xEA, 0xEA);
+
+    Debugger       d;
+    BreakCondition condition = {operand: BREAK_ON_VALUE, compare: BREAK_EQ, value: 2};
+    debugger_init(&d, &cpu);
+    debugger_set(&d, BREAK_READ, 0x10, &condition);
+    u64           cycles;
+    CpuStopReason reason = run_debugger(&d, &cycles);
+
+    // at the end of the LDA
+    assert_equals(CPU_STOP_CALLBACK, reason, "Stop reason");
+    assert_equals(ROM_OFFSET + 6, cpu.pc, "Program Counter");
+    assert_equals(cpu.pc, cpu.addr_bus, "Address Bus");
+    assert_equals(5 + 5 + 3, (int)cycles, "Cycles");
+    assert_equals(2, cpu.a, "Register A");
+    assert_equals(BREAK_READ, d.hit.kind, "Hit kind");
+    assert_equals(0x10, d.hit.addr, "Hit address");
+    assert_equals(2, d.hit.value, "Hit value");
+    return (TestResult) {is_success: true};
+}
+
+testcase(BREAK_write) {
+    // LDA #5, STA $21, STA $20: $21 shares the page but isn't watched
+    set_mem(ram_mem + 0x20, 2, 0x00, 0x00);
+    set_mem(rom_mem, 8, 0xA9, 0x05, 0x85, 0x21, 0x85, 0x20, 0xEA, 0xEA);
+
+    Debugger d;
+    debugger_init(&d, &cpu);
+    debugger_set(&d, BREAK_WRITE, 0x20, NULL);
+    u64           cycles;
+    CpuStopReason reason = run_debugger(&d, &cycles);
+
+    // at the end of the second STA
+    assert_equals(CPU_STOP_CALLBACK, reason, "Stop reason");
+    assert_equals(ROM_OFFSET + 6, cpu.pc, "Program Counter");
+    assert_equals(cpu.pc, cpu.addr_bus, "Address Bus");
+    assert_equals(2 + 3 + 3, (int)cycles, "Cycles");
+    assert_equals(5, ram_mem[0x20], "Memory");
+    assert_equals(BREAK_WRITE, d.hit.kind, "Hit kind");
+    assert_equals(0x20, d.hit.addr, "Hit address");
+    assert_equals(5, d.hit.value, "Hit value");
+    return (TestResult) {is_success: true};
+}
+
+typedef struct {
+    u64 cyc;
+    u16 pc;
+    u8  a, x, y, sp, p;
+    u8  zpg[0x40];
+} BoundaryState;
+
+void record_boundary(BoundaryState *s) {
+    s->cyc = cpu.cyc;
+    s->pc  = cpu.pc;
+    s->a   = cpu.a;
+    s->x   = cpu.x;
+    s->y   = cpu.y;
+    s->sp  = cpu.sp;
+    s->p   = cpu_get_p(&cpu);
+    memcpy(s->zpg, ram_mem, sizeof(s->zpg));
+}
+
+#define REWIND_TEST_STEPS 12
+#define REWIND_TEST_BACK  6
+
+testcase(REWIND_instruction) {
+    // LDX #0, then forever: INX, TXA, STA $10,X
+    set_mem(rom_mem, 9, 0xA2, 0x00, 0xE8, 0x8A, 0x95, 0x10, 0x4C, (ROM_OFFSET + 2) & 0xFF, (ROM_OFFSET + 2) >> 8);
+    memset(ram_mem, 0, 0x40);
+    start_execution();
+
+    // every 8 cycles, so going back crosses snapshots
+    Rewind r;
+    if (!rewind_init(&r, &cpu, 8)) {
+        sprintf(error_message, "Couldn't allocate the snapshots");
+        return (TestResult) {is_success: false};
+    }
+    BoundaryState forward[REWIND_TEST_STEPS + 1];
+    for (int i = 0; i < REWIND_TEST_STEPS; i++) {
+        record_boundary(&forward[i]);
+        cpu_run_until(&cpu, stop_after_one, NULL, MAX_CYCLES_PER_OP);
+        rewind_poll(&r);
+    }
+    record_boundary(&forward[REWIND_TEST_STEPS]);
+
+    bool          rewound[REWIND_TEST_BACK];
+    BoundaryState back[REWIND_TEST_BACK];
+    for (int i = 0; i < REWIND_TEST_BACK; i++) {
+        rewound[i] = rewind_instruction(&r);
+        record_boundary(&back[i]);
+    }
+    rewind_free(&r);
+
+    for (int i = 0; i < REWIND_TEST_BACK; i++) {
+        BoundaryState *e = &forward[REWIND_TEST_STEPS - 1 - i];
+        BoundaryState *a = &back[i];
+        assert_equals(true, rewound[i], "Rewound");
+        assert_equals((int)(e->cyc - forward[0].cyc), (int)(a->cyc - forward[0].cyc), "Cycle");
+        assert_equals(e->pc, a->pc, "Program Counter");
+        assert_equals(e->a, a->a, "Register A");
+        assert_equals(e->x, a->x, "Register X");
+        assert_equals(e->y, a->y, "Register Y");
+        assert_equals(e->sp, a->sp, "Register SP");
+        assert_equals(e->p, a->p, "Status");
+        for (int addr = 0; addr < (int)sizeof(e->zpg); addr++) {
+            assert_equals(e->zpg[addr], a->zpg[addr], "Memory");
+        }
+    }
+    return (TestResult) {is_success: true, is_deterministic: true};
+}
+
+// A cartridge whose every 8KB PRG bank is filled with its number, and every
+// 1KB CHR bank likewise, attached to a memory map of its own.
+bool setup_mapper(Mapper *mp, Cpu6502 *c, MapperId id, size_t prg_size, size_t chr_size) {
+    memset(mp, 0, sizeof(Mapper));
+    mp->id                 = id;
+    mp->prg_size           = prg_size;
+    mp->chr_size           = chr_size;
+    mp->prg                = malloc(prg_size);
+    mp->chr                = malloc(chr_size);
+    mp->prg_ram.map_offset = 0x6000;
+    mp->prg_ram.size       = 0x2000;
+    mp->prg_ram.value      = calloc(mp->prg_ram.size, 1);
+    if (!mp->prg || !mp->chr || !mp->prg_ram.value) {
+        mapper_free(mp);
+        return false;
+    }
+    for (size_t i = 0; i < prg_size; i++) {
+        mp->prg[i] = i / MAPPER_PRG_BANK;
+    }
+    for (size_t i = 0; i < chr_size; i++) {
+        mp->chr[i] = i / MAPPER_CHR_BANK;
+    }
+
+    memset(&worker->mapper_map, 0, sizeof(MemoryMap));
+    memset(c, 0, sizeof(Cpu6502));
+    c->memmap = &worker->mapper_map;
+    if (!mapper_attach(mp, c)) {
+        mapper_free(mp);
+        return false;
+    }
+    return true;
+}
+
+// The bank in each 8KB slot from $8000, as the CPU reads it, and in each 1KB
+// slot of CHR.
+TestResult check_banks(Mapper *mp, const int prg[MAPPER_PRG_SLOTS], const int chr[MAPPER_CHR_SLOTS]) {
+    for (uint i = 0; i < MAPPER_PRG_SLOTS; i++) {
+        memaddr addr = 0x8000 + i * MAPPER_PRG_BANK + 0x123;
+        u8      bank = mem_read_addr(mp->cpu->memmap, addr);
+        if (bank != prg[i]) {
+            sprintf(error_message, "PRG at $%04x: Expected bank %i, got %i.", addr, prg[i], bank);
+            return (TestResult) {is_success: false};
+        }
+    }
+    for (uint i = 0; i < MAPPER_CHR_SLOTS; i++) {
+        u16 addr = i * MAPPER_CHR_BANK + 0x123;
+        u8  bank = *mapper_chr(mp, addr);
+        if (bank != chr[i]) {
+            sprintf(error_message, "CHR at $%04x: Expected bank %i, got %i.", addr, chr[i], bank);
+            return (TestResult) {is_success: false};
+        }
+    }
+    return (TestResult) {is_success: true};
+}
+
+#define check_mapper_banks(mp, ...)                                                 \
+    {                                                                               \
+        const int  banks[MAPPER_PRG_SLOTS + MAPPER_CHR_SLOTS] = {__VA_ARGS__};      \
+        TestResult result = check_banks(mp, banks, banks + MAPPER_PRG_SLOTS);       \
+        if (!result.is_success) {                                                   \
+            mapper_free(mp);                                                        \
+            return result;                                                          \
+        }                                                                           \
+    }
+
+#define setup_mapper_or_fail(mp, c, id, prg_size, chr_size)                  \
+    if (!setup_mapper(mp, c, id, prg_size, chr_size)) {                      \
+        sprintf(error_message, "Couldn't set up the mapper");                \
+        return (TestResult) {is_success: false};                             \
+    }
+
+// The MMC1's serial port: a bit per write, lowest first, the fifth picking the
+// register by its address.
+void mmc1_write(MemoryMap *m, memaddr addr, u8 value) {
+    for (int i = 0; i < 5; i++) {
+        mem_write_addr(m, addr, (value >> i) & 1);
+    }
+}
+
+testcase(MAPPER_mmc1) {
+    Mapper  mp;
+    Cpu6502 c;
+    setup_mapper_or_fail(&mp, &c, MAPPER_MMC1, 0x20000, 0x20000);
+    MemoryMap *m = c.memmap;
+
+    // powers up with the last 16KB fixed at $C000 and 8KB of CHR
+    check_mapper_banks(&mp, 0, 1, 14, 15, 0, 1, 2, 3, 4, 5, 6, 7);
+    mmc1_write(m, 0xE000, 3);
+    check_mapper_banks(&mp, 6, 7, 14, 15, 0, 1, 2, 3, 4, 5, 6, 7);
+
+    // first 16KB fixed at $8000, 4KB CHR banks
+    mmc1_write(m, 0x8000, 0x18);
+    check_mapper_banks(&mp, 0, 1, 6, 7, 0, 1, 2, 3, 0, 1, 2, 3);
+    mmc1_write(m, 0xA000, 5);
+    mmc1_write(m, 0xC000, 9);
+    check_mapper_banks(&mp, 0, 1, 6, 7, 20, 21, 22, 23, 36, 37, 38, 39);
+
+    // the reset bit drops the bits written so far and fixes the last bank again
+    mem_write_addr(m, 0xE000, 1);
+    mem_write_addr(m, 0xE000, 1);
+    mem_write_addr(m, 0xE000, 0x80);
+    check_mapper_banks(&mp, 6, 7, 14, 15, 20, 21, 22, 23, 36, 37, 38, 39);
+    mmc1_write(m, 0xE000, 2);
+    check_mapper_banks(&mp, 4, 5, 14, 15, 20, 21, 22, 23, 36, 37, 38, 39);
+
+    // 32KB, ignoring the low bit of the bank, and 8KB CHR from an even bank
+    mmc1_write(m, 0x8000, 0x00);
+    mmc1_write(m, 0xE000, 3);
+    check_mapper_banks(&mp, 4, 5, 6, 7, 16, 17, 18, 19, 20, 21, 22, 23);
+
+    mapper_free(&mp);
+    return (TestResult) {is_success: true, is_deterministic: true};
+}
+
+testcase(MAPPER_uxrom) {
+    Mapper  mp;
+    Cpu6502 c;
+    setup_mapper_or_fail(&mp, &c, MAPPER_UXROM, 0x20000, 0x2000);
+
+    check_mapper_banks(&mp, 0, 1, 14, 15, 0, 1, 2, 3, 4, 5, 6, 7);
+    // the latch answers anywhere in $8000-$FFFF and selects 16KB at $8000
+    mem_write_addr(c.memmap, 0xC123, 5);
+    check_mapper_banks(&mp, 10, 11, 14, 15, 0, 1, 2, 3, 4, 5, 6, 7);
+
+    mapper_free(&mp);
+    return (TestResult) {is_success: true, is_deterministic: true};
+}
+
+testcase(MAPPER_cnrom) {
+    Mapper  mp;
+    Cpu6502 c;
+    setup_mapper_or_fail(&mp, &c, MAPPER_CNROM, 0x8000, 0x8000);
+
+    check_mapper_banks(&mp, 0, 1, 2, 3, 0, 1, 2, 3, 4, 5, 6, 7);
+    // the latch selects 8KB of CHR, PRG stays put
+    mem_write_addr(c.memmap, 0x8000, 2);
+    check_mapper_banks(&mp, 0, 1, 2, 3, 16, 17, 18, 19, 20, 21, 22, 23);
+
+    mapper_free(&mp);
+    return (TestResult) {is_success: true, is_deterministic: true};
+}
+
+testcase(MAPPER_mmc3) {
+    Mapper  mp;
+    Cpu6502 c;
+    setup_mapper_or_fail(&mp, &c, MAPPER_MMC3, 0x20000, 0x20000);
+    MemoryMap *m = c.memmap;
+
+    check_mapper_banks(&mp, 0, 0, 14, 15, 0, 1, 0, 1, 0, 0, 0, 0);
+    // R0-R7 through $8000/$8001; R0 and R1 are 2KB, so the low bit goes
+    const u8 values[8] = {11, 20, 30, 31, 32, 33, 3, 5};
+    for (u8 r = 0; r < 8; r++) {
+        mem_write_addr(m, 0x8000, r);
+        mem_write_addr(m, 0x8001, values[r]);
+    }
+    check_mapper_banks(&mp, 3, 5, 14, 15, 10, 11, 20, 21, 30, 31, 32, 33);
+
+    // R6 at $C000, the second to last bank at $8000
+    mem_write_addr(m, 0x8000, 0x40);
+    check_mapper_banks(&mp, 14, 5, 3, 15, 10, 11, 20, 21, 30, 31, 32, 33);
+    // and CHR inverted: the 1KB banks at $0000, the 2KB ones at $1000
+    mem_write_addr(m, 0x8000, 0xC0);
+    check_mapper_banks(&mp, 14, 5, 3, 15, 30, 31, 32, 33, 10, 11, 20, 21);
+    // the registers' mirrors ($8000 and $8001 every other byte) do the same
+    mem_write_addr(m, 0x9FFE, 0x07);
+    mem_write_addr(m, 0x9FFF, 7);
+    check_mapper_banks(&mp, 3, 7, 14, 15, 10, 11, 20, 21, 30, 31, 32, 33);
+
+    mapper_free(&mp);
+    return (TestResult) {is_success: true, is_deterministic: true};
+}
+
+testcase(MAPPER_mmc3__irq) {
+    Mapper  mp;
+    Cpu6502 c;
+    setup_mapper_or_fail(&mp, &c, MAPPER_MMC3, 0x20000, 0x20000);
+    MemoryMap *m = c.memmap;
+
+    // the first scanline loads the counter with 3, the next three count it
+    // down, and reaching 0 raises the IRQ
+    mem_write_addr(m, 0xC000, 3);
+    mem_write_addr(m, 0xC001, 0);
+    mem_write_addr(m, 0xE001, 0);
+    for (int round = 0; round < 2; round++) {
+        for (int i = 0; i < 3; i++) {
+            mapper_scanline(&mp);
+            if (c.bit_fields & PIN_IRQ) {
+                sprintf(error_message, "IRQ after %i scanlines, expected 4 (round %i)", i + 1, round);
+                mapper_free(&mp);
+                return (TestResult) {is_success: false};
+            }
+        }
+        mapper_scanline(&mp);
+        if (!(c.bit_fields & PIN_IRQ)) {
+            sprintf(error_message, "No IRQ after 4 scanlines (round %i)", round);
+            mapper_free(&mp);
+            return (TestResult) {is_success: false};
+        }
+        // acknowledged by disabling it, then on again: the counter at 0
+        // reloads on the next scanline and counts down the same way
+        mem_write_addr(m, 0xE000, 0);
+        mem_write_addr(m, 0xE001, 0);
+        if (c.bit_fields & PIN_IRQ) {
+            sprintf(error_message, "IRQ still raised after $E000 (round %i)", round);
+            mapper_free(&mp);
+            return (TestResult) {is_success: false};
+        }
+    }
+
+    mapper_free(&mp);
+    return (TestResult) {is_success: true, is_deterministic: true};
+}
+
 void get_test_name(char *buff, void *test_func) {
     void * bt[1] = {test_func};
     char **b     = backtrace_symbols(bt, 1);
@@ -1094,15 +1897,46 @@ header(__HEADER__FLAG__,       "Flag Instructions");
 header(__HEADER__COMP__,       "Comparison Instructions");
 header(__HEADER__BRANCH__,     "Branch Instructions");
 header(__HEADER__MISC__,       "Miscellaneous Instructions");
+header(__HEADER__INTERRUPT__,  "Interrupts");
+header(__HEADER__65C02__,      "65C02 Instructions");
+header(__HEADER__DEBUGGER__,   "Debugger");
+header(__HEADER__REWIND__,     "Rewind");
+header(__HEADER__MAPPER__,     "Mappers");
 
 void parse_args(int argc, char *argv[]);
 void setup_all_for_tests();
 void reset_for_test();
 
+// Shared by the workers. Each test's repetitions are split into tasks of
+// RUNS_PER_TASK, handed out in order, test by test.
+TestResult (**tests)();
+int         n_tests;
+int         tasks_per_test;
+int         next_task = 0;
+int        *first_failed_task; // per test, tasks after it are skipped
+
+typedef struct {
+    bool       ran;
+    TestResult result;
+    char       error_message[256];
+    clock_t    clocks; // CPU time of the worker thread
+} TaskResult;
+
+TaskResult *task_results;
+
+clock_t timespec_clocks(struct timespec *ts) {
+    return ts->tv_sec * CLOCKS_PER_SEC + ts->tv_nsec / (1000000000 / CLOCKS_PER_SEC);
+}
+
+void *run_worker(void *arg);
+
 int main(int argc, char *argv[]) {
-    init_profiler();
     enable_stacktrace();
     parse_args(argc, argv);
+    // the profiler's event stream is shared, so it only works single threaded
+    if (n_jobs == 1) {
+        init_profiler();
+    }
 
     TestResult (*test_functions[])() = {
 
@@ -1110,6 +1944,11 @@ int main(int argc, char *argv[]) {
         &LDA_imm__N0Z0,
         &LDA_imm__N0Z1,
         &LDA_imm__N1Z0,
+        &LDA_zpg,
+        &LDA_zpgX__wrap,
+        &LDA_absX,
+        &LDA_absX__page_cross,
+        &LDA_indY__page_cross,
         &LDX_imm__N0Z0,
         &LDX_imm__N0Z1,
         &LDX_imm__N1Z0,
@@ -1137,9 +1976,9 @@ int main(int argc, char *argv[]) {
         &TYA_imm__N1Z0,
 
     &__HEADER__STACK__,
-        // PHA
+        &PHA_impl,
         // PHP
-        // PLA
+        &PLA_impl__N1Z0,
         // PLP
 
     &__HEADER__INCDEC__,
@@ -1173,6 +2012,12 @@ int main(int argc, char *argv[]) {
         &ADC_imm__V0_overflow,
         &ADC_imm__V1_underflow,
         &ADC_imm__V1_overflow,
+#if CPU_HAS_DECIMAL
+        &ADC_imm__decimal,
+        &SBC_imm__decimal,
+#else
+        &ADC_imm__decimal_ignored,
+#endif
         // SBC
 
     &__HEADER__LOGIC__,
@@ -1220,58 +2065,105 @@ int main(int argc, char *argv[]) {
         &JMP_abs,
         // JSR
         // RTS
-        // BRK
+        &BRK_impl,
         // RTI
         // BIT
         &NOP_impl,
+
+    &__HEADER__INTERRUPT__,
+        &NMI,
+        &IRQ,
+        &IRQ__masked,
+
+#if CPU_VARIANT == CPU_VARIANT_65C02
+    &__HEADER__65C02__,
+        &BRA_rel,
+        &BIT_imm__Z1,
+        &DEC_acc__N1Z0,
+        &JMP_ind__page_end,
+        &JMP_absXind,
+        &LDA_zpgind,
+        &PHX_impl,
+        &PLY_impl__N1Z0,
+        &STZ_absX,
+        &TSB_zpg__Z1,
+        &NOP_zpgX__undefined,
+#endif
+
+    &__HEADER__DEBUGGER__,
+        &BREAK_exec,
+        &BREAK_read__condition,
+        &BREAK_write,
+
+    &__HEADER__REWIND__,
+        &REWIND_instruction,
+
+    &__HEADER__MAPPER__,
+        &MAPPER_mmc1,
+        &MAPPER_uxrom,
+        &MAPPER_cnrom,
+        &MAPPER_mmc3,
+        &MAPPER_mmc3__irq,
     };
 
-    char buff[64];
-    int  n_tests = sizeof(test_functions) / (sizeof(test_functions[0]));
+    tests   = test_functions;
+    n_tests = sizeof(test_functions) / (sizeof(test_functions[0]));
 
     printf("\n");
 
     const int CLOCKS_PER_MS = (CLOCKS_PER_SEC / 1000);
 
-    bool    all_success = true;
-    clock_t start_all   = clock();
-
-    MemoryMap mem;
-    mem.n_read_blocks  = 0;
-    mem.n_write_blocks = 0;
-    mem._ppu           = NULL;
+    bool            all_success = true;
+    struct timespec start_all, end_all;
+    clock_gettime(CLOCK_MONOTONIC, &start_all);
 
-    Ram ram;
-    ram.value      = ram_mem;
-    ram.size       = ROM_OFFSET - RAM_OFFSET;
-    ram.map_offset = RAM_OFFSET;
-    mem_add_ram(&mem, &ram, "RAM");
+    tasks_per_test    = n_executions > RUNS_PER_TASK ? (n_executions + RUNS_PER_TASK - 1) / RUNS_PER_TASK : 1;
+    task_results      = calloc(n_tests * tasks_per_test, sizeof(TaskResult));
+    first_failed_task = malloc(n_tests * sizeof(int));
+    for (int i = 0; i < n_tests; i++) {
+        first_failed_task[i] = tasks_per_test;
+    }
 
-    Rom rom;
-    rom.value      = rom_mem;
-    rom.rom_size   = ADDR_MAX - ROM_OFFSET;
-    rom.map_offset = ROM_OFFSET;
-    mem_add_rom(&mem, &rom, "ROM");
+    // workers take tasks until there are none left, so fewer threads than
+    // asked for still run everything, and with none this one does
+    pthread_t *threads   = malloc(n_jobs * sizeof(pthread_t));
+    int        n_started = 0;
+    while (threads && n_started < n_jobs && pthread_create(&threads[n_started], NULL, run_worker, NULL) == 0) {
+        n_started++;
+    }
+    if (n_started < n_jobs) {
+        fprintf(stderr, "Started %i of %i worker threads\n", n_started, n_jobs);
+    }
+    if (n_started == 0) {
+        run_worker(NULL);
+    }
+    for (int i = 0; i < n_started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
 
-    cpu.memmap = &mem;
+    clock_gettime(CLOCK_MONOTONIC, &end_all);
 
+    char buff[64];
     for (int test_index = 0; test_index < n_tests; test_index++) {
-        TestResult (*test)() = test_functions[test_index];
-        get_test_name(buff, test);
-
-        reset_for_test();
-        clock_t    start_test = clock();
-        TestResult result;
-        for (int n = 0; n < n_executions; n++)
-        {
-            result = test();
-            if (!result.is_success) break;
+        get_test_name(buff, tests[test_index]);
+
+        // the first failing task decides; the ones after it were skipped
+        TaskResult *tasks          = task_results + test_index * tasks_per_test;
+        TaskResult *first          = &tasks[0];
+        clock_t     runtime_clocks = 0;
+        for (int t = 0; t < tasks_per_test && tasks[t].ran; t++) {
+            runtime_clocks += tasks[t].clocks;
+            if (!tasks[t].result.is_success && !tasks[t].result.is_header) {
+                first = &tasks[t];
+                break;
+            }
         }
-        clock_t    end_test   = clock();
+        TestResult result = first->result;
 
         if (!print_errors_only || (!result.is_header && !result.is_success)) {
             if (result.is_header) {
-                printf("%s:\n", error_message);
+                printf("%s:\n", first->error_message);
                 continue;
             }
 
@@ -1284,23 +2176,20 @@ int main(int argc, char *argv[]) {
                 printf(" Failed");
             }
 
-            int runtime_clocks = end_test - start_test;
-            int runtime_ms     = runtime_clocks / CLOCKS_PER_MS;
+            int runtime_ms = runtime_clocks / CLOCKS_PER_MS;
             printf(" (%ims", runtime_ms);
             if (runtime_ms == 0) {
-                printf(" %i ticks", runtime_clocks);
+                printf(" %li ticks", runtime_clocks);
             }
             printf(")");
 
             if (!result.is_success) {
-                printf(" - %s", error_message);
+                printf(" - %s", first->error_message);
             }
             printf("\n");
         }
     }
 
-    clock_t end_all = clock();
-
     if (all_success) {
         printf("All unit tests completed successfully. Total run time: ");
     }
@@ -1308,7 +2197,7 @@ int main(int argc, char *argv[]) {
         printf("Unit tests failed. Total run time: ");
     }
 
-    int total_runtime_clocks = end_all - start_all;
+    int total_runtime_clocks = timespec_clocks(&end_all) - timespec_clocks(&start_all);
     int total_runtime_ms     = total_runtime_clocks / CLOCKS_PER_MS;
     printf("%ims", total_runtime_ms);
     if (total_runtime_ms == 0) {
@@ -1329,37 +2218,64 @@ int main(int argc, char *argv[]) {
     }
 
 void parse_args(int argc, char *argv[]) {
-    unsigned int seed = time(NULL);
+    seed = time(NULL);
 
     for (int i = 1; i < argc; i++) {
         arg("--seed",        1, { seed = (unsigned int)atoi(argv[i + 1]); });
         arg("--errors-only", 0, { print_errors_only = true; });
         arg("-e",            0, { print_errors_only = true; });
         arg("-n",            1, { n_executions = atoi(argv[i+1]); });
+        arg("--step",        0, { use_cpu_step = true; });
+        arg("-s",            0, { use_cpu_step = true; });
+        arg("--lanes",       0, { use_cpu_lanes = true; });
+        arg("-l",            0, { use_cpu_lanes = true; });
+        arg("--jobs",        1, { n_jobs = atoi(argv[i + 1]); });
+        arg("-j",            1, { n_jobs = atoi(argv[i + 1]); });
+    }
+    if (n_jobs <= 0) {
+        n_jobs = sysconf(_SC_NPROCESSORS_ONLN);
     }
 
     printf("rand seed:  %i\n", seed);
     printf("executions: %i\n", n_executions);
-    srand(seed);
+    printf("cpu mode:   %s\n", use_cpu_lanes ? "cpu_lanes_step" : use_cpu_step ? "cpu_step" : "cpu_pulse");
+    printf("variant:    %s\n", CPU_VARIANT_NAME);
+    printf("jobs:       %i\n", n_jobs);
 }
 
+// Cleared memory and random registers. The CPU itself is only reset (which
+// logs) if a failed test left it in the middle of an instruction.
 void reset_for_test() {
-    cpu_resb(&cpu);
-    cpu.x  = rand() % 0xFF;
-    cpu.y  = rand() % 0xFF;
-    cpu.a  = rand() % 0xFF;
-    cpu.sp = rand() % 0xFF;
-    cpu.p  = rand() % 0xFF;
+    for (int i = 0; i < (use_cpu_lanes ? CPU_LANES : 1); i++) {
+        memset(worker->lane_mem[i], 0, sizeof(worker->lane_mem[i]));
+        set_mem(worker->lane_mem[i] + 0xFFFC, 2, ROM_OFFSET & 0xFF, ROM_OFFSET >> 8);
+    }
+
+    if (cpu.tcu != 0) {
+        cpu_resb(&cpu);
+    }
+    unsetflag(cpu.bit_fields, PIN_NMI | PIN_IRQ);
+    cpu_set_p(&cpu, cpu_get_p(&cpu)); // so p can be poked directly
+    cpu.x  = test_rand() % 0xFF;
+    cpu.y  = test_rand() % 0xFF;
+    cpu.a  = test_rand() % 0xFF;
+    cpu.sp = test_rand() % 0xFF;
+    cpu.p  = test_rand() % 0xFF;
+#if CPU_HAS_DECIMAL
+    unsetflag(cpu.p, STAT_D_DECIMAL); // binary arithmetic, unless a test sets it
+#endif
     // shouldn't matter, but that's why I'm rand()ing them
-    cpu.ir       = rand() % 0xFF;
-    cpu.pd       = rand() % 0xFF;
-    cpu.data_bus = rand() % 0xFF;
+    cpu.ir       = test_rand() % 0xFF;
+    cpu.pd       = test_rand() % 0xFF;
+    cpu.data_bus = test_rand() % 0xFF;
+}
 
-    set_mem(rom_mem + (0xFFFC - ROM_OFFSET), 2, ROM_OFFSET & 0xFF,
-            ROM_OFFSET >> 8);
+bool stop_after_one(Cpu6502 *c, void *ctx) {
+    return true;
 }
 
-ExecutionResult run_cpu() {
+// Points cpu at the reset vector and records the initial values
+ExecutionResult start_execution() {
     cpu.pc = (rom_mem[0xFFFD - ROM_OFFSET] << 8) | rom_mem[0xFFFC - ROM_OFFSET];
     cpu.addr_bus = cpu.pc;
 
@@ -1369,36 +2285,190 @@ ExecutionResult run_cpu() {
     info.y0  = cpu.y;
     info.a0  = cpu.a;
     info.sp0 = cpu.sp;
-    info.p0  = cpu.p;
+    info.p0  = cpu_get_p(&cpu);
+    info.mem = ram_mem - RAM_OFFSET;
+    return info;
+}
+
+void finish_execution(ExecutionResult *info, Cpu6502 *c) {
+    info->pc1         = c->pc;
+    info->x1          = c->x;
+    info->y1          = c->y;
+    info->a1          = c->a;
+    info->sp1         = c->sp;
+    info->p1          = cpu_get_p(c);
+    info->bit_fields1 = c->bit_fields;
+    info->addr_bus1   = c->addr_bus;
+}
+
+ExecutionResult run_cpu() {
+    ExecutionResult info = start_execution();
 
     int cycles = 0;
-    do {
-        cpu_pulse(&cpu);
-        cycles++;
-    } while (cpu.tcu != 0 && cycles < MAX_CYCLES_PER_OP);
-
-    info.num_cycles  = cycles;
-    info.pc1         = cpu.pc;
-    info.x1          = cpu.x;
-    info.y1          = cpu.y;
-    info.a1          = cpu.a;
-    info.sp1         = cpu.sp;
-    info.p1          = cpu.p;
-    info.bit_fields1 = cpu.bit_fields;
-    info.addr_bus1   = cpu.addr_bus;
+    if (use_cpu_step) {
+        cycles = cpu_step(&cpu);
+    }
+    else {
+        u64 cyc0 = cpu.cyc;
+        cpu_run_until(&cpu, stop_after_one, NULL, MAX_CYCLES_PER_OP);
+        cycles = cpu.cyc - cyc0;
+    }
+
+    info.num_cycles = cycles;
+    finish_execution(&info, &cpu);
 
     return info;
 }
 
-#define assert_equals(expected, actual, value_name)         \
-    if ((actual) != (expected)) {                           \
-        sprintf(error_message,                              \
-                "%s: Expected $%02x (%i), got $%02x (%i).", \
-                value_name,                                 \
-                expected, expected,                         \
-                actual, actual);                            \
-        return (TestResult) {is_success: false};            \
+void select_lane(int lane) {
+    ram_mem = worker->lane_mem[lane] + RAM_OFFSET;
+    rom_mem = worker->lane_mem[lane] + ROM_OFFSET;
+}
+
+TestResult queue_lane(ExpectedExecutionResult expected) {
+    Worker *w = worker;
+
+    w->lane_results[w->n_queued]  = start_execution();
+    w->lane_expected[w->n_queued] = expected;
+    cpu.memmap                    = &w->lane_maps[w->n_queued];
+    cpu_lanes_load(&w->lanes, w->n_queued, &cpu);
+    cpu.memmap = &w->lane_maps[0];
+
+    w->n_queued++;
+    if (w->n_queued == CPU_LANES) {
+        return run_lanes();
+    }
+    select_lane(w->n_queued);
+    return (TestResult) {is_success: true};
+}
+
+TestResult run_lanes() {
+    Worker *w   = worker;
+    int     n   = w->n_queued;
+    w->n_queued = 0;
+    select_lane(0);
+
+    if (n == 0) {
+        return (TestResult) {is_success: true};
+    }
+    u64 cyc0[CPU_LANES];
+    for (int i = 0; i < n; i++) {
+        cyc0[i] = w->lanes.cyc[i];
+    }
+    w->lanes.n_lanes = n;
+    cpu_lanes_step(&w->lanes);
+
+    for (int i = 0; i < n; i++) {
+        Cpu6502 c;
+        cpu_lanes_store(&w->lanes, i, &c);
+        w->lane_results[i].num_cycles = c.cyc - cyc0[i];
+        finish_execution(&w->lane_results[i], &c);
+
+        TestResult result = compare_execution(w->lane_results[i], w->lane_expected[i]);
+        if (!result.is_success) {
+            return result;
+        }
+    }
+    return (TestResult) {is_success: true};
+}
+
+// From --seed, the test and the task, so nothing depends on scheduling (splitmix64)
+u64 task_seed(int test_index, int task) {
+    u64 z = seed ^ ((u64)test_index << 32 | (u32)task);
+    z += 0x9E3779B97F4A7C15ULL;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return (z ^ (z >> 31)) | 1; // xorshift can't start from 0
+}
+
+void run_task(int test_index, int task, TaskResult *r) {
+    TestResult (*test)() = tests[test_index];
+    int runs = n_executions - task * RUNS_PER_TASK;
+    if (runs > RUNS_PER_TASK) {
+        runs = RUNS_PER_TASK;
+    }
+
+    rand_state = task_seed(test_index, task);
+    reset_for_test();
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &start);
+    TestResult result = {is_success: true};
+    for (int n = 0; n < runs; n++) {
+        result = test();
+        if (!result.is_success || result.is_deterministic) break;
+    }
+    if (use_cpu_lanes && result.is_success && !result.is_header) {
+        result = run_lanes();
+    }
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &end);
+
+    r->ran    = true;
+    r->result = result;
+    r->clocks = timespec_clocks(&end) - timespec_clocks(&start);
+    memcpy(r->error_message, error_message, sizeof(r->error_message));
+}
+
+void *run_worker(void *arg) {
+    // CpuLanes wants its vectors aligned, and aligned_alloc a multiple of it
+    size_t size = (sizeof(Worker) + CPU_LANES - 1) / CPU_LANES * CPU_LANES;
+    worker      = aligned_alloc(CPU_LANES, size);
+    if (!worker) {
+        fprintf(stderr, "Worker couldn't allocate its memory\n");
+        return NULL; // the others take its tasks
+    }
+    memset(worker, 0, sizeof(Worker));
+
+    for (int i = 0; i < CPU_LANES; i++) {
+        MemoryMap *mem = &worker->lane_maps[i];
+
+        Ram ram;
+        ram.value      = worker->lane_mem[i] + RAM_OFFSET;
+        ram.size       = ROM_OFFSET - RAM_OFFSET;
+        ram.map_offset = RAM_OFFSET;
+        mem_add_ram(mem, &ram, "RAM");
+
+        Rom rom;
+        rom.value      = worker->lane_mem[i] + ROM_OFFSET;
+        rom.rom_size   = ADDR_MAX + 1 - ROM_OFFSET;
+        rom.map_offset = ROM_OFFSET;
+        mem_add_rom(mem, &rom, "ROM");
     }
+    cpu_lanes_init(&worker->lanes, CPU_LANES);
+    select_lane(0);
+
+    memset(&cpu, 0, sizeof(cpu));
+    cpu.memmap = &worker->lane_maps[0];
+    cpu.tcu    = 1; // so the first reset_for_test resets it
+
+    int n_tasks = n_tests * tasks_per_test;
+    while (true) {
+        int i = __atomic_fetch_add(&next_task, 1, __ATOMIC_RELAXED);
+        if (i >= n_tasks) {
+            break;
+        }
+
+        int test_index = i / tasks_per_test;
+        int task       = i % tasks_per_test;
+        if (task > __atomic_load_n(&first_failed_task[test_index], __ATOMIC_RELAXED)) {
+            continue;
+        }
+
+        TaskResult *r = &task_results[i];
+        run_task(test_index, task, r);
+
+        if (!r->result.is_success && !r->result.is_header) {
+            int failed = __atomic_load_n(&first_failed_task[test_index], __ATOMIC_RELAXED);
+            while (task < failed
+                   && !__atomic_compare_exchange_n(&first_failed_task[test_index], &failed, task,
+                                                   false, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            }
+        }
+    }
+
+    free(worker);
+    return NULL;
+}
 
 TestResult compare_execution(ExecutionResult         actual,
                              ExpectedExecutionResult expected) {
@@ -1474,5 +2544,9 @@ TestResult compare_execution(ExecutionResult         actual,
     check_flag(expected, actual, STAT_Z_ZERO,      "Z");
     check_flag(expected, actual, STAT_C_CARRY,     "C");
 
+    if (expected.writes_mem) {
+        assert_equals(expected.mem, actual.mem[expected.mem_addr], "Memory");
+    }
+
     return (TestResult) {is_success: true};
 }
@@ -0,0 +1,192 @@
+#include "headers/guestprofile.h"
+#include "headers/disasm.h"
+#include "headers/profile.h"
+#include "stdlib.h"
+#include "string.h"
+
+void guest_profile_attach(Cpu6502 *c, GuestProfile *p) {
+    c->profile = p;
+    if (p) {
+        p->pc  = c->pc;
+        p->cyc = c->cyc;
+    }
+}
+
+void guest_profile_clear(GuestProfile *p) {
+    memset(p->cycles, 0, sizeof(p->cycles));
+}
+
+u64 guest_profile_total(GuestProfile *p) {
+    u64 total = 0;
+    for (uint pc = 0; pc < 0x10000; pc++) {
+        total += p->cycles[pc];
+    }
+    return total;
+}
+
+// Reads around MMIO, so nothing is disturbed
+u8 _guest_profile_peek(MemoryMap *m, memaddr addr) {
+    MemoryBlock *b = mem_get_read_block(m, addr);
+    return b ? b->values[addr - b->range_low] : 0;
+}
+
+int _guest_profile_cmp(const void *a, const void *b) {
+    const GuestProfileEntry *x = a;
+    const GuestProfileEntry *y = b;
+    return x->cycles < y->cycles ? 1 : x->cycles > y->cycles ? -1 : x->pc - y->pc;
+}
+
+int guest_profile_top(GuestProfile *p, GuestProfileEntry *top, int n) {
+    static GuestProfileEntry all[0x10000];
+    int                      n_ran = 0;
+    for (uint pc = 0; pc < 0x10000; pc++) {
+        if (p->cycles[pc]) {
+            all[n_ran++] = (GuestProfileEntry) {pc: pc, cycles: p->cycles[pc]};
+        }
+    }
+    qsort(all, n_ran, sizeof(all[0]), _guest_profile_cmp);
+
+    if (n > n_ran) {
+        n = n_ran;
+    }
+    memcpy(top, all, n * sizeof(all[0]));
+    return n;
+}
+
+// The instruction at pc; returns its size.
+int _guest_profile_disasm(MemoryMap *m, memaddr pc, Disassembler *d, Disassembly *out) {
+    u8 bytes[3];
+    for (int i = 0; i < 3; i++) {
+        bytes[i] = _guest_profile_peek(m, pc + i);
+    }
+    *out = disasm(d, bytes, sizeof(bytes), 1);
+    return out->countBytes;
+}
+
+void guest_profile_print_flat(GuestProfile *p, MemoryMap *m, FILE *f, int n) {
+    static GuestProfileEntry top[0x10000];
+    static Disassembler      d;
+    u64                      total = guest_profile_total(p);
+    n                              = guest_profile_top(p, top, n < 0x10000 ? n : 0x10000);
+
+    fprintf(f, "  %-5s  %13s %6s  %s\n", "pc", "cycles", "share", "instruction");
+    for (int i = 0; i < n; i++) {
+        Disassembly dis;
+        _guest_profile_disasm(m, top[i].pc, &d, &dis);
+        fprintf(f, "  $%04X  %13lu %5.1f%%  %s\n",
+                top[i].pc, top[i].cycles, total ? 100.0 * top[i].cycles / total : 0.0, dis.text[0]);
+    }
+    fprintf(f, "  %-5s  %13lu\n", "total", total);
+}
+
+void guest_profile_print_annotated(GuestProfile *p, MemoryMap *m, FILE *f, memaddr from, memaddr to) {
+    static Disassembler d;
+    u64                 total = guest_profile_total(p);
+    bool                gap   = false;
+
+    for (uint pc = from; pc <= to;) {
+        if (p->cycles[pc] == 0) {
+            gap = true;
+            pc++;
+            continue;
+        }
+        if (gap) {
+            fprintf(f, "\n");
+            gap = false;
+        }
+
+        Disassembly dis;
+        int         size = _guest_profile_disasm(m, pc, &d, &dis);
+        fprintf(f, "  $%04X  %s %-22s %13lu %5.1f%%\n",
+                pc, dis.bytes[0], dis.text[0], p->cycles[pc], total ? 100.0 * p->cycles[pc] / total : 0.0);
+        pc += size;
+    }
+}
+
+bool guest_calls_start(GuestProfile *p, GuestCallGraph *g, Cpu6502 *c) {
+    memset(g, 0, sizeof(GuestCallGraph));
+    g->start       = c->cyc;
+    g->frames_json = open_memstream(&g->frames_buf, &g->frames_size);
+    g->events_json = open_memstream(&g->events_buf, &g->events_size);
+    p->calls       = g;
+    if (!g->frames_json || !g->events_json) {
+        guest_calls_write(p, c, NULL, NULL);
+        return false;
+    }
+    return true;
+}
+
+// Closes every frame with an sp below `limit`, innermost first.
+void _guest_calls_unwind(GuestCallGraph *g, int limit, u64 cyc) {
+    while (g->depth > 0 && g->stack[g->depth - 1].sp < limit) {
+        g->depth--;
+        fprintf(g->events_json, "        {\"type\":\"C\",\"frame\":%u,\"at\":%lu},\n",
+                g->frames[g->stack[g->depth].addr] - 1, cyc);
+    }
+}
+
+// Called by the CPU at every boundary while tracing: the instruction in ir
+// (or the interrupt, with CPU_IN_INTERRUPT set) has run and pc is next.
+void _guest_calls_boundary(GuestCallGraph *g, Cpu6502 *c, memaddr pc) {
+    const char *kind;
+    if (c->bit_fields & CPU_IN_INTERRUPT) {
+        memaddr nmi = _guest_profile_peek(c->memmap, 0xFFFA) | (_guest_profile_peek(c->memmap, 0xFFFB) << 8);
+        kind        = pc == nmi ? "NMI " : "IRQ ";
+    }
+    else {
+        switch (c->ir) {
+            case 0x20: // JSR
+                kind = "";
+                break;
+            case 0x00: // BRK
+                kind = "BRK ";
+                break;
+            case 0x40: // RTI
+            case 0x60: // RTS
+                _guest_calls_unwind(g, c->sp, c->cyc);
+                return;
+            default:
+                return;
+        }
+    }
+
+    // whatever was open at or below this sp has been abandoned
+    _guest_calls_unwind(g, c->sp + 1, c->cyc);
+    if (!g->frames[pc]) {
+        g->frames[pc] = ++g->n_frames;
+        fprintf(g->frames_json, "      {\"name\":\"%s$%04X\"},\n", kind, pc);
+    }
+    g->stack[g->depth++] = (GuestCall) {addr: pc, sp: c->sp};
+    fprintf(g->events_json, "        {\"type\":\"O\",\"frame\":%u,\"at\":%lu},\n", g->frames[pc] - 1, c->cyc);
+}
+
+bool guest_calls_write(GuestProfile *p, Cpu6502 *c, const char *name, const char *file_name) {
+    GuestCallGraph *g = p->calls;
+    if (!g) {
+        return false;
+    }
+    p->calls = NULL;
+
+    if (g->frames_json && g->events_json) {
+        _guest_calls_unwind(g, 0x100, c->cyc);
+    }
+    if (g->frames_json) {
+        fclose(g->frames_json);
+    }
+    if (g->events_json) {
+        fclose(g->events_json);
+    }
+
+    bool  written = false;
+    FILE *fd      = g->frames_buf && g->events_buf && file_name ? fopen(file_name, "w") : NULL;
+    if (fd) {
+        write_speedscope(fd, name, "none", g->start, c->cyc,
+                         g->frames_buf, g->frames_size, g->events_buf, g->events_size, NULL);
+        fclose(fd);
+        written = true;
+    }
+    free(g->frames_buf);
+    free(g->events_buf);
+    memset(g, 0, sizeof(GuestCallGraph));
+    return written;
+}
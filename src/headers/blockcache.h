@@ -0,0 +1,66 @@
+#ifndef BLOCKCACHE_H
+#define BLOCKCACHE_H
+
+#include "common.h"
+#include "memmap.h"
+
+// Predecoded basic blocks for cpu_run_blocks: runs of instructions starting at
+// a pc and ending after the first branch/jump/call/return (or at
+// BLOCK_MAX_INSTRUCTIONS), with their operand bytes already fetched. They're
+// peeked, not read through the memory map, so decoding ahead doesn't set off
+// watchpoints or read I/O for bytes that may never run.
+//
+// Blocks decoded out of writable memory remember the version of the pages they
+// cover. The memory map routes writes to the pages holding such code through
+// its MEM_PAGE_HOOK, which bumps the page's version and makes those blocks
+// stale; writes to other pages don't look at the cache. ROM can't be written,
+// so blocks in ROM never go stale and never need checking; switching a bank of
+// it (mem_switch_bank) drops the blocks in the bank instead.
+
+typedef struct {
+    u8  opcode;
+    u16 operand; // lo | hi << 8, as many bytes as the instruction has
+} CachedInstruction;
+
+typedef struct {
+#define BLOCK_MAX_INSTRUCTIONS 16
+    memaddr           pc;  // first instruction
+    memaddr           end; // last byte of the last instruction
+    bool              valid;
+    bool              writable; // some of it is in writable memory
+    u32               versions[2]; // page versions of pc and end when decoded
+    u8                n_instructions;
+    CachedInstruction instructions[BLOCK_MAX_INSTRUCTIONS];
+
+    // owned by the JIT, reset whenever the block is decoded again
+    void *native; // compiled code, if any
+    u32   runs;   // times interpreted so far
+} CachedBlock;
+
+typedef struct BlockCache {
+#define BLOCK_CACHE_SIZE 4096 // direct mapped on the low bits of pc
+    MemoryMap  *memmap;
+    bool        code_pages[0x100];    // pages of writable memory holding cached code
+    u32         page_versions[0x100]; // bumped by writes to a code page
+    u64         hits;
+    u64         misses;
+    CachedBlock blocks[BLOCK_CACHE_SIZE];
+} BlockCache;
+
+// Also attaches the cache to m, so its writes can invalidate blocks.
+void block_cache_init(BlockCache *bc, MemoryMap *m);
+// Drops every block in writable memory, for memory changed behind the memory
+// map's back. Blocks in ROM stay, as it can't have been.
+void block_cache_flush(BlockCache *bc);
+// Drops the blocks with any of [lo, hi] in them, for a bank switched under
+// them. Costs a pass over the cache, however many there are.
+void block_cache_invalidate(BlockCache *bc, memaddr lo, memaddr hi);
+
+CachedBlock *block_cache_get(BlockCache *bc, memaddr pc);
+bool         block_cache_is_valid(BlockCache *bc, const CachedBlock *b);
+
+// Called by the memory map for writes to the pages in code_pages (and others,
+// which it ignores).
+void block_cache_write(BlockCache *bc, memaddr addr);
+
+#endif
@@ -1,7 +1,9 @@
 #ifndef CPU6502_H
 #define CPU6502_H
 
+#include "blockcache.h"
 #include "common.h"
+#include "cpuvariant.h"
 #include "memmap.h"
 
 #define setflag(p, f)   p |= f
@@ -25,11 +27,101 @@ typedef enum {
 
 typedef enum {
     PIN_READ = 0x1,
-    PIN_NMI  = 0x2,
+    PIN_NMI  = 0x2, // latched on the edge, until the NMI is taken
     PIN_IRQ  = 0x4,
+
+    CPU_IN_INTERRUPT = 0x8, // not a pin: BRK's sequence is running for an NMI/IRQ
 } CpuSinglePins;
 
+// Stages of the cycle engine, one per micro-op in cpu6502_stages.h. The stage
+// a CPU runs on its next clock is on_next_clock; CpuStage names it portably.
+// New stages go on the end, so the IDs in saved states keep their meaning.
+#define CPU_STAGES(s)         \
+    s(fetch_opcode)           \
+    s(fetch_opcode_add1)      \
+    s(fetch_lo)               \
+    s(fetch_hi)               \
+    s(index_zpg)              \
+    s(index_addr)             \
+    s(index_carry)            \
+    s(operand)                \
+    s(read_addr)              \
+    s(write_fetch)            \
+    s(rmw_read)               \
+    s(rmw_modify)             \
+    s(read_addr_ind)          \
+    s(read_addr_ind_fetch)    \
+    s(read_ind_read_addrhi)   \
+    s(read_ind_read_val)      \
+    s(rel_addr_inc)           \
+    s(page_boundary)          \
+    s(push)                   \
+    s(read_stack_inc_sp)      \
+    s(pop)                    \
+    s(write_brk_write_pclo)   \
+    s(write_brk_write_sr)     \
+    s(write_brk_read_pclo)    \
+    s(read_brk_read_pchi)     \
+    s(read_brk_fetch)         \
+    s(read_rti_read_pclo)     \
+    s(read_rti_read_pchi)     \
+    s(read_rti_fetch)         \
+    s(read_rts_read_pchi)     \
+    s(read_rts_inc_pc)        \
+    s(read_jsr_stack)         \
+    s(write_jsr_write_pclo)   \
+    s(write_jsr_read_pchi)    \
+    s(read_jsr_fetch)         \
+    s(index_ind)
+
+#define _cpu_stage_enum(name) CPU_STAGE_##name,
+typedef enum { CPU_STAGES(_cpu_stage_enum) CPU_STAGE_COUNT } CpuStage;
+#undef _cpu_stage_enum
+
+// Opcode histogram, compiled in with -DCPU_OPCODE_STATS (make nestest-stats).
+// Each engine folds an instruction in once it's done, at the boundary: how many
+// times every opcode ran, the cycles it took in total, and how many times it
+// paid a page-cross penalty (an indexed read or a taken branch crossing into
+// another page). The JIT runs everything through the interpreter to be
+// counted; lanes in lockstep aren't counted.
+#ifdef CPU_OPCODE_STATS
+typedef struct {
+    u64 count[0x100];
+    u64 cycles[0x100];
+    u64 page_crosses[0x100];
+    u64 interrupts; // NMI and IRQ sequences, which aren't counted as BRK
+    u64 interrupt_cycles;
+    u64 boundary_cyc; // cyc at the last instruction boundary
+} CpuOpcodeStats;
+#endif
+
+// Execution trace, recorded by every engine as each instruction starts into a
+// ring the caller provides: each record is the state it started from, as in
+// nestest.log. NMI and IRQ sequences aren't instructions and aren't recorded,
+// the handler's first instruction is. The JIT interprets while tracing, and
+// lanes aren't traced.
+typedef struct __attribute__((packed)) {
+    u64 cyc;
+    u16 pc;
+    u8  bytes[3]; // opcode and operand, 0 past the instruction's size
+    u8  x;        // x to sp as Cpu6502 has them, so they're copied in one go
+    u8  y;
+    u8  a;
+    u8  sp;
+    u8  p;
+} CpuTraceRecord;
+
 typedef struct {
+    CpuTraceRecord *records;
+    u32             mask; // capacity - 1
+    u64             n;    // recorded since cpu_trace_start; the last capacity of them are kept
+    // the memory block the last operand came from, most likely the next one's
+    // too. Its values are read through it every time, as switching a bank
+    // (mem_switch_bank) changes them.
+    const MemoryBlock *block;
+} CpuTrace;
+
+typedef struct Cpu6502 {
     u8  ir;  // Instruction Register
     u8  tcu; // Timing Control Unit
     u16 pc;  // Program Counter
@@ -37,7 +129,8 @@ typedef struct {
     u8  y;
     u8  a;  // Accumulator
     u8  sp; // Stack Pointer
-    u8  p;  // Status Flags
+    u8  p;  // Status Flags, but see nz: read with cpu_get_p, write with cpu_set_p
+    u16 nz; // last result, for lazy N and Z
     u8  pd; // Input Data Latch
 
     u64 cyc;
@@ -51,9 +144,125 @@ typedef struct {
     MemoryMap *memmap;
 
     void *(*on_next_clock)(void *);
+
+    struct GuestProfile *profile; // see guestprofile.h; NULL unless attached, cpu_resb detaches
+    CpuTrace            *trace;   // NULL unless tracing, cpu_resb stops it
+
+#ifdef CPU_OPCODE_STATS
+    CpuOpcodeStats opcode_stats; // since the last cpu_resb
+#endif
 } Cpu6502;
 
+// N and Z are evaluated lazily: instructions just store their result in nz and
+// the flags are worked out when p is observed. While NZ_LAZY is set, Z is set
+// if the low byte of nz is 0 and N if bit 7 or 15 is (BIT and PLP set N apart
+// from the result). Otherwise p holds N and Z itself.
+#define NZ_LAZY 0x100
+// p with N and Z worked out from nz, for where a call to cpu_get_p costs too
+// much
+#define cpu_p_of(p, nz)                                                      \
+    ((nz) & NZ_LAZY ? ((p) & ~(STAT_N_NEGATIVE | STAT_Z_ZERO))               \
+                          | ((nz) & 0x8080 ? STAT_N_NEGATIVE : 0)            \
+                          | ((nz) & 0x00FF ? 0 : STAT_Z_ZERO)                \
+                    : (p))
+// The status register with N and Z worked out.
+u8   cpu_get_p(Cpu6502 *c);
+void cpu_set_p(Cpu6502 *c, u8 p);
+
+// The stage on_next_clock points at, and back. CPU_STAGE_COUNT stands for no
+// stage, like on a CPU that was never reset.
+CpuStage    cpu_get_stage(Cpu6502 *c);
+void        cpu_set_stage(Cpu6502 *c, CpuStage stage);
+const char *cpu_stage_name(CpuStage stage);
+
+// Everything about the CPU but its memory map, mid-instruction included, as a
+// fixed-size blob. It holds no pointers and is the same on every host, so it
+// can be stored, compared with memcmp or handed to another process. Loading
+// keeps c->memmap and fails on a blob from another version.
+#define CPU_STATE_VERSION 1
+#define CPU_STATE_SIZE    32
+
+typedef struct {
+    u8 bytes[CPU_STATE_SIZE];
+} CpuState;
+
+void cpu_save_state(Cpu6502 *c, CpuState *state);
+bool cpu_load_state(Cpu6502 *c, const CpuState *state);
+
+// Interrupt inputs, polled at every instruction boundary (cpu_run_blocks and
+// cpu_run_jit only poll between blocks). NMI is edge triggered: cpu_nmi latches
+// it until it's taken. IRQ is level triggered and taken whenever it's held with
+// I clear, so the source has to release it. Either one runs BRK's 7 cycle
+// sequence instead of the next opcode, pushing pc and p with B clear, and
+// jumps through $FFFA (NMI) or $FFFE (IRQ). cpu_resb drops both.
+void cpu_nmi(Cpu6502 *c);
+void cpu_set_irq(Cpu6502 *c, bool asserted);
+
+// Cycle accurate: advances the CPU by a single clock.
 void cpu_pulse(Cpu6502 *c);
 void cpu_resb(Cpu6502 *c);
+// Cycle accurate, computed-goto build of the same engine: equivalent to calling
+// cpu_pulse `cycles` times but without an indirect call per clock.
+void cpu_run_threaded(Cpu6502 *c, u64 cycles);
+
+typedef enum {
+    CPU_STOP_CYCLES,   // ran all the cycles it was given
+    CPU_STOP_PC,       // reached the address
+    CPU_STOP_CALLBACK, // the callback asked to stop
+} CpuStopReason;
+
+// Called at instruction boundaries; returns true to stop. It may look at and
+// change the CPU's registers and memory but must not run it.
+typedef bool (*CpuStopCallback)(Cpu6502 *c, void *ctx);
+
+// Cycle accurate batch runs on the threaded engine, so the loop stays in the
+// core instead of calling cpu_pulse from outside. Stop conditions are checked
+// at every instruction boundary after the first cycle, leaving the CPU about to
+// fetch the opcode at pc; running out of cycles can stop it anywhere.
+CpuStopReason cpu_run_cycles(Cpu6502 *c, u64 n);
+CpuStopReason cpu_run_until_pc(Cpu6502 *c, memaddr addr, u64 max_cycles);
+CpuStopReason cpu_run_until(Cpu6502 *c, CpuStopCallback until, void *ctx, u64 max_cycles);
+
+// Records into t, whose ring of `capacity` records (a power of 2) is
+// `records`, from the next instruction c starts on; false if capacity isn't a
+// power of 2. Nothing is allocated, and a record is a handful of stores.
+bool cpu_trace_start(Cpu6502 *c, CpuTrace *t, CpuTraceRecord *records, u32 capacity);
+void cpu_trace_stop(Cpu6502 *c);
+// How many records t holds, and the i-th of them, oldest first.
+u64                   cpu_trace_count(CpuTrace *t);
+const CpuTraceRecord *cpu_trace_get(CpuTrace *t, u64 i);
+// Writes the records in nestest.log's layout, oldest first. Operands are shown
+// as in nestest.log but without the memory values it adds after them, and the
+// PPU column is worked out from the cycle count.
+void cpu_trace_dump(CpuTrace *t, FILE *f);
+// One line of the dump, without the newline.
+void cpu_trace_format(const CpuTraceRecord *r, char *line, size_t size);
+
+// Instruction level: executes a whole opcode per call and advances cyc by its
+// cycle count (page-cross and branch penalties included), without per-cycle
+// bus activity. Any instruction cpu_pulse is part way through is finished first.
+// Returns the number of cycles taken.
+u8  cpu_step(Cpu6502 *c);
+u64 cpu_run_instructions(Cpu6502 *c, u64 n);
+// Instruction level, same results as cpu_step but instructions come predecoded
+// from bc instead of being fetched through the memory map one by one. Runs
+// whole instructions until at least `cycles` have passed; returns cycles taken.
+u64 cpu_run_blocks(Cpu6502 *c, BlockCache *bc, u64 cycles);
+
+#ifdef CPU_OPCODE_STATS
+typedef struct {
+    u8  opcode;
+    u64 count;
+    u64 cycles;
+    u64 page_crosses;
+} CpuOpcodeStat;
+
+void cpu_opcode_stats_reset(Cpu6502 *c);
+// Fills `top` with up to n of the opcodes that ran, the most cycles first, and
+// returns how many it filled.
+int cpu_opcode_stats_top(Cpu6502 *c, CpuOpcodeStat *top, int n);
+// cpu_opcode_stats_top as a table, with each opcode's share of the cycles.
+void cpu_opcode_stats_print(Cpu6502 *c, FILE *f, int n);
+#endif
 
 #endif
\ No newline at end of file
@@ -0,0 +1,391 @@
+// Micro-op stages of the cycle engine.
+//
+// This file has no include guard on purpose: cpu6502.c includes it twice, once
+// with stage() expanding to the _cpu_* functions that cpu_pulse calls through
+// on_next_clock, and once inside cpu_run_threaded() where every stage becomes a
+// label dispatched by computed goto. Both cores therefore share this one copy.
+//
+//   stage(name)      defines the stage run on a clock
+//   next_stage(name) ends the cycle, name runs on the next clock
+//   same_stage()     ends the cycle, this stage runs again on the next clock
+//   run_stage(name)  continues straight into name within the same cycle
+//
+// A stage runs after the bus access of its clock: data_bus holds what was just
+// read and pd what was read on the clock before. Everything about the opcode
+// comes from decoded(c), which is fixed once fetch_opcode has latched ir.
+
+stage(fetch_opcode) {
+    if (_cpu_interrupt_pending(c)) {
+        // the opcode is dropped for BRK's sequence and pc stays where it is
+        c->ir = 0x00;
+        setflag(c->bit_fields, CPU_IN_INTERRUPT);
+        next_stage(fetch_lo);
+    }
+    if (c->trace) {
+        _cpu_trace_record(c, c->cyc - 1, c->pc, c->data_bus);
+    }
+    c->ir = c->data_bus;
+    c->addr_bus++;
+    next_stage(fetch_lo);
+}
+
+stage(fetch_opcode_add1) {
+    _cpu_end_instruction(c, c->pc + 1);
+    next_stage(fetch_opcode);
+}
+
+// Second clock of every instruction: the byte after the opcode has been read,
+// either the operand or a dummy read for single byte instructions.
+stage(fetch_lo) {
+    const DecodedInstruction *d = decoded(c);
+
+    switch (d->mode) {
+        case AM_imm:
+            _cpu_alu(c, d, c->data_bus);
+            _cpu_end_instruction(c, c->pc + 2);
+            next_stage(fetch_opcode);
+        case AM_A:
+            c->a = _cpu_modify(c, d->alu, c->a);
+            _cpu_end_instruction(c, c->pc + 1);
+            next_stage(fetch_opcode);
+        case AM_zpg:
+            c->addr_bus = c->data_bus;
+            run_stage(operand);
+        case AM_zpgX:
+        case AM_zpgY:
+        case AM_Xind:
+            c->addr_bus = c->data_bus; // dummy read before the index is added
+            next_stage(index_zpg);
+        case AM_indY:
+        case AM_zpgind:
+            c->addr_bus = c->data_bus;
+            next_stage(read_ind_read_addrhi);
+        case AM_abs:
+        case AM_absX:
+        case AM_absY:
+        case AM_ind:
+        case AM_absXind:
+            if (d->access == CLASS_JSR) {
+                c->jsr_juggle_addr_because_im_lazy = c->data_bus;
+                c->addr_bus                        = 0x0100 | c->sp;
+                next_stage(read_jsr_stack);
+            }
+            c->addr_bus++;
+            next_stage(fetch_hi);
+        case AM_rel:
+            if (((cpu_get_p(c) & d->flag) != 0) == (d->alu == ALU_BRANCH_SET)) {
+                c->addr_bus = c->pc + 2; // dummy read of the next opcode
+                next_stage(rel_addr_inc);
+            }
+            _cpu_end_instruction(c, c->pc + 2);
+            next_stage(fetch_opcode);
+        case AM_impl:
+            break;
+    }
+
+    switch (d->access) {
+        case CLASS_BRK:
+            c->addr_bus = 0x0100 | c->sp;
+            c->data_bus = _cpu_brk_return(c) >> 8;
+            unsetflag(c->bit_fields, PIN_READ);
+            next_stage(write_brk_write_pclo);
+        case CLASS_PUSH:
+            c->addr_bus = 0x0100 | c->sp;
+            c->data_bus = d->reg == REG_P ? cpu_get_p(c) | STAT_B_BREAK | STAT___IGNORE : *_cpu_reg(c, d->reg);
+            unsetflag(c->bit_fields, PIN_READ);
+            next_stage(push);
+        case CLASS_PULL:
+        case CLASS_RTS:
+        case CLASS_RTI:
+            c->addr_bus = 0x0100 | c->sp; // dummy read
+            next_stage(read_stack_inc_sp);
+        default:
+            _cpu_implied(c, d);
+            _cpu_end_instruction(c, c->pc + 1);
+            next_stage(fetch_opcode);
+    }
+}
+
+stage(fetch_hi) {
+    const DecodedInstruction *d = decoded(c);
+    c->addr_bus                 = (c->data_bus << 8) | c->pd;
+
+    switch (d->mode) {
+        case AM_absX:
+        case AM_absY:
+            run_stage(index_addr);
+        case AM_ind:
+        case AM_absXind:
+#if CPU_VARIANT == CPU_VARIANT_65C02
+            next_stage(index_ind);
+#else
+            next_stage(read_addr_ind);
+#endif
+        default:
+            break;
+    }
+
+    if (d->access == CLASS_JMP) {
+        _cpu_end_instruction(c, c->addr_bus);
+        next_stage(fetch_opcode);
+    }
+    run_stage(operand);
+}
+
+// zpg,X zpg,Y and (zpg,X): the unindexed address has been read, add the index
+// without leaving the zero page.
+stage(index_zpg) {
+    const DecodedInstruction *d = decoded(c);
+    c->addr_bus                 = (c->addr_bus + *_cpu_reg(c, d->index)) & 0x00FF;
+
+    if (d->mode == AM_Xind) {
+        next_stage(read_ind_read_addrhi);
+    }
+    run_stage(operand);
+}
+
+// abs,X abs,Y and (zpg),Y with the base address on the bus: the index is added
+// to the low byte first, so the access lands in the base page and costs an
+// extra clock to fix up when that's the wrong page. Stores and read-modify-
+// writes always take the extra clock.
+stage(index_addr) {
+    const DecodedInstruction *d = decoded(c);
+    memaddr                   ea = c->addr_bus + *_cpu_reg(c, d->index);
+    c->addr_bus                  = (c->addr_bus & 0xFF00) | (ea & 0x00FF);
+
+    if (c->addr_bus != ea || d->access != CLASS_READ) {
+        next_stage(index_carry);
+    }
+    run_stage(operand);
+}
+
+stage(index_carry) {
+    // the low byte wrapped while adding the index: carry into the high byte
+    if ((c->addr_bus & 0x00FF) < *_cpu_reg(c, decoded(c)->index)) {
+        c->addr_bus += 0x0100;
+    }
+    run_stage(operand);
+}
+
+// The effective address is on the bus: start the access.
+stage(operand) {
+    const DecodedInstruction *d = decoded(c);
+
+    switch (d->access) {
+        case CLASS_WRITE:
+            c->data_bus = *_cpu_reg(c, d->reg);
+            unsetflag(c->bit_fields, PIN_READ);
+            next_stage(write_fetch);
+        case CLASS_RMW:
+            next_stage(rmw_read);
+        default:
+            next_stage(read_addr);
+    }
+}
+
+stage(read_addr) {
+    const DecodedInstruction *d = decoded(c);
+    _cpu_alu(c, d, c->data_bus);
+    _cpu_end_instruction(c, c->pc + d->size);
+    next_stage(fetch_opcode);
+}
+
+stage(write_fetch) {
+    _cpu_end_instruction(c, c->pc + decoded(c)->size);
+    next_stage(fetch_opcode);
+}
+
+stage(rmw_read) {
+    unsetflag(c->bit_fields, PIN_READ); // writes the unmodified value back first
+    next_stage(rmw_modify);
+}
+
+stage(rmw_modify) {
+    c->data_bus = _cpu_modify(c, decoded(c)->alu, c->data_bus);
+    next_stage(write_fetch);
+}
+
+// JMP ind: the pointer is on the bus. The NMOS parts read its high byte
+// without carrying into the pointer's page.
+stage(read_addr_ind) {
+#if CPU_VARIANT == CPU_VARIANT_65C02
+    c->addr_bus++;
+#else
+    c->addr_bus = (c->addr_bus & 0xFF00) | ((c->addr_bus + 1) & 0x00FF);
+#endif
+    next_stage(read_addr_ind_fetch);
+}
+
+stage(read_addr_ind_fetch) {
+    _cpu_end_instruction(c, (c->data_bus << 8) | c->pd);
+    next_stage(fetch_opcode);
+}
+
+// 65C02 JMP (abs) and JMP (abs,X) spend a clock on the pointer, adding X.
+stage(index_ind) {
+    const DecodedInstruction *d = decoded(c);
+    if (d->mode == AM_absXind) {
+        c->addr_bus += *_cpu_reg(c, d->index);
+    }
+    next_stage(read_addr_ind);
+}
+
+stage(read_ind_read_addrhi) {
+    c->addr_bus = (c->addr_bus + 1) & 0x00FF; // without carry
+    next_stage(read_ind_read_val);
+}
+
+stage(read_ind_read_val) {
+    c->addr_bus = (c->data_bus << 8) | c->pd;
+
+    if (decoded(c)->mode == AM_indY) {
+        run_stage(index_addr);
+    }
+    run_stage(operand);
+}
+
+stage(rel_addr_inc) {
+    memaddr next = c->pc + 2;
+    c->pc        = next + (int8_t)c->pd;
+
+    if ((next & 0xFF00) != (c->pc & 0xFF00)) {
+        c->addr_bus = (next & 0xFF00) | (c->pc & 0x00FF); // read before the page is fixed
+        next_stage(page_boundary);
+    }
+    run_stage(page_boundary);
+}
+
+stage(page_boundary) {
+    _cpu_end_instruction(c, c->pc);
+    next_stage(fetch_opcode);
+}
+
+stage(push) {
+    c->sp--;
+    _cpu_end_instruction(c, c->pc + 1);
+    next_stage(fetch_opcode);
+}
+
+// PLA, PLP, RTS and RTI: the dummy read of the stack is done.
+stage(read_stack_inc_sp) {
+    c->sp++;
+    c->addr_bus = 0x0100 | c->sp;
+
+    switch (decoded(c)->access) {
+        case CLASS_RTS:
+            next_stage(read_rts_read_pchi);
+        case CLASS_RTI:
+            next_stage(read_rti_read_pclo);
+        default:
+            next_stage(pop);
+    }
+}
+
+stage(pop) {
+    const DecodedInstruction *d = decoded(c);
+    if (d->reg == REG_P) {
+        _cpu_pull_p(c, c->data_bus);
+    }
+    else {
+        *_cpu_reg(c, d->reg) = c->data_bus;
+        _cpu_update_NZ_flags(c, c->data_bus);
+    }
+    _cpu_end_instruction(c, c->pc + 1);
+    next_stage(fetch_opcode);
+}
+
+stage(write_brk_write_pclo) {
+    c->sp--;
+    c->addr_bus = 0x0100 | c->sp;
+    c->data_bus = 0xFF & _cpu_brk_return(c);
+    next_stage(write_brk_write_sr);
+}
+
+stage(write_brk_write_sr) {
+    c->sp--;
+    c->addr_bus = 0x0100 | c->sp;
+    c->data_bus = cpu_get_p(c) | STAT___IGNORE;
+    if ((c->bit_fields & CPU_IN_INTERRUPT) == 0) {
+        setflag(c->data_bus, STAT_B_BREAK);
+    }
+    next_stage(write_brk_read_pclo);
+}
+
+stage(write_brk_read_pclo) {
+    c->sp--;
+    setflag(c->p, STAT_I_INTERRUPT);
+#if CPU_VARIANT == CPU_VARIANT_65C02
+    unsetflag(c->p, STAT_D_DECIMAL);
+#endif
+    c->addr_bus = _cpu_brk_vector(c);
+    setflag(c->bit_fields, PIN_READ);
+    next_stage(read_brk_read_pchi);
+}
+
+stage(read_brk_read_pchi) {
+    c->addr_bus++;
+    next_stage(read_brk_fetch);
+}
+
+stage(read_brk_fetch) {
+    _cpu_end_instruction(c, (c->data_bus << 8) | c->pd);
+    unsetflag(c->bit_fields, CPU_IN_INTERRUPT);
+    next_stage(fetch_opcode);
+}
+
+stage(read_rti_read_pclo) {
+    _cpu_pull_p(c, c->data_bus);
+    c->sp++;
+    c->addr_bus = 0x0100 | c->sp;
+    next_stage(read_rti_read_pchi);
+}
+
+stage(read_rti_read_pchi) {
+    c->sp++;
+    c->addr_bus = 0x0100 | c->sp;
+    next_stage(read_rti_fetch);
+}
+
+stage(read_rti_fetch) {
+    _cpu_end_instruction(c, (c->data_bus << 8) | c->pd);
+    next_stage(fetch_opcode);
+}
+
+stage(read_rts_read_pchi) {
+    c->sp++;
+    c->addr_bus = 0x0100 | c->sp;
+    next_stage(read_rts_inc_pc);
+}
+
+stage(read_rts_inc_pc) {
+    c->pc       = (c->data_bus << 8) | c->pd;
+    c->addr_bus = c->pc; // dummy read, RTS adds 1 to the pushed pc
+    next_stage(fetch_opcode_add1);
+}
+
+// JSR reads its low byte, juggles it while pushing the return address, then
+// reads the high byte last.
+stage(read_jsr_stack) {
+    c->data_bus = (c->pc + 2) >> 8;
+    unsetflag(c->bit_fields, PIN_READ);
+    next_stage(write_jsr_write_pclo);
+}
+
+stage(write_jsr_write_pclo) {
+    c->sp--;
+    c->addr_bus = 0x0100 | c->sp;
+    c->data_bus = (c->pc + 2) & 0xFF;
+    next_stage(write_jsr_read_pchi);
+}
+
+stage(write_jsr_read_pchi) {
+    c->sp--;
+    c->addr_bus = c->pc + 2;
+    setflag(c->bit_fields, PIN_READ);
+    next_stage(read_jsr_fetch);
+}
+
+stage(read_jsr_fetch) {
+    _cpu_end_instruction(c, (c->data_bus << 8) | c->jsr_juggle_addr_because_im_lazy);
+    next_stage(fetch_opcode);
+}
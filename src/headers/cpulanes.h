@@ -0,0 +1,52 @@
+#ifndef CPULANES_H
+#define CPULANES_H
+
+#include "common.h"
+#include "cpu6502.h"
+
+// CPU_LANES independent 6502s run in lockstep. Registers are kept as a
+// structure of arrays, one vector per register, so an instruction runs on every
+// lane at once (GCC vector extensions: SSE2 by default, AVX2 with -mavx2).
+//
+// An instruction runs in lockstep when every lane is at the same pc with the
+// same opcode. Memory operands must also be at the same address, and branches
+// must go the same way, and no lane may have an interrupt to take. Otherwise
+// each lane runs that instruction on its own through cpu_step, and keeps doing
+// so until the pcs meet again. Results match
+// cpu_step either way. Each lane has its own memory map.
+//
+// The vectors want CPU_LANES-byte alignment: make CpuLanes static, or allocate
+// it with aligned_alloc.
+
+#define CPU_LANES 32
+
+typedef u8 LaneVec __attribute__((vector_size(CPU_LANES)));
+
+typedef struct {
+    LaneVec    a;
+    LaneVec    x;
+    LaneVec    y;
+    LaneVec    sp;
+    LaneVec    p; // always materialised, no lazy N and Z
+    u16        pc[CPU_LANES];
+    u8         ir[CPU_LANES];
+    u8         pins[CPU_LANES]; // PIN_NMI and PIN_IRQ
+    u64        cyc[CPU_LANES];
+    MemoryMap *memmap[CPU_LANES];
+    int        n_lanes; // lanes 0 to n_lanes - 1 are run
+
+    u64 lockstep; // instructions run on all lanes at once
+    u64 diverged; // instructions run lane by lane
+} CpuLanes;
+
+void cpu_lanes_init(CpuLanes *l, int n_lanes);
+
+// Copy a CPU into a lane and back. c must be at an instruction boundary; a
+// stored CPU is left at one, ready for cpu_pulse or cpu_step.
+void cpu_lanes_load(CpuLanes *l, int lane, Cpu6502 *c);
+void cpu_lanes_store(CpuLanes *l, int lane, Cpu6502 *c);
+
+// Runs one instruction on every lane; true if it was run in lockstep.
+bool cpu_lanes_step(CpuLanes *l);
+
+#endif
@@ -0,0 +1,43 @@
+#ifndef CPUVARIANT_H
+#define CPUVARIANT_H
+
+// Which 6502 the core is built as, picked at compile time with
+// -DCPU_VARIANT=CPU_VARIANT_NMOS (see the Makefile's *-nmos and *-65c02
+// targets). Everything that differs between them is selected with #if, so each
+// build gets its own instruction tables and none of the engines test the
+// variant at runtime.
+//
+//   2A03   the NES's CPU, and the default: an NMOS 6502 with decimal mode
+//          taken out, so D is a flag like any other and ADC/SBC are binary
+//   NMOS   the original 6502: BCD ADC/SBC with the NMOS flag quirks, and D is
+//          left alone by reset
+//   65C02  the CMOS 6502: the NMOS core plus its new opcodes and addressing
+//          modes, valid N and Z in decimal mode, JMP ($xxFF) fixed, D cleared
+//          by reset and interrupts, and undefined opcodes as NOPs
+//
+// Of the 65C02 the engines model the instruction set and cycle counts of the
+// original CMOS part, not Rockwell's and WDC's bit instructions, nor its bus
+// differences (reads instead of the NMOS dummy writes), the extra clock of
+// decimal ADC/SBC, the shorter abs,X shifts or its 1-clock NOPs.
+
+#define CPU_VARIANT_2A03  1
+#define CPU_VARIANT_NMOS  2
+#define CPU_VARIANT_65C02 3
+
+#ifndef CPU_VARIANT
+#define CPU_VARIANT CPU_VARIANT_2A03
+#endif
+
+#if CPU_VARIANT == CPU_VARIANT_2A03
+#define CPU_VARIANT_NAME "2A03"
+#elif CPU_VARIANT == CPU_VARIANT_NMOS
+#define CPU_VARIANT_NAME "NMOS 6502"
+#elif CPU_VARIANT == CPU_VARIANT_65C02
+#define CPU_VARIANT_NAME "65C02"
+#else
+#error "CPU_VARIANT must be CPU_VARIANT_2A03, CPU_VARIANT_NMOS or CPU_VARIANT_65C02"
+#endif
+
+#define CPU_HAS_DECIMAL (CPU_VARIANT != CPU_VARIANT_2A03)
+
+#endif
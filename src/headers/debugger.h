@@ -0,0 +1,105 @@
+#ifndef DEBUGGER_H
+#define DEBUGGER_H
+
+#include "common.h"
+#include "cpu6502.h"
+#include "memmap.h"
+
+// Breakpoints and watchpoints for the monitors. Each kind is a bit per
+// address, so checking one is a shift and a mask however many are set.
+//
+// Exec breakpoints are checked at instruction boundaries, by passing
+// debugger_check to cpu_run_until (or running through debugger_run): the CPU
+// stops about to fetch the opcode at the breakpoint. Read and write
+// watchpoints are checked by the memory map, whose page table sends the pages
+// with some to MEM_PAGE_HOOK (mem_hook_pages), so accesses anywhere else don't
+// look at the debugger at all; a hit stops the CPU at the end of the
+// instruction that made the access. Reads include opcode and operand fetches,
+// but not under cpu_run_blocks, as the block cache decodes code without going
+// through the memory map's hooks. The JIT interprets while watchpoints are
+// set, as its code goes around the memory map.
+//
+// A breakpoint can have a condition on a register or on the byte involved: the
+// opcode for exec, the value read or written for watchpoints.
+
+typedef enum {
+    BREAK_EXEC,
+    BREAK_READ,
+    BREAK_WRITE,
+    BREAK_KINDS,
+} BreakKind;
+
+typedef enum {
+    BREAK_ON_VALUE, // opcode, or the byte read or written
+    BREAK_ON_A,
+    BREAK_ON_X,
+    BREAK_ON_Y,
+    BREAK_ON_SP,
+    BREAK_ON_P,
+} BreakOperand;
+
+typedef enum {
+    BREAK_EQ,
+    BREAK_NE,
+    BREAK_LT,
+    BREAK_GE,
+    BREAK_ANY, // operand & value != 0
+} BreakCompare;
+
+typedef struct {
+    BreakOperand operand;
+    BreakCompare compare;
+    u8           value;
+} BreakCondition;
+
+typedef struct {
+    BreakKind      kind;
+    memaddr        addr;
+    BreakCondition condition;
+} ConditionalBreak;
+
+typedef struct {
+    bool      pending; // stops the CPU at the next boundary
+    BreakKind kind;
+    memaddr   addr;
+    u8        value;
+    memaddr   pc;  // pc when it hit: past the opcode for watchpoints
+    u64       cyc; // when it hit
+} BreakHit;
+
+typedef struct Debugger {
+#define DEBUGGER_MAX_CONDITIONS 32
+    Cpu6502 *cpu;
+    u64      bits[BREAK_KINDS][0x10000 / 64];
+    uint     n_set[BREAK_KINDS];
+
+    uint             n_conditions;
+    ConditionalBreak conditions[DEBUGGER_MAX_CONDITIONS];
+
+    BreakHit hit; // the last one
+} Debugger;
+
+void debugger_init(Debugger *d, Cpu6502 *c);
+
+// Sets a breakpoint, replacing any there already; condition NULL makes it
+// unconditional. False if it needs a condition and they're all in use.
+bool debugger_set(Debugger *d, BreakKind kind, memaddr addr, const BreakCondition *condition);
+void debugger_clear(Debugger *d, BreakKind kind, memaddr addr);
+void debugger_clear_all(Debugger *d);
+bool debugger_is_set(Debugger *d, BreakKind kind, memaddr addr);
+// Whether any address in page has one of kind, for the memory map.
+bool debugger_watches_page(Debugger *d, BreakKind kind, uint page);
+
+// CpuStopCallback, with the Debugger as ctx.
+bool debugger_check(Cpu6502 *c, void *ctx);
+// cpu_run_until with debugger_check. A hit from an instruction that finished
+// before the run (stepping with cpu_pulse, say) is forgotten; batches may end
+// mid-instruction, and a hit in the part already run stops the next batch at
+// the end of it.
+CpuStopReason debugger_run(Debugger *d, u64 max_cycles);
+
+// Called by the memory map for every access to a watched page.
+void debugger_on_read(Debugger *d, memaddr addr, u8 value);
+void debugger_on_write(Debugger *d, memaddr addr, u8 value);
+
+#endif
@@ -8,7 +8,7 @@
 
 typedef struct {
 #define N_MAX_DISASM    64
-#define N_MAX_TEXT_SIZE 20 // "OPC $LLHH,X (65535)" = 19 + \0
+#define N_MAX_TEXT_SIZE 22 // "OPC ($LLHH,X) (65535)" = 21 + \0
 #define N_MAX_BYTE_SIZE 10 // "00 00 00 "     = 9 + \0
     char _disasm_text[N_MAX_DISASM][N_MAX_TEXT_SIZE];
     u8   _disasm_offsets[N_MAX_DISASM]; // N_MAX_DISASM <= 85
@@ -0,0 +1,85 @@
+#ifndef GUESTPROFILE_H
+#define GUESTPROFILE_H
+
+#include "common.h"
+#include "cpu6502.h"
+#include "memmap.h"
+#include "stdio.h"
+
+// Profiler for the 6502 program, as opposed to profile.c's for the emulator.
+// Every emulated cycle is charged to the pc of the instruction it was spent
+// in, at instruction boundaries, by every engine: an NMI or IRQ sequence is
+// charged to the instruction it took the place of. The JIT interprets while a
+// profile is attached, and lanes aren't profiled.
+//
+// Attaching costs a test per instruction while detached and an add while
+// attached. cpu_resb detaches, so attach after resetting.
+
+// Call graph of the 6502 program, as an evented speedscope profile whose
+// frames are subroutines and interrupt handlers and whose time is cycles. JSR
+// and BRK, NMI and IRQ open a frame once they've run, RTS and RTI close it.
+//
+// Frames are matched up through the stack pointer rather than by counting, so
+// stack tricks don't throw it off: a frame is over once sp has gone back above
+// where it was after the call. RTS used as a jump (return address pushed by
+// hand) closes nothing, and a frame whose return address was pulled and thrown
+// away is closed by whichever return or call lands past it.
+typedef struct {
+    memaddr addr;
+    u8      sp; // just after the call
+} GuestCall;
+
+typedef struct {
+#define GUEST_CALL_MAX_DEPTH 256 // every open frame has its own sp
+    GuestCall stack[GUEST_CALL_MAX_DEPTH];
+    int       depth;
+    u32       frames[0x10000]; // speedscope frame + 1 by address, 0 if it has none yet
+    u32       n_frames;
+    u64       start; // cyc when tracing began
+
+    FILE  *frames_json; // memstreams, as in profile.c
+    char  *frames_buf;
+    size_t frames_size;
+    FILE  *events_json;
+    char  *events_buf;
+    size_t events_size;
+} GuestCallGraph;
+
+typedef struct GuestProfile {
+    u64     cycles[0x10000]; // by pc
+    memaddr pc;              // the instruction running since the last boundary
+    u64     cyc;             // cyc at the last boundary
+
+    GuestCallGraph *calls; // NULL unless the call graph is traced too
+} GuestProfile;
+
+typedef struct {
+    memaddr pc;
+    u64     cycles;
+} GuestProfileEntry;
+
+// Charges c's cycles to p from now on, on top of what it holds; p NULL
+// detaches.
+void guest_profile_attach(Cpu6502 *c, GuestProfile *p);
+void guest_profile_clear(GuestProfile *p);
+u64  guest_profile_total(GuestProfile *p);
+
+// The n pcs with the most cycles, most first; returns how many there are.
+int guest_profile_top(GuestProfile *p, GuestProfileEntry *top, int n);
+
+// Starts tracing calls into g from c's next boundary on; c must have p
+// attached. False if the buffers can't be set up.
+bool guest_calls_start(GuestProfile *p, GuestCallGraph *g, Cpu6502 *c);
+// Closes the frames still open as of c->cyc and writes the speedscope file.
+// Tracing stops and g's buffers are freed either way.
+bool guest_calls_write(GuestProfile *p, Cpu6502 *c, const char *name, const char *file_name);
+
+// Flat profile: the top n instructions with their share of the cycles,
+// disassembled from m.
+void guest_profile_print_flat(GuestProfile *p, MemoryMap *m, FILE *f, int n);
+// Annotated disassembly of the code that ran between from and to: every
+// instruction that was charged cycles, in address order, with its cycles and
+// share. Code that never ran is left out, with a blank line for each gap.
+void guest_profile_print_annotated(GuestProfile *p, MemoryMap *m, FILE *f, memaddr from, memaddr to);
+
+#endif
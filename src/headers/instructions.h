@@ -0,0 +1,209 @@
+#ifndef INSTRUCTIONS_H
+#define INSTRUCTIONS_H
+
+#include "common.h"
+#include "cpuvariant.h"
+
+typedef enum {
+    AM_A,    // Accumulator
+    AM_abs,  // absolute
+    AM_absX, // absolute, X-indexed
+    AM_absY, // absolute, Y-indexed
+    AM_imm,  // immediate
+    AM_impl, // implied
+    AM_ind,  // indirect
+    AM_Xind, // X-indexed, indirect
+    AM_indY, // indirect, Y-indexed
+    AM_rel,  // relative
+    AM_zpg,  // zeropage
+    AM_zpgX, // zeropage, X-indexed
+    AM_zpgY, // zeropage, Y-indexed
+
+    AM_zpgind,  // zeropage, indirect (65C02)
+    AM_absXind, // absolute, X-indexed, indirect (65C02 JMP)
+} AddressingMode;
+
+// What the cycle engine does with an opcode once its operand address is known.
+typedef enum {
+    CLASS_IMPLIED, // executes on the dummy operand read: transfers, flags, register inc/dec
+    CLASS_READ,    // reads the operand, then runs the ALU op
+    CLASS_WRITE,   // writes a register to the operand address
+    CLASS_RMW,     // read, dummy write of the old value, write of the new value
+    CLASS_BRANCH,
+    CLASS_JMP,
+    CLASS_JSR,
+    CLASS_RTS,
+    CLASS_RTI,
+    CLASS_BRK,
+    CLASS_PUSH,
+    CLASS_PULL,
+} AccessClass;
+
+typedef enum {
+    ALU_NONE,
+    ALU_ORA,
+    ALU_AND,
+    ALU_EOR,
+    ALU_ADC,
+    ALU_SBC,
+    ALU_CMP,
+    ALU_BIT,
+    ALU_BIT_IMM,      // BIT #: only Z
+    ALU_LD,           // load (or transfer from src), sets N and Z
+    ALU_ST,
+    ALU_ASL,
+    ALU_LSR,
+    ALU_ROL,
+    ALU_ROR,
+    ALU_INC,
+    ALU_DEC,
+    ALU_TSB,          // set the bits of A in the operand, Z from operand & A
+    ALU_TRB,          // clear them
+    ALU_MOV,          // transfer from src without touching flags (TXS)
+    ALU_CLEAR,        // clear flag
+    ALU_SET,          // set flag
+    ALU_BRANCH_CLEAR, // branch if flag is clear
+    ALU_BRANCH_SET,   // branch if flag is set
+} AluOp;
+
+typedef enum {
+    REG_NONE,
+    REG_A,
+    REG_X,
+    REG_Y,
+    REG_SP,
+    REG_P,
+    REG_ZERO, // reads as 0, for STZ
+} CpuRegister;
+
+typedef struct {
+    AddressingMode mode;
+    AccessClass    access;
+    AluOp          alu;
+    CpuRegister    reg;   // register loaded, stored, compared, modified, pushed or pulled
+    CpuRegister    src;   // source register of a transfer
+    CpuRegister    index; // X or Y for indexed modes
+    u8             flag;  // status flag tested by a branch or set/cleared by a flag op
+    u8             size;  // instruction length in bytes
+    u8             cycles;
+} DecodedInstruction;
+
+// Defined in cpu6502.c, indexed by opcode
+extern const DecodedInstruction DECODED_INSTRUCTIONS[0x100];
+extern const char *const        CPU_MNEMONICS[0x100];
+
+// m(mnemonic, addressing mode, operation, base cycles)
+// Base cycles exclude page-cross and branch-taken penalties.
+#if CPU_VARIANT == CPU_VARIANT_65C02
+// Opcodes the 65C02 leaves undefined are NOPs, treated as taking the size and
+// clocks of their addressing mode.
+#define INSTRUCTION_TABLE(m) \
+    m("BRK", AM_impl, op_brk, 7), m("ORA", AM_Xind, op_ora, 6), m("NOP", AM_imm, op_nop, 2),    m("NOP", AM_impl, op_nop, 2), m("TSB", AM_zpg, op_tsb, 5),  m("ORA", AM_zpg, op_ora, 3),  m("ASL", AM_zpg, op_asl, 5),  m("NOP", AM_impl, op_nop, 2), m("PHP", AM_impl, op_php, 3), m("ORA", AM_imm, op_ora, 2),  m("ASL", AM_A, op_asl, 2),    m("NOP", AM_impl, op_nop, 2), m("TSB", AM_abs, op_tsb, 6),     m("ORA", AM_abs, op_ora, 4),  m("ASL", AM_abs, op_asl, 6),  m("NOP", AM_impl, op_nop, 2), \
+    m("BPL", AM_rel, op_bpl, 2),  m("ORA", AM_indY, op_ora, 5), m("ORA", AM_zpgind, op_ora, 5), m("NOP", AM_impl, op_nop, 2), m("TRB", AM_zpg, op_trb, 5),  m("ORA", AM_zpgX, op_ora, 4), m("ASL", AM_zpgX, op_asl, 6), m("NOP", AM_impl, op_nop, 2), m("CLC", AM_impl, op_clc, 2), m("ORA", AM_absY, op_ora, 4), m("INC", AM_A, op_ina, 2),    m("NOP", AM_impl, op_nop, 2), m("TRB", AM_abs, op_trb, 6),     m("ORA", AM_absX, op_ora, 4), m("ASL", AM_absX, op_asl, 7), m("NOP", AM_impl, op_nop, 2), \
+    m("JSR", AM_abs, op_jsr, 6),  m("AND", AM_Xind, op_and, 6), m("NOP", AM_imm, op_nop, 2),    m("NOP", AM_impl, op_nop, 2), m("BIT", AM_zpg, op_bit, 3),  m("AND", AM_zpg, op_and, 3),  m("ROL", AM_zpg, op_rol, 5),  m("NOP", AM_impl, op_nop, 2), m("PLP", AM_impl, op_plp, 4), m("AND", AM_imm, op_and, 2),  m("ROL", AM_A, op_rol, 2),    m("NOP", AM_impl, op_nop, 2), m("BIT", AM_abs, op_bit, 4),     m("AND", AM_abs, op_and, 4),  m("ROL", AM_abs, op_rol, 6),  m("NOP", AM_impl, op_nop, 2), \
+    m("BMI", AM_rel, op_bmi, 2),  m("AND", AM_indY, op_and, 5), m("AND", AM_zpgind, op_and, 5), m("NOP", AM_impl, op_nop, 2), m("BIT", AM_zpgX, op_bit, 4), m("AND", AM_zpgX, op_and, 4), m("ROL", AM_zpgX, op_rol, 6), m("NOP", AM_impl, op_nop, 2), m("SEC", AM_impl, op_sec, 2), m("AND", AM_absY, op_and, 4), m("DEC", AM_A, op_dea, 2),    m("NOP", AM_impl, op_nop, 2), m("BIT", AM_absX, op_bit, 4),    m("AND", AM_absX, op_and, 4), m("ROL", AM_absX, op_rol, 7), m("NOP", AM_impl, op_nop, 2), \
+    m("RTI", AM_impl, op_rti, 6), m("EOR", AM_Xind, op_eor, 6), m("NOP", AM_imm, op_nop, 2),    m("NOP", AM_impl, op_nop, 2), m("NOP", AM_zpg, op_nop, 3),  m("EOR", AM_zpg, op_eor, 3),  m("LSR", AM_zpg, op_lsr, 5),  m("NOP", AM_impl, op_nop, 2), m("PHA", AM_impl, op_pha, 3), m("EOR", AM_imm, op_eor, 2),  m("LSR", AM_A, op_lsr, 2),    m("NOP", AM_impl, op_nop, 2), m("JMP", AM_abs, op_jmp, 3),     m("EOR", AM_abs, op_eor, 4),  m("LSR", AM_abs, op_lsr, 6),  m("NOP", AM_impl, op_nop, 2), \
+    m("BVC", AM_rel, op_bvc, 2),  m("EOR", AM_indY, op_eor, 5), m("EOR", AM_zpgind, op_eor, 5), m("NOP", AM_impl, op_nop, 2), m("NOP", AM_zpgX, op_nop, 4), m("EOR", AM_zpgX, op_eor, 4), m("LSR", AM_zpgX, op_lsr, 6), m("NOP", AM_impl, op_nop, 2), m("CLI", AM_impl, op_cli, 2), m("EOR", AM_absY, op_eor, 4), m("PHY", AM_impl, op_phy, 3), m("NOP", AM_impl, op_nop, 2), m("NOP", AM_abs, op_nop, 4),     m("EOR", AM_absX, op_eor, 4), m("LSR", AM_absX, op_lsr, 7), m("NOP", AM_impl, op_nop, 2), \
+    m("RTS", AM_impl, op_rts, 6), m("ADC", AM_Xind, op_adc, 6), m("NOP", AM_imm, op_nop, 2),    m("NOP", AM_impl, op_nop, 2), m("STZ", AM_zpg, op_stz, 3),  m("ADC", AM_zpg, op_adc, 3),  m("ROR", AM_zpg, op_ror, 5),  m("NOP", AM_impl, op_nop, 2), m("PLA", AM_impl, op_pla, 4), m("ADC", AM_imm, op_adc, 2),  m("ROR", AM_A, op_ror, 2),    m("NOP", AM_impl, op_nop, 2), m("JMP", AM_ind, op_jmp, 6),     m("ADC", AM_abs, op_adc, 4),  m("ROR", AM_abs, op_ror, 6),  m("NOP", AM_impl, op_nop, 2), \
+    m("BVS", AM_rel, op_bvs, 2),  m("ADC", AM_indY, op_adc, 5), m("ADC", AM_zpgind, op_adc, 5), m("NOP", AM_impl, op_nop, 2), m("STZ", AM_zpgX, op_stz, 4), m("ADC", AM_zpgX, op_adc, 4), m("ROR", AM_zpgX, op_ror, 6), m("NOP", AM_impl, op_nop, 2), m("SEI", AM_impl, op_sei, 2), m("ADC", AM_absY, op_adc, 4), m("PLY", AM_impl, op_ply, 4), m("NOP", AM_impl, op_nop, 2), m("JMP", AM_absXind, op_jmp, 6), m("ADC", AM_absX, op_adc, 4), m("ROR", AM_absX, op_ror, 7), m("NOP", AM_impl, op_nop, 2), \
+    m("BRA", AM_rel, op_bra, 2),  m("STA", AM_Xind, op_sta, 6), m("NOP", AM_imm, op_nop, 2),    m("NOP", AM_impl, op_nop, 2), m("STY", AM_zpg, op_sty, 3),  m("STA", AM_zpg, op_sta, 3),  m("STX", AM_zpg, op_stx, 3),  m("NOP", AM_impl, op_nop, 2), m("DEY", AM_impl, op_dey, 2), m("BIT", AM_imm, op_bim, 2),  m("TXA", AM_impl, op_txa, 2), m("NOP", AM_impl, op_nop, 2), m("STY", AM_abs, op_sty, 4),     m("STA", AM_abs, op_sta, 4),  m("STX", AM_abs, op_stx, 4),  m("NOP", AM_impl, op_nop, 2), \
+    m("BCC", AM_rel, op_bcc, 2),  m("STA", AM_indY, op_sta, 6), m("STA", AM_zpgind, op_sta, 5), m("NOP", AM_impl, op_nop, 2), m("STY", AM_zpgX, op_sty, 4), m("STA", AM_zpgX, op_sta, 4), m("STX", AM_zpgY, op_stx, 4), m("NOP", AM_impl, op_nop, 2), m("TYA", AM_impl, op_tya, 2), m("STA", AM_absY, op_sta, 5), m("TXS", AM_impl, op_txs, 2), m("NOP", AM_impl, op_nop, 2), m("STZ", AM_abs, op_stz, 4),     m("STA", AM_absX, op_sta, 5), m("STZ", AM_absX, op_stz, 5), m("NOP", AM_impl, op_nop, 2), \
+    m("LDY", AM_imm, op_ldy, 2),  m("LDA", AM_Xind, op_lda, 6), m("LDX", AM_imm, op_ldx, 2),    m("NOP", AM_impl, op_nop, 2), m("LDY", AM_zpg, op_ldy, 3),  m("LDA", AM_zpg, op_lda, 3),  m("LDX", AM_zpg, op_ldx, 3),  m("NOP", AM_impl, op_nop, 2), m("TAY", AM_impl, op_tay, 2), m("LDA", AM_imm, op_lda, 2),  m("TAX", AM_impl, op_tax, 2), m("NOP", AM_impl, op_nop, 2), m("LDY", AM_abs, op_ldy, 4),     m("LDA", AM_abs, op_lda, 4),  m("LDX", AM_abs, op_ldx, 4),  m("NOP", AM_impl, op_nop, 2), \
+    m("BCS", AM_rel, op_bcs, 2),  m("LDA", AM_indY, op_lda, 5), m("LDA", AM_zpgind, op_lda, 5), m("NOP", AM_impl, op_nop, 2), m("LDY", AM_zpgX, op_ldy, 4), m("LDA", AM_zpgX, op_lda, 4), m("LDX", AM_zpgY, op_ldx, 4), m("NOP", AM_impl, op_nop, 2), m("CLV", AM_impl, op_clv, 2), m("LDA", AM_absY, op_lda, 4), m("TSX", AM_impl, op_tsx, 2), m("NOP", AM_impl, op_nop, 2), m("LDY", AM_absX, op_ldy, 4),    m("LDA", AM_absX, op_lda, 4), m("LDX", AM_absY, op_ldx, 4), m("NOP", AM_impl, op_nop, 2), \
+    m("CPY", AM_imm, op_cpy, 2),  m("CMP", AM_Xind, op_cmp, 6), m("NOP", AM_imm, op_nop, 2),    m("NOP", AM_impl, op_nop, 2), m("CPY", AM_zpg, op_cpy, 3),  m("CMP", AM_zpg, op_cmp, 3),  m("DEC", AM_zpg, op_dec, 5),  m("NOP", AM_impl, op_nop, 2), m("INY", AM_impl, op_iny, 2), m("CMP", AM_imm, op_cmp, 2),  m("DEX", AM_impl, op_dex, 2), m("NOP", AM_impl, op_nop, 2), m("CPY", AM_abs, op_cpy, 4),     m("CMP", AM_abs, op_cmp, 4),  m("DEC", AM_abs, op_dec, 6),  m("NOP", AM_impl, op_nop, 2), \
+    m("BNE", AM_rel, op_bne, 2),  m("CMP", AM_indY, op_cmp, 5), m("CMP", AM_zpgind, op_cmp, 5), m("NOP", AM_impl, op_nop, 2), m("NOP", AM_zpgX, op_nop, 4), m("CMP", AM_zpgX, op_cmp, 4), m("DEC", AM_zpgX, op_dec, 6), m("NOP", AM_impl, op_nop, 2), m("CLD", AM_impl, op_cld, 2), m("CMP", AM_absY, op_cmp, 4), m("PHX", AM_impl, op_phx, 3), m("NOP", AM_impl, op_nop, 2), m("NOP", AM_abs, op_nop, 4),     m("CMP", AM_absX, op_cmp, 4), m("DEC", AM_absX, op_dec, 7), m("NOP", AM_impl, op_nop, 2), \
+    m("CPX", AM_imm, op_cpx, 2),  m("SBC", AM_Xind, op_sbc, 6), m("NOP", AM_imm, op_nop, 2),    m("NOP", AM_impl, op_nop, 2), m("CPX", AM_zpg, op_cpx, 3),  m("SBC", AM_zpg, op_sbc, 3),  m("INC", AM_zpg, op_inc, 5),  m("NOP", AM_impl, op_nop, 2), m("INX", AM_impl, op_inx, 2), m("SBC", AM_imm, op_sbc, 2),  m("NOP", AM_impl, op_nop, 2), m("NOP", AM_impl, op_nop, 2), m("CPX", AM_abs, op_cpx, 4),     m("SBC", AM_abs, op_sbc, 4),  m("INC", AM_abs, op_inc, 6),  m("NOP", AM_impl, op_nop, 2), \
+    m("BEQ", AM_rel, op_beq, 2),  m("SBC", AM_indY, op_sbc, 5), m("SBC", AM_zpgind, op_sbc, 5), m("NOP", AM_impl, op_nop, 2), m("NOP", AM_zpgX, op_nop, 4), m("SBC", AM_zpgX, op_sbc, 4), m("INC", AM_zpgX, op_inc, 6), m("NOP", AM_impl, op_nop, 2), m("SED", AM_impl, op_sed, 2), m("SBC", AM_absY, op_sbc, 4), m("PLX", AM_impl, op_plx, 4), m("NOP", AM_impl, op_nop, 2), m("NOP", AM_abs, op_nop, 4),     m("SBC", AM_absX, op_sbc, 4), m("INC", AM_absX, op_inc, 7), m("NOP", AM_impl, op_nop, 2),
+#else
+// Undocumented opcodes ("???") are treated as 2-cycle implied NOPs.
+#define INSTRUCTION_TABLE(m) \
+    m("BRK", AM_impl, op_brk, 7), m("ORA", AM_Xind, op_ora, 6), m("???", AM_impl, op____, 2), m("???", AM_impl, op____, 2), m("???", AM_impl, op____, 2), m("ORA", AM_zpg, op_ora, 3),  m("ASL", AM_zpg, op_asl, 5),  m("???", AM_impl, op____, 2), m("PHP", AM_impl, op_php, 3), m("ORA", AM_imm, op_ora, 2),  m("ASL", AM_A, op_asl, 2),    m("???", AM_impl, op____, 2), m("???", AM_impl, op____, 2), m("ORA", AM_abs, op_ora, 4),  m("ASL", AM_abs, op_asl, 6),  m("???", AM_impl, op____, 2), \
+    m("BPL", AM_rel, op_bpl, 2),  m("ORA", AM_indY, op_ora, 5), m("???", AM_impl, op____, 2), m("???", AM_impl, op____, 2), m("???", AM_impl, op____, 2), m("ORA", AM_zpgX, op_ora, 4), m("ASL", AM_zpgX, op_asl, 6), m("???", AM_impl, op____, 2), m("CLC", AM_impl, op_clc, 2), m("ORA", AM_absY, op_ora, 4), m("???", AM_impl, op____, 2), m("???", AM_impl, op____, 2), m("???", AM_impl, op____, 2), m("ORA", AM_absX, op_ora, 4), m("ASL", AM_absX, op_asl, 7), m("???", AM_impl, op____, 2), \
+    m("JSR", AM_abs, op_jsr, 6),  m("AND", AM_Xind, op_and, 6), m("???", AM_impl, op____, 2), m("???", AM_impl, op____, 2), m("BIT", AM_zpg, op_bit, 3),  m("AND", AM_zpg, op_and, 3),  m("ROL", AM_zpg, op_rol, 5),  m("???", AM_impl, op____, 2), m("PLP", AM_impl, op_plp, 4), m("AND", AM_imm, op_and, 2),  m("ROL", AM_A, op_rol, 2),    m("???", AM_impl, op____, 2), m("BIT", AM_abs, op_bit, 4),  m("AND", AM_abs, op_and, 4),  m("ROL", AM_abs, op_rol, 6),  m("???", AM_impl, op____, 2), \
+    m("BMI", AM_rel, op_bmi, 2),  m("AND", AM_indY, op_and, 5), m("???", AM_impl, op____, 2), m("???", AM_impl, op____, 2), m("???", AM_impl, op____, 2), m("AND", AM_zpgX, op_and, 4), m("ROL", AM_zpgX, op_rol, 6), m("???", AM_impl, op____, 2), m("SEC", AM_impl, op_sec, 2), m("AND", AM_absY, op_and, 4), m("???", AM_impl, op____, 2), m("???", AM_impl, op____, 2), m("???", AM_impl, op____, 2), m("AND", AM_absX, op_and, 4), m("ROL", AM_absX, op_rol, 7), m("???", AM_impl, op____, 2), \
+    m("RTI", AM_impl, op_rti, 6), m("EOR", AM_Xind, op_eor, 6), m("???", AM_impl, op____, 2), m("???", AM_impl, op____, 2), m("???", AM_impl, op____, 2), m("EOR", AM_zpg, op_eor, 3),  m("LSR", AM_zpg, op_lsr, 5),  m("???", AM_impl, op____, 2), m("PHA", AM_impl, op_pha, 3), m("EOR", AM_imm, op_eor, 2),  m("LSR", AM_A, op_lsr, 2),    m("???", AM_impl, op____, 2), m("JMP", AM_abs, op_jmp, 3),  m("EOR", AM_abs, op_eor, 4),  m("LSR", AM_abs, op_lsr, 6),  m("???", AM_impl, op____, 2), \
+    m("BVC", AM_rel, op_bvc, 2),  m("EOR", AM_indY, op_eor, 5), m("???", AM_impl, op____, 2), m("???", AM_impl, op____, 2), m("???", AM_impl, op____, 2), m("EOR", AM_zpgX, op_eor, 4), m("LSR", AM_zpgX, op_lsr, 6), m("???", AM_impl, op____, 2), m("CLI", AM_impl, op_cli, 2), m("EOR", AM_absY, op_eor, 4), m("???", AM_impl, op____, 2), m("???", AM_impl, op____, 2), m("???", AM_impl, op____, 2), m("EOR", AM_absX, op_eor, 4), m("LSR", AM_absX, op_lsr, 7), m("???", AM_impl, op____, 2), \
+    m("RTS", AM_impl, op_rts, 6), m("ADC", AM_Xind, op_adc, 6), m("???", AM_impl, op____, 2), m("???", AM_impl, op____, 2), m("???", AM_impl, op____, 2), m("ADC", AM_zpg, op_adc, 3),  m("ROR", AM_zpg, op_ror, 5),  m("???", AM_impl, op____, 2), m("PLA", AM_impl, op_pla, 4), m("ADC", AM_imm, op_adc, 2),  m("ROR", AM_A, op_ror, 2),    m("???", AM_impl, op____, 2), m("JMP", AM_ind, op_jmp, 5),  m("ADC", AM_abs, op_adc, 4),  m("ROR", AM_abs, op_ror, 6),  m("???", AM_impl, op____, 2), \
+    m("BVS", AM_rel, op_bvs, 2),  m("ADC", AM_indY, op_adc, 5), m("???", AM_impl, op____, 2), m("???", AM_impl, op____, 2), m("???", AM_impl, op____, 2), m("ADC", AM_zpgX, op_adc, 4), m("ROR", AM_zpgX, op_ror, 6), m("???", AM_impl, op____, 2), m("SEI", AM_impl, op_sei, 2), m("ADC", AM_absY, op_adc, 4), m("???", AM_impl, op____, 2), m("???", AM_impl, op____, 2), m("???", AM_impl, op____, 2), m("ADC", AM_absX, op_adc, 4), m("ROR", AM_absX, op_ror, 7), m("???", AM_impl, op____, 2), \
+    m("???", AM_impl, op____, 2), m("STA", AM_Xind, op_sta, 6), m("???", AM_impl, op____, 2), m("???", AM_impl, op____, 2), m("STY", AM_zpg, op_sty, 3),  m("STA", AM_zpg, op_sta, 3),  m("STX", AM_zpg, op_stx, 3),  m("???", AM_impl, op____, 2), m("DEY", AM_impl, op_dey, 2), m("???", AM_impl, op____, 2), m("TXA", AM_impl, op_txa, 2), m("???", AM_impl, op____, 2), m("STY", AM_abs, op_sty, 4),  m("STA", AM_abs, op_sta, 4),  m("STX", AM_abs, op_stx, 4),  m("???", AM_impl, op____, 2), \
+    m("BCC", AM_rel, op_bcc, 2),  m("STA", AM_indY, op_sta, 6), m("???", AM_impl, op____, 2), m("???", AM_impl, op____, 2), m("STY", AM_zpgX, op_sty, 4), m("STA", AM_zpgX, op_sta, 4), m("STX", AM_zpgY, op_stx, 4), m("???", AM_impl, op____, 2), m("TYA", AM_impl, op_tya, 2), m("STA", AM_absY, op_sta, 5), m("TXS", AM_impl, op_txs, 2), m("???", AM_impl, op____, 2), m("???", AM_impl, op____, 2), m("STA", AM_absX, op_sta, 5), m("???", AM_impl, op____, 2), m("???", AM_impl, op____, 2), \
+    m("LDY", AM_imm, op_ldy, 2),  m("LDA", AM_Xind, op_lda, 6), m("LDX", AM_imm, op_ldx, 2),  m("???", AM_impl, op____, 2), m("LDY", AM_zpg, op_ldy, 3),  m("LDA", AM_zpg, op_lda, 3),  m("LDX", AM_zpg, op_ldx, 3),  m("???", AM_impl, op____, 2), m("TAY", AM_impl, op_tay, 2), m("LDA", AM_imm, op_lda, 2),  m("TAX", AM_impl, op_tax, 2), m("???", AM_impl, op____, 2), m("LDY", AM_abs, op_ldy, 4),  m("LDA", AM_abs, op_lda, 4),  m("LDX", AM_abs, op_ldx, 4),  m("???", AM_impl, op____, 2), \
+    m("BCS", AM_rel, op_bcs, 2),  m("LDA", AM_indY, op_lda, 5), m("???", AM_impl, op____, 2), m("???", AM_impl, op____, 2), m("LDY", AM_zpgX, op_ldy, 4), m("LDA", AM_zpgX, op_lda, 4), m("LDX", AM_zpgY, op_ldx, 4), m("???", AM_impl, op____, 2), m("CLV", AM_impl, op_clv, 2), m("LDA", AM_absY, op_lda, 4), m("TSX", AM_impl, op_tsx, 2), m("???", AM_impl, op____, 2), m("LDY", AM_absX, op_ldy, 4), m("LDA", AM_absX, op_lda, 4), m("LDX", AM_absY, op_ldx, 4), m("???", AM_impl, op____, 2), \
+    m("CPY", AM_imm, op_cpy, 2),  m("CMP", AM_Xind, op_cmp, 6), m("???", AM_impl, op____, 2), m("???", AM_impl, op____, 2), m("CPY", AM_zpg, op_cpy, 3),  m("CMP", AM_zpg, op_cmp, 3),  m("DEC", AM_zpg, op_dec, 5),  m("???", AM_impl, op____, 2), m("INY", AM_impl, op_iny, 2), m("CMP", AM_imm, op_cmp, 2),  m("DEX", AM_impl, op_dex, 2), m("???", AM_impl, op____, 2), m("CPY", AM_abs, op_cpy, 4),  m("CMP", AM_abs, op_cmp, 4),  m("DEC", AM_abs, op_dec, 6),  m("???", AM_impl, op____, 2), \
+    m("BNE", AM_rel, op_bne, 2),  m("CMP", AM_indY, op_cmp, 5), m("???", AM_impl, op____, 2), m("???", AM_impl, op____, 2), m("???", AM_impl, op____, 2), m("CMP", AM_zpgX, op_cmp, 4), m("DEC", AM_zpgX, op_dec, 6), m("???", AM_impl, op____, 2), m("CLD", AM_impl, op_cld, 2), m("CMP", AM_absY, op_cmp, 4), m("???", AM_impl, op____, 2), m("???", AM_impl, op____, 2), m("???", AM_impl, op____, 2), m("CMP", AM_absX, op_cmp, 4), m("DEC", AM_absX, op_dec, 7), m("???", AM_impl, op____, 2), \
+    m("CPX", AM_imm, op_cpx, 2),  m("SBC", AM_Xind, op_sbc, 6), m("???", AM_impl, op____, 2), m("???", AM_impl, op____, 2), m("CPX", AM_zpg, op_cpx, 3),  m("SBC", AM_zpg, op_sbc, 3),  m("INC", AM_zpg, op_inc, 5),  m("???", AM_impl, op____, 2), m("INX", AM_impl, op_inx, 2), m("SBC", AM_imm, op_sbc, 2),  m("NOP", AM_impl, op_nop, 2), m("???", AM_impl, op____, 2), m("CPX", AM_abs, op_cpx, 4),  m("SBC", AM_abs, op_sbc, 4),  m("INC", AM_abs, op_inc, 6),  m("???", AM_impl, op____, 2), \
+    m("BEQ", AM_rel, op_beq, 2),  m("SBC", AM_indY, op_sbc, 5), m("???", AM_impl, op____, 2), m("???", AM_impl, op____, 2), m("???", AM_impl, op____, 2), m("SBC", AM_zpgX, op_sbc, 4), m("INC", AM_zpgX, op_inc, 6), m("???", AM_impl, op____, 2), m("SED", AM_impl, op_sed, 2), m("SBC", AM_absY, op_sbc, 4), m("???", AM_impl, op____, 2), m("???", AM_impl, op____, 2), m("???", AM_impl, op____, 2), m("SBC", AM_absX, op_sbc, 4), m("INC", AM_absX, op_inc, 7), m("???", AM_impl, op____, 2),
+#endif
+
+// Per-operation half of DecodedInstruction, pasted in by the op_ name from the
+// table above so the whole decode is a compile-time constant.
+#define DECODE_op_adc .access = CLASS_READ, .alu = ALU_ADC, .reg = REG_A
+#define DECODE_op_and .access = CLASS_READ, .alu = ALU_AND, .reg = REG_A
+#define DECODE_op_asl .access = CLASS_RMW, .alu = ALU_ASL
+#define DECODE_op_bcc .access = CLASS_BRANCH, .alu = ALU_BRANCH_CLEAR, .flag = STAT_C_CARRY
+#define DECODE_op_bcs .access = CLASS_BRANCH, .alu = ALU_BRANCH_SET, .flag = STAT_C_CARRY
+#define DECODE_op_beq .access = CLASS_BRANCH, .alu = ALU_BRANCH_SET, .flag = STAT_Z_ZERO
+#define DECODE_op_bim .access = CLASS_READ, .alu = ALU_BIT_IMM, .reg = REG_A
+#define DECODE_op_bit .access = CLASS_READ, .alu = ALU_BIT, .reg = REG_A
+#define DECODE_op_bmi .access = CLASS_BRANCH, .alu = ALU_BRANCH_SET, .flag = STAT_N_NEGATIVE
+#define DECODE_op_bne .access = CLASS_BRANCH, .alu = ALU_BRANCH_CLEAR, .flag = STAT_Z_ZERO
+#define DECODE_op_bpl .access = CLASS_BRANCH, .alu = ALU_BRANCH_CLEAR, .flag = STAT_N_NEGATIVE
+#define DECODE_op_bra .access = CLASS_BRANCH, .alu = ALU_BRANCH_CLEAR, .flag = 0 /* always clear */
+#define DECODE_op_brk .access = CLASS_BRK
+#define DECODE_op_bvc .access = CLASS_BRANCH, .alu = ALU_BRANCH_CLEAR, .flag = STAT_V_OVERFLOW
+#define DECODE_op_bvs .access = CLASS_BRANCH, .alu = ALU_BRANCH_SET, .flag = STAT_V_OVERFLOW
+#define DECODE_op_clc .access = CLASS_IMPLIED, .alu = ALU_CLEAR, .flag = STAT_C_CARRY
+#define DECODE_op_cld .access = CLASS_IMPLIED, .alu = ALU_CLEAR, .flag = STAT_D_DECIMAL
+#define DECODE_op_cli .access = CLASS_IMPLIED, .alu = ALU_CLEAR, .flag = STAT_I_INTERRUPT
+#define DECODE_op_clv .access = CLASS_IMPLIED, .alu = ALU_CLEAR, .flag = STAT_V_OVERFLOW
+#define DECODE_op_cmp .access = CLASS_READ, .alu = ALU_CMP, .reg = REG_A
+#define DECODE_op_cpx .access = CLASS_READ, .alu = ALU_CMP, .reg = REG_X
+#define DECODE_op_cpy .access = CLASS_READ, .alu = ALU_CMP, .reg = REG_Y
+#define DECODE_op_dea .access = CLASS_RMW, .alu = ALU_DEC
+#define DECODE_op_dec .access = CLASS_RMW, .alu = ALU_DEC
+#define DECODE_op_dex .access = CLASS_IMPLIED, .alu = ALU_DEC, .reg = REG_X
+#define DECODE_op_dey .access = CLASS_IMPLIED, .alu = ALU_DEC, .reg = REG_Y
+#define DECODE_op_eor .access = CLASS_READ, .alu = ALU_EOR, .reg = REG_A
+#define DECODE_op_ina .access = CLASS_RMW, .alu = ALU_INC
+#define DECODE_op_inc .access = CLASS_RMW, .alu = ALU_INC
+#define DECODE_op_inx .access = CLASS_IMPLIED, .alu = ALU_INC, .reg = REG_X
+#define DECODE_op_iny .access = CLASS_IMPLIED, .alu = ALU_INC, .reg = REG_Y
+#define DECODE_op_jmp .access = CLASS_JMP
+#define DECODE_op_jsr .access = CLASS_JSR
+#define DECODE_op_lda .access = CLASS_READ, .alu = ALU_LD, .reg = REG_A
+#define DECODE_op_ldx .access = CLASS_READ, .alu = ALU_LD, .reg = REG_X
+#define DECODE_op_ldy .access = CLASS_READ, .alu = ALU_LD, .reg = REG_Y
+#define DECODE_op_lsr .access = CLASS_RMW, .alu = ALU_LSR
+#define DECODE_op_nop .access = CLASS_IMPLIED
+#define DECODE_op_ora .access = CLASS_READ, .alu = ALU_ORA, .reg = REG_A
+#define DECODE_op_pha .access = CLASS_PUSH, .reg = REG_A
+#define DECODE_op_php .access = CLASS_PUSH, .reg = REG_P
+#define DECODE_op_phx .access = CLASS_PUSH, .reg = REG_X
+#define DECODE_op_phy .access = CLASS_PUSH, .reg = REG_Y
+#define DECODE_op_pla .access = CLASS_PULL, .reg = REG_A
+#define DECODE_op_plp .access = CLASS_PULL, .reg = REG_P
+#define DECODE_op_plx .access = CLASS_PULL, .reg = REG_X
+#define DECODE_op_ply .access = CLASS_PULL, .reg = REG_Y
+#define DECODE_op_rol .access = CLASS_RMW, .alu = ALU_ROL
+#define DECODE_op_ror .access = CLASS_RMW, .alu = ALU_ROR
+#define DECODE_op_rti .access = CLASS_RTI
+#define DECODE_op_rts .access = CLASS_RTS
+#define DECODE_op_sbc .access = CLASS_READ, .alu = ALU_SBC, .reg = REG_A
+#define DECODE_op_sec .access = CLASS_IMPLIED, .alu = ALU_SET, .flag = STAT_C_CARRY
+#define DECODE_op_sed .access = CLASS_IMPLIED, .alu = ALU_SET, .flag = STAT_D_DECIMAL
+#define DECODE_op_sei .access = CLASS_IMPLIED, .alu = ALU_SET, .flag = STAT_I_INTERRUPT
+#define DECODE_op_sta .access = CLASS_WRITE, .alu = ALU_ST, .reg = REG_A
+#define DECODE_op_stx .access = CLASS_WRITE, .alu = ALU_ST, .reg = REG_X
+#define DECODE_op_sty .access = CLASS_WRITE, .alu = ALU_ST, .reg = REG_Y
+#define DECODE_op_stz .access = CLASS_WRITE, .alu = ALU_ST, .reg = REG_ZERO
+#define DECODE_op_tax .access = CLASS_IMPLIED, .alu = ALU_LD, .reg = REG_X, .src = REG_A
+#define DECODE_op_tay .access = CLASS_IMPLIED, .alu = ALU_LD, .reg = REG_Y, .src = REG_A
+#define DECODE_op_trb .access = CLASS_RMW, .alu = ALU_TRB
+#define DECODE_op_tsb .access = CLASS_RMW, .alu = ALU_TSB
+#define DECODE_op_tsx .access = CLASS_IMPLIED, .alu = ALU_LD, .reg = REG_X, .src = REG_SP
+#define DECODE_op_txa .access = CLASS_IMPLIED, .alu = ALU_LD, .reg = REG_A, .src = REG_X
+#define DECODE_op_txs .access = CLASS_IMPLIED, .alu = ALU_MOV, .reg = REG_SP, .src = REG_X
+#define DECODE_op_tya .access = CLASS_IMPLIED, .alu = ALU_LD, .reg = REG_A, .src = REG_Y
+#define DECODE_op____ .access = CLASS_IMPLIED
+
+#endif
@@ -0,0 +1,59 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include "blockcache.h"
+#include "common.h"
+#include "cpu6502.h"
+
+// Dynamic recompiler for x86-64 hosts: blocks of the block cache that have run
+// JIT_HOT_RUNS times are translated into native code in an executable arena.
+//
+// Loads, stores, ALU ops, transfers, flag ops, branches and JMP with an address
+// known at compile time become native code, reading and writing the memory
+// map's buffers directly. Everything else (indexed and indirect addresses,
+// stack ops, calls and returns) calls back into the interpreter for that one
+// instruction. A fixed address with I/O registered (mem_add_io) ends the
+// native code before the instruction, so MMIO always goes through
+// mem_read_addr and mem_write_addr. Blocks in writable memory check their page
+// versions after every write and leave as soon as they've been written over.
+// With a guest profile attached, a trace running or debugger watchpoints set
+// nothing runs natively, so every instruction and access is seen.
+//
+// Native code lives as long as its block: block_cache_flush keeps the blocks
+// in ROM, so code there isn't compiled again after a reset.
+//
+// The generated code points straight into the memory map's blocks: flush the
+// JIT if the map changes. Banks are the exception: reads from them load the
+// bank's page table entry, so code elsewhere sees a switch straight away.
+// Switching a bank (mem_switch_bank) drops the blocks in it from the block
+// cache, native code and all, and code in a bank leaves after any interpreted
+// write in case it switched itself out.
+
+typedef void (*JitBlockFn)(Cpu6502 *c);
+
+typedef struct {
+#define JIT_ARENA_SIZE (4 << 20)
+#define JIT_HOT_RUNS   8          // interpreted runs before a block is compiled
+#define JIT_NEVER      0xFFFFFFFF // runs of a block that starts with MMIO
+    BlockCache *blocks;
+    u8         *arena; // mmap'd read/write/execute
+    size_t      arena_used;
+    u64         compiled;
+    u64         native_runs;
+} Jit;
+
+// False if generated code can't run here (not x86-64, or no executable memory).
+bool jit_init(Jit *j, BlockCache *bc);
+void jit_free(Jit *j);
+// Drops all generated code.
+void jit_flush(Jit *j);
+
+// Native code for b, compiled once it is hot. NULL means interpret it.
+JitBlockFn jit_get(Jit *j, CachedBlock *b);
+
+// Instruction level, same results as cpu_run_blocks but hot blocks run as
+// native code. Native blocks always run to the end, so this may overshoot
+// `cycles` by up to a block; returns cycles taken.
+u64 cpu_run_jit(Cpu6502 *c, Jit *j, u64 cycles);
+
+#endif
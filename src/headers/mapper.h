@@ -0,0 +1,96 @@
+#ifndef MAPPER_H
+#define MAPPER_H
+
+#include "common.h"
+#include "cpu6502.h"
+#include "memmap.h"
+#include "ram.h"
+
+// iNES cartridges and their mappers: NROM (0), MMC1 (1), UxROM (2), CNROM (3)
+// and MMC3 (4).
+//
+// PRG ROM is mapped at $8000-$FFFF as four 8KB banks of the memory map
+// (mem_add_bank), with the mapper's registers as write-only I/O over the same
+// range. A register write repoints the banks' page table entries
+// (mem_switch_bank), so nothing is copied, switching costs the same whatever
+// the bank size, and reads from banked ROM are as cheap as any other memory.
+// NROM has no registers and maps no I/O at all.
+//
+// CHR is switched the same way, as eight 1KB pointers (mapper_chr); the PPU
+// doesn't render, so nothing reads them yet. For the same reason the MMC3's
+// scanline counter is clocked by mapper_scanline rather than off the PPU's
+// A12. Bus conflicts, the MMC1's ignoring of consecutive writes and PRG RAM
+// write protection aren't emulated.
+
+typedef enum {
+    MAPPER_NROM  = 0,
+    MAPPER_MMC1  = 1,
+    MAPPER_UXROM = 2,
+    MAPPER_CNROM = 3,
+    MAPPER_MMC3  = 4,
+} MapperId;
+
+typedef enum {
+    MIRROR_HORIZONTAL,
+    MIRROR_VERTICAL,
+    MIRROR_SINGLE_LOW,
+    MIRROR_SINGLE_HIGH,
+    MIRROR_FOUR_SCREEN,
+} Mirroring;
+
+typedef struct {
+    u8 shift;   // bits written so far, lowest first
+    u8 written; // how many
+    u8 control;
+    u8 chr[2];
+    u8 prg;
+} Mmc1;
+
+typedef struct {
+    u8   bank_select;
+    u8   banks[8]; // R0-R7
+    u8   irq_latch;
+    u8   irq_counter;
+    bool irq_reload;
+    bool irq_enabled;
+} Mmc3;
+
+typedef struct {
+#define MAPPER_PRG_BANK  0x2000 // as mapped: 16KB and 32KB banks are several of these
+#define MAPPER_PRG_SLOTS 4      // $8000, $A000, $C000, $E000
+#define MAPPER_CHR_BANK  0x400
+#define MAPPER_CHR_SLOTS 8
+    MapperId  id;
+    Mirroring mirroring;
+    u8       *prg;
+    size_t    prg_size;
+    u8       *chr;
+    size_t    chr_size;
+    bool      chr_ram; // the cartridge has none, so it's 8KB of RAM
+    Ram       prg_ram; // $6000-$7FFF
+
+    Cpu6502 *cpu;                         // set by mapper_attach
+    int      prg_banks[MAPPER_PRG_SLOTS]; // the memory map's banks
+    u8      *chr_banks[MAPPER_CHR_SLOTS];
+
+    u8   latch; // UxROM's PRG bank, CNROM's CHR bank
+    Mmc1 mmc1;
+    Mmc3 mmc3;
+} Mapper;
+
+// Reads an iNES file (a trainer is skipped). False if it can't be read or its
+// mapper isn't one of the above.
+bool mapper_load_ines(Mapper *mp, const char *filepath);
+void mapper_free(Mapper *mp);
+
+// Maps PRG RAM, PRG ROM and the registers into c's memory map, with the banks
+// as they are at power up. False if the memory map is out of blocks or I/O.
+bool mapper_attach(Mapper *mp, Cpu6502 *c);
+
+// The CHR byte the PPU sees at addr ($0000-$1FFF).
+u8 *mapper_chr(Mapper *mp, u16 addr);
+// Clocks the MMC3's IRQ counter, once per rendered scanline. Does nothing for
+// the other mappers.
+void mapper_scanline(Mapper *mp);
+
+#endif
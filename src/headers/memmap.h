@@ -2,7 +2,6 @@
 #define MEMMAP_H
 
 #include "common.h"
-#include "ppuregisters.h"
 #include "ram.h"
 #include "rom.h"
 #include "stdio.h"
@@ -14,20 +13,100 @@ typedef struct {
     memaddr     range_low;
     memaddr     range_high;
     u8 *        values;
+    bool        mirror; // the same values as the block before it, further up
+    bool        bank;   // values are switched by mem_switch_bank
 } MemoryBlock;
 
+// Memory-mapped I/O: reads and writes in [range_low, range_high] call the
+// device instead of touching memory. ctx is the device. A direction without a
+// function is left to the blocks underneath, so a device that's only written
+// (cartridge bank registers over PRG ROM) costs reads nothing.
+typedef u8 (*MemReadFn)(void *ctx, memaddr addr);
+typedef void (*MemWriteFn)(void *ctx, memaddr addr, u8 value);
+
+typedef struct {
+    memaddr    range_low;
+    memaddr    range_high;
+    MemReadFn  read;  // NULL: reads go to the blocks
+    MemWriteFn write; // NULL: writes go to the blocks
+    void      *ctx;
+} MemoryIo;
+
+// What a page that isn't all in one block does instead: MEM_PAGE_IO + i is
+// io[i], which covers the whole page.
+enum {
+    MEM_PAGE_OPEN, // nothing mapped: reads are 0, writes go nowhere
+    MEM_PAGE_SCAN, // split between I/O and blocks, looked up address by address
+    MEM_PAGE_HOOK, // accessed as mapped, then reported: see mem_hook_pages
+    MEM_PAGE_IO,
+};
+
+typedef struct {
+    u8 *base;    // the page's block, biased so base[addr] is addr's byte; NULL if it's handled
+    u8  handler; // MEM_PAGE_*, when base is NULL
+} MemoryPage;
+
+struct BlockCache;
+struct Debugger;
+
+// Blocks and I/O are looked up through a page table per direction, built by
+// the mem_add_* functions: a page that lies inside a single block is read and
+// written through its pointer, anything else goes to its handler, so memory
+// accesses never check for I/O. I/O takes precedence over blocks where they
+// overlap, and whatever was added earlier over what was added later.
+//
+// read_pages and write_pages are what accesses go through. They're the pages
+// as mapped (read_mapped, write_mapped) but for the ones that something has to
+// hear about, which go to MEM_PAGE_HOOK instead, so reading or writing any
+// other page of memory is just the pointer access. Those are the pages with
+// the debugger's watchpoints and, for writes to blocks, pages holding code the
+// block cache has decoded and pages that aren't dirty yet: the first write to
+// one marks it, and the rest go straight through until a delta cleans it.
 typedef struct {
 #define MEM_MAP_MAX_BLOCKS 16
-    uint          n_read_blocks;
-    uint          n_write_blocks;
-    MemoryBlock   read_blocks[MEM_MAP_MAX_BLOCKS];
-    MemoryBlock   write_blocks[MEM_MAP_MAX_BLOCKS];
-    PPURegisters *_ppu; // I hate that I need to do this, but PPU really f's up my mapping
+#define MEM_MAP_MAX_IO     16
+    uint        n_read_blocks;
+    uint        n_write_blocks;
+    uint        n_io;
+    MemoryBlock read_blocks[MEM_MAP_MAX_BLOCKS];
+    MemoryBlock write_blocks[MEM_MAP_MAX_BLOCKS];
+    MemoryIo    io[MEM_MAP_MAX_IO];
+    MemoryPage  read_pages[0x100];
+    MemoryPage  write_pages[0x100];
+    MemoryPage  read_mapped[0x100];
+    MemoryPage  write_mapped[0x100];
+    u8          dirty[0x100 / 8]; // a bit per page written since the last mem_snapshot_delta
+
+    struct BlockCache *block_cache; // optional, told about writes so it can drop stale code
+    struct Debugger   *debugger;    // set by the debugger only while it has watchpoints
 } MemoryMap;
 
+// Routes the accesses to pages lo to hi through MEM_PAGE_HOOK, or back
+// straight to memory, for whoever changed what they want to hear about there.
+void mem_hook_pages(MemoryMap *m, uint lo, uint hi);
+
 void mem_add_rom(MemoryMap *m, Rom *r, const char *name);
 void mem_add_ram(MemoryMap *m, Ram *r, const char *name);
-void mem_add_ppu(MemoryMap *m, PPURegisters *p);
+// Also maps r every r->size bytes after its map_offset, for as long as it
+// fits up to mirror_high: NES RAM is 2KB at $0000 with mirror_high $1FFF. A
+// mirror costs a block, not a copy, and with r->size a multiple of 256 its
+// pages go through the page table like the original's.
+void mem_add_rom_mirrored(MemoryMap *m, Rom *r, const char *name, u32 mirror_high);
+void mem_add_ram_mirrored(MemoryMap *m, Ram *r, const char *name, u32 mirror_high);
+// False if there's no room for another.
+bool mem_add_io(MemoryMap *m, memaddr lo, memaddr hi, MemReadFn read_fn, MemWriteFn write_fn, void *ctx);
+// The I/O handling reads (or writes) at addr, if any.
+MemoryIo *mem_get_io(MemoryMap *m, memaddr addr, bool write);
+
+// A window of `size` bytes of ROM at lo whose memory can be switched, for
+// cartridge banks. Returns its index for mem_switch_bank, or -1 if there's no
+// room. With lo and size multiples of 256 its pages map straight to the bank.
+int mem_add_bank(MemoryMap *m, const char *name, memaddr lo, size_t size, u8 *values);
+// Points a bank at other memory of its size: the block and its page table
+// entries are repointed and nothing is copied, so switching costs the same
+// however often it happens and reads cost nothing extra. The block cache drops
+// the blocks in the bank if it changes, as the code there has.
+void mem_switch_bank(MemoryMap *m, int bank, u8 *values);
 
 // use for debug purposes only; not always accurate
 MemoryBlock *mem_get_read_block(MemoryMap *m, memaddr addr);
@@ -37,4 +116,42 @@ MemoryBlock *mem_get_write_block(MemoryMap *m, memaddr addr);
 u8   mem_read_addr(MemoryMap *m, memaddr addr);
 void mem_write_addr(MemoryMap *m, memaddr addr, u8 value);
 
+// Snapshots of just the pages written since the last one. Every write that
+// lands in a block (through mem_write_addr or the JIT's code) sets its page's
+// bit in `dirty`, though only the first to a clean page has to do anything
+// for it; a write to a mirror counts for the page it mirrors. Taking a
+// delta copies the dirty pages of the RAM blocks and clears the bits, so it
+// costs what the program wrote rather than all of RAM.
+//
+// A delta only holds what changed, so state is rebuilt by restoring a full one
+// (taken after mem_dirty_all) and then every delta after it, in order. Deltas
+// belong to the map as it was: adding blocks marks every page dirty, so the
+// next delta is a full one again.
+
+typedef struct {
+    u8      block; // write block it was copied from
+    memaddr addr;
+    u16     size; // the page, or as much of it as the block covers
+} MemDeltaPage;
+
+typedef struct {
+#define MEM_DELTA_MAX_PAGES (0x100 + MEM_MAP_MAX_BLOCKS) // one per block a page is split between
+    uint         n_pages;
+    MemDeltaPage pages[MEM_DELTA_MAX_PAGES];
+    u8          *data; // the pages' bytes, back to back
+    size_t       size;
+    size_t       capacity;
+} MemDelta;
+
+// Marks every page dirty, for memory changed behind the map's back or to make
+// the next delta a full one.
+void mem_dirty_all(MemoryMap *m);
+// d must start zeroed; its buffer is reused and grown as needed. False if it
+// can't be, leaving the dirty bits alone.
+bool mem_snapshot_delta(MemoryMap *m, MemDelta *d);
+// Copies d's pages back. They're marked dirty, having changed since the last
+// snapshot, and code cached from them is dropped.
+void mem_restore_delta(MemoryMap *m, const MemDelta *d);
+void mem_delta_free(MemDelta *d);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,41 @@
+#ifndef PPU_H
+#define PPU_H
+
+#include "common.h"
+#include "cpu6502.h"
+#include "ppuregisters.h"
+#include "scheduler.h"
+
+// The PPU is run lazily instead of 3 dots per CPU cycle in lockstep: it only
+// catches up to the CPU's cyc when one of its registers at $2000-$3FFF is
+// touched, or when a scheduled event needs it (the vblank NMI). Between those
+// nothing can observe it, so the result is the same as running it every cycle.
+//
+// Timing is NTSC: 341 dots by 262 scanlines, 3 dots per CPU cycle. It's as
+// accurate as the CPU's cyc is when the access happens: exact with the cycle
+// engine, the start of the instruction with cpu_step and friends.
+
+#define PPU_DOTS_PER_CYCLE    3
+#define PPU_DOTS_PER_SCANLINE 341
+#define PPU_SCANLINES         262
+#define PPU_VBLANK_SCANLINE   241
+#define PPU_PRERENDER         261
+
+#define PPU_CTRL_NMI      0x80
+#define PPU_STATUS_VBLANK 0x80
+
+// Maps p's registers at $2000-$3FFF (mirrored every 8 bytes) with mem_add_io,
+// as storage until ppu_attach.
+void mem_add_ppu(MemoryMap *m, PPURegisters *p);
+
+// Makes p follow c's cyc, starting from dot 0 of scanline 0 now, and
+// schedules the vblank NMI on s. Call it after mem_add_ppu.
+void ppu_attach(PPURegisters *p, Cpu6502 *c, Scheduler *s);
+// Runs the PPU up to the CPU's cyc. Does nothing when not attached.
+void ppu_catch_up(PPURegisters *p);
+
+// Register access, which the memory map calls for $2000-$3FFF.
+u8   ppu_read(PPURegisters *p, memaddr addr);
+void ppu_write(PPURegisters *p, memaddr addr, u8 value);
+
+#endif
@@ -3,6 +3,8 @@
 
 #include "common.h"
 
+struct Cpu6502;
+
 typedef struct {
     u8 controller;  // $2000 w
     u8 mask;        // $2001 w
@@ -12,6 +14,15 @@ typedef struct {
     u8 scroll;      // $2005 w
     u8 address;     // $2006 w
     u8 data;        // $2007 rw
+
+    // Timing, once ppu_attach (ppu.h) has given it a CPU to follow. Until then
+    // the registers are only storage. mem_add_ppu detaches it.
+    struct Cpu6502 *cpu;        // whose cyc it catches up to
+    u64             synced_cyc; // CPU cycle it has been run up to
+    u16             scanline;   // 0-261: 241 starts vblank, 261 is the pre-render line
+    u16             dot;        // 0-340
+    u64             frame;
+    u64             catch_ups; // times it actually had to run
 } PPURegisters;
 
-#endif
\ No newline at end of file
+#endif
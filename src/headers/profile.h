@@ -9,6 +9,12 @@
 long get_frame(void *fn);
 void init_profiler();
 void end_profiler(const char *file_name);
+// An evented speedscope profile, as end_profiler writes. frames and events are
+// JSON objects one per line, each ending in ",\n". extra is more fields for the
+// profile in the same form, or NULL.
+void write_speedscope(FILE *fd, const char *name, const char *unit, unsigned long start, unsigned long end,
+                      const char *frames, size_t frames_size, const char *events, size_t events_size,
+                      const char *extra);
 void __cyg_profile_func_enter (void *, void *) __attribute__((no_instrument_function));
 void __cyg_profile_func_exit (void *, void *) __attribute__((no_instrument_function));
 
@@ -0,0 +1,76 @@
+#ifndef REWIND_H
+#define REWIND_H
+
+#include "common.h"
+#include "cpu6502.h"
+#include "memmap.h"
+
+// Stepping backwards, for the monitors. Every `interval` cycles the CPU, the
+// RAM blocks of its memory map and any device state added with
+// rewind_add_state are copied into a ring of snapshots. Going back to a cycle
+// restores the newest snapshot from before it and replays forward on the
+// cycle engine, which is deterministic, so the CPU ends up exactly as it was
+// then.
+//
+// Snapshots are taken by rewind_poll between batches rather than by the core,
+// so running costs nothing in between and a snapshot is a memcpy per RAM
+// block and state. They land at the first poll after each interval has
+// passed, which may be mid-instruction; the CPU state covers that.
+//
+// While replaying, the memory map's debugger and the CPU's guest profile and
+// trace are detached, so replayed accesses don't hit watchpoints and replayed
+// instructions aren't charged or recorded twice. A block cache is flushed and
+// every page marked dirty (mem_snapshot_delta), as restoring memory goes
+// behind the map's back. Anything else the program can see (a PPU being
+// clocked, input) has to be deterministic too, or the replay goes its own way.
+
+typedef struct {
+    u64      cyc; // when it was taken
+    CpuState cpu;
+    u8      *ram; // every write block but mirrors, then every state, back to back
+} RewindSnapshot;
+
+typedef struct {
+    void  *state;
+    size_t size;
+} RewindState;
+
+typedef struct {
+#define REWIND_MAX_SNAPSHOTS 64
+#define REWIND_MAX_STATES    8
+    Cpu6502       *cpu;
+    u64            interval;
+    u64            next;     // cyc to take the next snapshot at
+    size_t         ram_size; // of each snapshot
+    u8            *ram;      // REWIND_MAX_SNAPSHOTS * ram_size
+    uint           head;     // the next one to be written
+    uint           n;
+    RewindSnapshot snapshots[REWIND_MAX_SNAPSHOTS];
+    uint           n_states;
+    RewindState    states[REWIND_MAX_STATES];
+} Rewind;
+
+// Sizes the snapshots for c's memory map as it is now: don't add blocks to it
+// afterwards. Takes the first snapshot straight away. False if the ring can't
+// be allocated.
+bool rewind_init(Rewind *r, Cpu6502 *c, u64 interval);
+void rewind_free(Rewind *r);
+// Snapshots `size` bytes at state along with memory, for devices behind
+// mem_add_io (the PPU's registers, say). They're copied back as they are, so
+// pointers in them must stay valid. Starts the ring over; false if it can't
+// be allocated or there are REWIND_MAX_STATES already.
+bool rewind_add_state(Rewind *r, void *state, size_t size);
+
+// Takes a snapshot if `interval` cycles have passed since the last one.
+void rewind_poll(Rewind *r);
+
+// Takes the CPU back to `cyc` (not forward). Snapshots from after it are
+// dropped. False, leaving the CPU alone, if it's older than the oldest one.
+bool rewind_to(Rewind *r, u64 cyc);
+// Back by a clock.
+bool rewind_cycle(Rewind *r);
+// Back to the start of the instruction before the one at pc, or to the start
+// of the current one if the CPU is in the middle of it.
+bool rewind_instruction(Rewind *r);
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include "common.h"
+#include "cpu6502.h"
+
+// Timed events for whatever runs alongside the CPU: vblank NMIs, IRQ sources,
+// DMA. Events are kept in a min-heap on the cycle they're due, so the run loop
+// only looks at the queue when the earliest one is due and otherwise leaves
+// the CPU running in the cycle engine.
+//
+// An event runs once the CPU's cyc has reached its cycle, which may be in the
+// middle of an instruction. It can drive the CPU's pins (cpu_nmi, cpu_set_irq),
+// touch memory, schedule more events (itself again, for periodic ones) or take
+// cycles from the CPU by adding them to cyc, as DMA does. Events due on the
+// same cycle run in the order they were scheduled.
+
+struct Scheduler;
+
+// `cyc` is when the event was due, which c->cyc may be past.
+typedef void (*EventFn)(struct Scheduler *s, u64 cyc, void *ctx);
+
+typedef struct {
+    u64     cyc;
+    u64     seq; // scheduling order, to break ties
+    EventFn fn;
+    void   *ctx;
+} ScheduledEvent;
+
+typedef struct Scheduler {
+#define SCHEDULER_MAX_EVENTS 64
+    Cpu6502       *cpu;
+    uint           n_events;
+    u64            n_scheduled;
+    ScheduledEvent events[SCHEDULER_MAX_EVENTS]; // heap, earliest first
+} Scheduler;
+
+void scheduler_init(Scheduler *s, Cpu6502 *c);
+
+// False if the queue is full.
+bool scheduler_add(Scheduler *s, u64 cyc, EventFn fn, void *ctx);
+// Drops every pending event with this fn and ctx; returns how many there were.
+uint scheduler_cancel(Scheduler *s, EventFn fn, void *ctx);
+// When the earliest event is due, or UINT64_MAX if there's none.
+u64 scheduler_next(Scheduler *s);
+
+// Runs every event that's due by the CPU's cyc.
+void scheduler_run_due(Scheduler *s);
+// Runs the CPU cycle accurately for `cycles` (or a little past, if events take
+// cycles from it), running events as they come due. Returns cycles run.
+u64 scheduler_run(Scheduler *s, u64 cycles);
+
+#endif
@@ -0,0 +1,594 @@
+#include "headers/jit.h"
+#include "headers/instructions.h"
+#include "stddef.h"
+#include "string.h"
+#include "sys/mman.h"
+
+// cpu6502.c internals, called by cpu_run_jit and by the generated code
+void _cpu_alu(Cpu6502 *c, const DecodedInstruction *d, u8 val);
+u8   _cpu_modify(Cpu6502 *c, AluOp alu, u8 val);
+void _cpu_step_execute(Cpu6502 *c, memaddr pc, u16 operand);
+void _cpu_step_end(Cpu6502 *c);
+void _cpu_run_block(Cpu6502 *c, BlockCache *bc, const CachedBlock *b, u64 cyc_start, u64 cycles);
+bool _cpu_interrupt_pending(Cpu6502 *c);
+void _cpu_step_interrupt(Cpu6502 *c);
+void _cpu_trace_store(Cpu6502 *c, CpuTrace *t, u64 cyc, memaddr pc, u8 opcode, u16 operand);
+
+#define JIT_MAX_BLOCK_CODE 4096 // worst case for BLOCK_MAX_INSTRUCTIONS instructions
+
+bool jit_init(Jit *j, BlockCache *bc) {
+    memset(j, 0, sizeof(Jit));
+    j->blocks = bc;
+
+#if defined(__x86_64__)
+    void *arena = mmap(NULL, JIT_ARENA_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (arena == MAP_FAILED) {
+        return false;
+    }
+    j->arena = arena;
+    return true;
+#else
+    return false;
+#endif
+}
+
+void jit_free(Jit *j) {
+    jit_flush(j);
+    if (j->arena) {
+        munmap(j->arena, JIT_ARENA_SIZE);
+        j->arena = NULL;
+    }
+}
+
+void jit_flush(Jit *j) {
+    for (uint i = 0; i < BLOCK_CACHE_SIZE; i++) {
+        j->blocks->blocks[i].native = NULL;
+        j->blocks->blocks[i].runs   = 0;
+    }
+    j->arena_used = 0;
+}
+
+
+// x86-64 emitter
+//
+// Generated blocks are `void block(Cpu6502 *c)`. rbx holds c for the whole
+// block and the 6502 registers stay in *c, so calls back into C need no
+// spilling. eax holds the operand value, ecx/edx are scratch.
+
+typedef struct {
+    u8 *p;
+    u32 cycles; // base cycles not yet added to c->cyc
+    u8  ir;     // opcode of the last instruction compiled
+} _JitEmitter;
+
+enum { X86_EAX, X86_ECX, X86_EDX, X86_EBX, X86_ESP, X86_EBP, X86_ESI, X86_EDI };
+enum { X86_JE = 0x4, X86_JNE = 0x5 };
+
+#define _jit_field(f) ((u32)offsetof(Cpu6502, f))
+
+void _jit_u8(_JitEmitter *e, u8 v) {
+    *e->p++ = v;
+}
+
+void _jit_u16(_JitEmitter *e, u16 v) {
+    memcpy(e->p, &v, sizeof(v));
+    e->p += sizeof(v);
+}
+
+void _jit_u32(_JitEmitter *e, u32 v) {
+    memcpy(e->p, &v, sizeof(v));
+    e->p += sizeof(v);
+}
+
+void _jit_u64(_JitEmitter *e, u64 v) {
+    memcpy(e->p, &v, sizeof(v));
+    e->p += sizeof(v);
+}
+
+// ModRM + disp32 for [rbx + disp]
+void _jit_rbx(_JitEmitter *e, u8 reg, u32 disp) {
+    _jit_u8(e, 0x83 | (reg << 3));
+    _jit_u32(e, disp);
+}
+
+// movzx reg, byte [rbx + field]
+void _jit_load_field(_JitEmitter *e, u8 reg, u32 field) {
+    _jit_u8(e, 0x0F);
+    _jit_u8(e, 0xB6);
+    _jit_rbx(e, reg, field);
+}
+
+// mov byte [rbx + field], al/cl/dl
+void _jit_store_field(_JitEmitter *e, u8 reg, u32 field) {
+    _jit_u8(e, 0x88);
+    _jit_rbx(e, reg, field);
+}
+
+void _jit_mov_imm32(_JitEmitter *e, u8 reg, u32 v) {
+    _jit_u8(e, 0xB8 + reg);
+    _jit_u32(e, v);
+}
+
+void _jit_mov_imm64(_JitEmitter *e, u8 reg, u64 v) {
+    _jit_u8(e, 0x48);
+    _jit_u8(e, 0xB8 + reg);
+    _jit_u64(e, v);
+}
+
+// Arguments go in rdi, rsi, rdx; the first is always c.
+void _jit_call(_JitEmitter *e, void *fn) {
+    _jit_u8(e, 0x48); // mov rdi, rbx
+    _jit_u8(e, 0x89);
+    _jit_u8(e, 0xDF);
+    _jit_mov_imm64(e, X86_EAX, (u64)(uintptr_t)fn);
+    _jit_u8(e, 0xFF); // call rax
+    _jit_u8(e, 0xD0);
+}
+
+// Short forward jump, resolved by _jit_land.
+u8 *_jit_jcc(_JitEmitter *e, u8 cc) {
+    _jit_u8(e, 0x70 | cc);
+    _jit_u8(e, 0);
+    return e->p - 1;
+}
+
+void _jit_land(_JitEmitter *e, u8 *jump) {
+    *jump = (u8)(e->p - (jump + 1));
+}
+
+void _jit_flush_cycles(_JitEmitter *e) {
+    if (e->cycles) {
+        _jit_u8(e, 0x48); // add qword [rbx + cyc], imm32
+        _jit_u8(e, 0x81);
+        _jit_rbx(e, 0, _jit_field(cyc));
+        _jit_u32(e, e->cycles);
+        e->cycles = 0;
+    }
+}
+
+// Leaves the block with pc at the next instruction to run.
+void _jit_exit(_JitEmitter *e, memaddr pc) {
+    _jit_flush_cycles(e);
+    _jit_u8(e, 0x66); // mov word [rbx + pc], imm16
+    _jit_u8(e, 0xC7);
+    _jit_rbx(e, 0, _jit_field(pc));
+    _jit_u16(e, pc);
+    _jit_u8(e, 0xC6); // mov byte [rbx + ir], imm8
+    _jit_rbx(e, 0, _jit_field(ir));
+    _jit_u8(e, e->ir);
+    _jit_u8(e, 0x5B); // pop rbx
+    _jit_u8(e, 0xC3); // ret
+}
+
+// N and Z from eax, lazily (see NZ_LAZY).
+void _jit_update_nz(_JitEmitter *e) {
+    _jit_u8(e, 0x0D); // or eax, NZ_LAZY
+    _jit_u32(e, NZ_LAZY);
+    _jit_u8(e, 0x66); // mov word [rbx + nz], ax
+    _jit_u8(e, 0x89);
+    _jit_rbx(e, X86_EAX, _jit_field(nz));
+}
+
+// cpu_get_p into ecx.
+void _jit_get_p(_JitEmitter *e) {
+    _jit_load_field(e, X86_ECX, _jit_field(p));
+    _jit_u8(e, 0x0F); // movzx eax, word [rbx + nz]
+    _jit_u8(e, 0xB7);
+    _jit_rbx(e, X86_EAX, _jit_field(nz));
+    _jit_u8(e, 0xA9); // test eax, NZ_LAZY
+    _jit_u32(e, NZ_LAZY);
+    u8 *not_lazy = _jit_jcc(e, X86_JE);
+    _jit_u8(e, 0x83); // and ecx, ~(N | Z)
+    _jit_u8(e, 0xE1);
+    _jit_u8(e, (u8) ~(STAT_N_NEGATIVE | STAT_Z_ZERO));
+    _jit_u8(e, 0x84); // test al, al
+    _jit_u8(e, 0xC0);
+    _jit_u8(e, 0x75); // jnz over the or
+    _jit_u8(e, 0x03);
+    _jit_u8(e, 0x83); // or ecx, Z
+    _jit_u8(e, 0xC9);
+    _jit_u8(e, STAT_Z_ZERO);
+    _jit_u8(e, 0xA9); // test eax, 0x8080
+    _jit_u32(e, 0x8080);
+    _jit_u8(e, 0x74); // jz over the or
+    _jit_u8(e, 0x03);
+    _jit_u8(e, 0x80); // or cl, N
+    _jit_u8(e, 0xC9);
+    _jit_u8(e, STAT_N_NEGATIVE);
+    _jit_land(e, not_lazy);
+}
+
+u32 _jit_reg(CpuRegister r) {
+    switch (r) {
+        case REG_X:
+            return _jit_field(x);
+        case REG_Y:
+            return _jit_field(y);
+        case REG_SP:
+            return _jit_field(sp);
+        case REG_P:
+            return _jit_field(p);
+        default:
+            return _jit_field(a);
+    }
+}
+
+bool _jit_banked(MemoryMap *m, memaddr addr) {
+    MemoryBlock *rb = mem_get_read_block(m, addr);
+    return rb && rb->bank;
+}
+
+// The byte behind a fixed address, as mem_read_addr/mem_write_addr would find
+// it, or NULL if nothing is mapped there. Memory-mapped I/O must go through
+// the memory map, so it's reported through io instead, and so is a bank whose
+// page the page table doesn't map straight to it.
+u8 *_jit_resolve(MemoryMap *m, memaddr addr, bool write, bool *io) {
+    *io            = mem_get_io(m, addr, write) != NULL;
+    MemoryBlock *b = write ? mem_get_write_block(m, addr) : mem_get_read_block(m, addr);
+    if (b && b->bank && !m->read_mapped[addr >> 8].base) {
+        *io = true;
+    }
+    return b ? b->values + (addr - b->range_low) : NULL;
+}
+
+// movzx reg, byte [ptr], or 0 for unmapped memory. What a bank holds changes
+// with mem_switch_bank, so reads from one go through its page table entry
+// instead of a pointer fixed at compile time.
+void _jit_read(_JitEmitter *e, MemoryMap *m, memaddr addr, u8 *ptr, u8 reg) {
+    if (!ptr) {
+        _jit_u8(e, 0x31); // xor reg, reg
+        _jit_u8(e, 0xC0 | (reg << 3) | reg);
+        return;
+    }
+    if (_jit_banked(m, addr)) {
+        _jit_mov_imm64(e, X86_EAX, (u64)(uintptr_t)&m->read_mapped[addr >> 8].base);
+        _jit_u8(e, 0x48); // mov rax, [rax]
+        _jit_u8(e, 0x8B);
+        _jit_u8(e, 0x00);
+        _jit_u8(e, 0x0F); // movzx reg, byte [rax + addr], base being biased
+        _jit_u8(e, 0xB6);
+        _jit_u8(e, 0x80 | (reg << 3));
+        _jit_u32(e, addr);
+        return;
+    }
+    _jit_mov_imm64(e, X86_EAX, (u64)(uintptr_t)ptr);
+    _jit_u8(e, 0x0F);
+    _jit_u8(e, 0xB6);
+    _jit_u8(e, reg << 3); // [rax]
+}
+
+// Stores al at ptr, marks its page dirty and tells the block cache, like
+// mem_write_addr does.
+void _jit_write(_JitEmitter *e, BlockCache *bc, memaddr addr, u8 *ptr) {
+    if (!ptr) {
+        return; // nothing mapped, the write is lost
+    }
+    _jit_mov_imm64(e, X86_ECX, (u64)(uintptr_t)ptr);
+    _jit_u8(e, 0x88); // mov [rcx], al
+    _jit_u8(e, 0x01);
+
+    _jit_mov_imm64(e, X86_ECX, (u64)(uintptr_t)&bc->memmap->dirty[addr >> 11]);
+    _jit_u8(e, 0x80); // or byte [rcx], bit
+    _jit_u8(e, 0x09);
+    _jit_u8(e, 1 << ((addr >> 8) & 7));
+
+    _jit_mov_imm64(e, X86_EAX, (u64)(uintptr_t)&bc->code_pages[addr >> 8]);
+    _jit_u8(e, 0x80); // cmp byte [rax], 0
+    _jit_u8(e, 0x38);
+    _jit_u8(e, 0x00);
+    u8 *no_code = _jit_jcc(e, X86_JE);
+    _jit_mov_imm64(e, X86_EDI, (u64)(uintptr_t)bc);
+    _jit_mov_imm32(e, X86_ESI, addr);
+    _jit_mov_imm64(e, X86_EAX, (u64)(uintptr_t)block_cache_write);
+    _jit_u8(e, 0xFF); // call rax
+    _jit_u8(e, 0xD0);
+    _jit_land(e, no_code);
+}
+
+// After a write: leave before running code it may have replaced, or code a
+// bank switch has taken away (which drops its block).
+void _jit_check_self(_JitEmitter *e, BlockCache *bc, const CachedBlock *b, memaddr next) {
+    if (_jit_banked(bc->memmap, b->pc) || _jit_banked(bc->memmap, b->end)) {
+        _jit_flush_cycles(e);
+        _jit_mov_imm64(e, X86_EAX, (u64)(uintptr_t)&b->valid);
+        _jit_u8(e, 0x80); // cmp byte [rax], 0
+        _jit_u8(e, 0x38);
+        _jit_u8(e, 0x00);
+        u8 *still_valid = _jit_jcc(e, X86_JNE);
+        _jit_exit(e, next);
+        _jit_land(e, still_valid);
+    }
+    if (!b->writable) {
+        return; // ROM
+    }
+    _jit_flush_cycles(e);
+
+    memaddr pages[2] = { b->pc >> 8, b->end >> 8 };
+    for (uint i = 0; i < 2; i++) {
+        _jit_mov_imm64(e, X86_EAX, (u64)(uintptr_t)&bc->page_versions[pages[i]]);
+        _jit_u8(e, 0x81); // cmp dword [rax], imm32
+        _jit_u8(e, 0x38);
+        _jit_u32(e, b->versions[i]);
+        u8 *unchanged = _jit_jcc(e, X86_JE);
+        _jit_exit(e, next);
+        _jit_land(e, unchanged);
+    }
+}
+
+// The ALU op of a CLASS_READ instruction on the value in eax.
+void _jit_alu(_JitEmitter *e, const DecodedInstruction *d) {
+    switch (d->alu) {
+        case ALU_LD:
+            _jit_store_field(e, X86_EAX, _jit_reg(d->reg));
+            _jit_update_nz(e);
+            break;
+        case ALU_AND:
+        case ALU_ORA:
+        case ALU_EOR:
+            _jit_u8(e, d->alu == ALU_AND ? 0x22 : d->alu == ALU_ORA ? 0x0A : 0x32); // op al, [rbx + a]
+            _jit_rbx(e, X86_EAX, _jit_field(a));
+            _jit_store_field(e, X86_EAX, _jit_field(a));
+            _jit_update_nz(e);
+            break;
+        default: // ADC, SBC, CMP, BIT
+            _jit_u8(e, 0x89); // mov edx, eax
+            _jit_u8(e, 0xC2);
+            _jit_mov_imm64(e, X86_ESI, (u64)(uintptr_t)d);
+            _jit_call(e, _cpu_alu);
+            break;
+    }
+}
+
+// CLASS_IMPLIED in AM_impl.
+void _jit_implied(_JitEmitter *e, const DecodedInstruction *d) {
+    switch (d->alu) {
+        case ALU_NONE:
+            break;
+        case ALU_CLEAR:
+        case ALU_SET:
+            _jit_u8(e, 0x80); // and/or byte [rbx + p], imm8
+            _jit_rbx(e, d->alu == ALU_SET ? 1 : 4, _jit_field(p));
+            _jit_u8(e, d->alu == ALU_SET ? d->flag : (u8)~d->flag);
+            break;
+        case ALU_LD:
+        case ALU_MOV:
+            _jit_load_field(e, X86_EAX, _jit_reg(d->src));
+            _jit_store_field(e, X86_EAX, _jit_reg(d->reg));
+            if (d->alu == ALU_LD) {
+                _jit_update_nz(e);
+            }
+            break;
+        default: // INX, DEY, ...
+            _jit_u8(e, 0xFE); // inc/dec byte [rbx + reg]
+            _jit_rbx(e, d->alu == ALU_INC ? 0 : 1, _jit_reg(d->reg));
+            _jit_load_field(e, X86_EAX, _jit_reg(d->reg));
+            _jit_update_nz(e);
+            break;
+    }
+}
+
+// Whether the instruction compiles to native code, as opposed to a call to
+// _cpu_step_execute.
+bool _jit_is_native(const DecodedInstruction *d) {
+#ifdef CPU_OPCODE_STATS
+    return false; // counted in _cpu_step_execute
+#endif
+    bool fixed = d->mode == AM_zpg || d->mode == AM_abs;
+    switch (d->access) {
+        case CLASS_READ:
+            return fixed || d->mode == AM_imm;
+        case CLASS_WRITE:
+            return fixed && d->reg != REG_ZERO;
+        case CLASS_RMW:
+            return fixed || d->mode == AM_A;
+        case CLASS_IMPLIED:
+            return d->mode == AM_impl;
+        case CLASS_BRANCH:
+            return true;
+        case CLASS_JMP:
+            return d->mode == AM_abs;
+        default:
+            return false;
+    }
+}
+
+// Compiles b into the arena. Returns NULL when there's nothing to compile: the
+// block starts with an access to a fixed MMIO address.
+JitBlockFn _jit_compile(Jit *j, const CachedBlock *b) {
+    BlockCache *bc    = j->blocks;
+    MemoryMap  *m     = bc->memmap;
+    _JitEmitter e     = { .p = j->arena + j->arena_used, .cycles = 0, .ir = 0 };
+    u8         *start = e.p;
+
+    _jit_u8(&e, 0x53); // push rbx
+    _jit_u8(&e, 0x48); // mov rbx, rdi
+    _jit_u8(&e, 0x89);
+    _jit_u8(&e, 0xFB);
+
+    memaddr pc = b->pc;
+    for (uint i = 0; i < b->n_instructions; i++) {
+        const CachedInstruction  *inst = &b->instructions[i];
+        const DecodedInstruction *d    = &DECODED_INSTRUCTIONS[inst->opcode];
+        memaddr                   next = pc + d->size;
+
+        if (!_jit_is_native(d)) {
+            _jit_flush_cycles(&e);
+            _jit_u8(&e, 0xC6); // mov byte [rbx + ir], opcode
+            _jit_rbx(&e, 0, _jit_field(ir));
+            _jit_u8(&e, inst->opcode);
+            _jit_mov_imm32(&e, X86_ESI, pc);
+            _jit_mov_imm32(&e, X86_EDX, inst->operand);
+            _jit_call(&e, _cpu_step_execute);
+            e.ir = inst->opcode;
+
+            switch (d->access) {
+                case CLASS_JMP:
+                case CLASS_JSR:
+                case CLASS_RTS:
+                case CLASS_RTI:
+                case CLASS_BRK:
+                    _jit_u8(&e, 0x5B); // pop rbx, pc is already set
+                    _jit_u8(&e, 0xC3); // ret
+                    goto done;
+                case CLASS_WRITE:
+                case CLASS_RMW:
+                case CLASS_PUSH:
+                    _jit_check_self(&e, bc, b, next);
+                    break;
+                default:
+                    break;
+            }
+            pc = next;
+            continue;
+        }
+
+        bool io       = false;
+        u8  *read_at  = NULL;
+        u8  *write_at = NULL;
+        if (d->mode == AM_zpg || d->mode == AM_abs) {
+            bool read_io  = false;
+            bool write_io = false;
+            bool writes   = d->access == CLASS_WRITE || d->access == CLASS_RMW;
+            read_at       = _jit_resolve(m, inst->operand, false, &read_io);
+            write_at      = _jit_resolve(m, inst->operand, true, &write_io);
+            // I/O may only handle one direction (mapper registers over ROM)
+            io = (read_io && d->access != CLASS_WRITE) || (write_io && writes);
+        }
+        if (io) {
+            if (i == 0) {
+                return NULL;
+            }
+            _jit_exit(&e, pc); // MMIO goes through the interpreter
+            goto done;
+        }
+
+        e.cycles += d->cycles;
+        e.ir      = inst->opcode;
+
+        switch (d->access) {
+            case CLASS_READ:
+                if (d->mode == AM_imm) {
+                    _jit_mov_imm32(&e, X86_EAX, inst->operand);
+                }
+                else {
+                    _jit_read(&e, m, inst->operand, read_at, X86_EAX);
+                }
+                _jit_alu(&e, d);
+                break;
+            case CLASS_WRITE:
+                _jit_load_field(&e, X86_EAX, _jit_reg(d->reg));
+                _jit_write(&e, bc, inst->operand, write_at);
+                _jit_check_self(&e, bc, b, next);
+                break;
+            case CLASS_RMW:
+                if (d->mode == AM_A) {
+                    _jit_load_field(&e, X86_EDX, _jit_field(a));
+                    _jit_mov_imm32(&e, X86_ESI, d->alu);
+                    _jit_call(&e, _cpu_modify);
+                    _jit_store_field(&e, X86_EAX, _jit_field(a));
+                    break;
+                }
+                _jit_read(&e, m, inst->operand, read_at, X86_EDX);
+                _jit_mov_imm32(&e, X86_ESI, d->alu);
+                _jit_call(&e, _cpu_modify);
+                _jit_write(&e, bc, inst->operand, write_at);
+                _jit_check_self(&e, bc, b, next);
+                break;
+            case CLASS_IMPLIED:
+                _jit_implied(&e, d);
+                break;
+            case CLASS_BRANCH:
+            {
+                memaddr target = next + (int8_t)inst->operand;
+                _jit_flush_cycles(&e);
+                if (d->flag & (STAT_N_NEGATIVE | STAT_Z_ZERO)) {
+                    _jit_get_p(&e);
+                    _jit_u8(&e, 0xF6); // test cl, flag
+                    _jit_u8(&e, 0xC1);
+                }
+                else {
+                    _jit_u8(&e, 0xF6); // test byte [rbx + p], flag
+                    _jit_rbx(&e, 0, _jit_field(p));
+                }
+                _jit_u8(&e, d->flag);
+                u8 *not_taken = _jit_jcc(&e, d->alu == ALU_BRANCH_SET ? X86_JE : X86_JNE);
+                e.cycles      = (next & 0xFF00) != (target & 0xFF00) ? 2 : 1;
+                _jit_exit(&e, target);
+                _jit_land(&e, not_taken);
+                _jit_exit(&e, next);
+                goto done;
+            }
+            case CLASS_JMP:
+                _jit_exit(&e, inst->operand);
+                goto done;
+            default:
+                break;
+        }
+        pc = next;
+    }
+    _jit_exit(&e, pc);
+
+done:
+    j->arena_used += e.p - start;
+    j->compiled++;
+    return (JitBlockFn)(void *)start;
+}
+
+JitBlockFn jit_get(Jit *j, CachedBlock *b) {
+    if (b->native || !j->arena || b->runs == JIT_NEVER) {
+        return (JitBlockFn)b->native;
+    }
+    if (++b->runs < JIT_HOT_RUNS) {
+        return NULL;
+    }
+
+    if (JIT_ARENA_SIZE - j->arena_used < JIT_MAX_BLOCK_CODE) {
+        jit_flush(j);
+    }
+    b->native = (void *)_jit_compile(j, b);
+    if (!b->native) {
+        b->runs = JIT_NEVER;
+    }
+    return (JitBlockFn)b->native;
+}
+
+u64 cpu_run_jit(Cpu6502 *c, Jit *j, u64 cycles) {
+    u64 cyc_start = c->cyc;
+
+    while (c->tcu != 0) {
+        cpu_pulse(c);
+    }
+
+    while (c->cyc - cyc_start < cycles) {
+        if (_cpu_interrupt_pending(c)) {
+            _cpu_step_interrupt(c);
+            continue;
+        }
+
+        // profiled, traced and watched per instruction, as native code doesn't
+        // go through the memory map
+        CachedBlock *b         = block_cache_get(j->blocks, c->pc);
+        bool         interpret = c->profile || c->trace || c->memmap->debugger;
+        JitBlockFn   native    = interpret ? NULL : jit_get(j, b);
+
+        if (native) {
+            native(c);
+            j->native_runs++;
+        }
+        else if (b->runs == JIT_NEVER) {
+            // only the MMIO access itself is interpreted, what follows is a
+            // block of its own
+            c->ir = b->instructions[0].opcode;
+            if (c->trace) {
+                _cpu_trace_store(c, c->trace, c->cyc, c->pc, c->ir, b->instructions[0].operand);
+            }
+            _cpu_step_execute(c, c->pc, b->instructions[0].operand);
+        }
+        else {
+            _cpu_run_block(c, j->blocks, b, cyc_start, cycles);
+        }
+    }
+
+    _cpu_step_end(c);
+    return c->cyc - cyc_start;
+}
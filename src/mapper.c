@@ -0,0 +1,303 @@
+#include "headers/mapper.h"
+#include "string.h"
+
+#define INES_HEADER  16
+#define INES_TRAINER 512
+#define INES_PRG     0x4000
+#define INES_CHR     0x2000
+
+bool mapper_load_ines(Mapper *mp, const char *filepath) {
+    tracef("mapper_load_ines \n");
+    memset(mp, 0, sizeof(Mapper));
+    FILE *f = fopen(filepath, "rb");
+    if (!f) {
+        return false;
+    }
+
+    u8 header[INES_HEADER];
+    if (fread(header, 1, INES_HEADER, f) != INES_HEADER
+        || header[0] != 'N' || header[1] != 'E' || header[2] != 'S' || header[3] != 0x1A
+        || header[4] == 0) {
+        fclose(f);
+        return false;
+    }
+    u8 flags6     = header[6];
+    u8 flags7     = header[7];
+    mp->id        = (flags6 >> 4) | (flags7 & 0xF0);
+    mp->mirroring = flags6 & 0x08 ? MIRROR_FOUR_SCREEN : flags6 & 0x01 ? MIRROR_VERTICAL : MIRROR_HORIZONTAL;
+    if (mp->id > MAPPER_MMC3) {
+        infof("Unsupported mapper %i in '%s'\n", mp->id, filepath);
+        fclose(f);
+        return false;
+    }
+    if (flags6 & 0x04) {
+        fseek(f, INES_TRAINER, SEEK_CUR);
+    }
+
+    mp->prg_size = header[4] * INES_PRG;
+    mp->chr_size = header[5] ? header[5] * INES_CHR : INES_CHR;
+    mp->chr_ram  = header[5] == 0;
+    mp->prg      = malloc(mp->prg_size);
+    mp->chr      = calloc(mp->chr_size, 1);
+    bool read    = mp->prg && mp->chr && fread(mp->prg, 1, mp->prg_size, f) == mp->prg_size
+                && (mp->chr_ram || fread(mp->chr, 1, mp->chr_size, f) == mp->chr_size);
+    fclose(f);
+    if (!read) {
+        mapper_free(mp);
+        return false;
+    }
+
+    mp->prg_ram.map_offset = 0x6000;
+    mp->prg_ram.size       = 0x2000;
+    mp->prg_ram.value      = calloc(mp->prg_ram.size, 1);
+    if (!mp->prg_ram.value) {
+        mapper_free(mp);
+        return false;
+    }
+
+    infof("Successfully loaded iNES '%s': mapper %i, %liKB PRG, %liKB CHR%s\n", filepath, mp->id,
+          mp->prg_size / 1024, mp->chr_size / 1024, mp->chr_ram ? " RAM" : "");
+    return true;
+}
+
+void mapper_free(Mapper *mp) {
+    free(mp->prg);
+    free(mp->chr);
+    free(mp->prg_ram.value);
+    mp->prg           = NULL;
+    mp->chr           = NULL;
+    mp->prg_ram.value = NULL;
+}
+
+// Banks are counted in MAPPER_PRG_BANK and MAPPER_CHR_BANK units and wrap
+// around what the cartridge has, as the unused high bits of a register would.
+// Negative ones count from the end.
+void _mapper_prg(Mapper *mp, uint slot, int bank) {
+    int n = mp->prg_size / MAPPER_PRG_BANK;
+    bank  = ((bank % n) + n) % n;
+    mem_switch_bank(mp->cpu->memmap, mp->prg_banks[slot], mp->prg + bank * MAPPER_PRG_BANK);
+}
+
+void _mapper_chr(Mapper *mp, uint slot, int bank) {
+    int n               = mp->chr_size / MAPPER_CHR_BANK;
+    bank                = ((bank % n) + n) % n;
+    mp->chr_banks[slot] = mp->chr + bank * MAPPER_CHR_BANK;
+}
+
+// 16KB PRG at $8000 (slot 0) or $C000 (slot 2)
+void _mapper_prg16(Mapper *mp, uint slot, int bank) {
+    _mapper_prg(mp, slot, bank * 2);
+    _mapper_prg(mp, slot + 1, bank * 2 + 1);
+}
+
+void _mapper_chr_run(Mapper *mp, uint slot, uint n, int bank) {
+    for (uint i = 0; i < n; i++) {
+        _mapper_chr(mp, slot + i, bank + i);
+    }
+}
+
+void _mapper_update_mmc1(Mapper *mp) {
+    Mmc1 *r = &mp->mmc1;
+    switch ((r->control >> 2) & 3) {
+        case 0:
+        case 1: // 32KB, ignoring the low bit
+            _mapper_prg16(mp, 0, r->prg & 0x0E);
+            _mapper_prg16(mp, 2, (r->prg & 0x0E) + 1);
+            break;
+        case 2: // first bank fixed at $8000
+            _mapper_prg16(mp, 0, 0);
+            _mapper_prg16(mp, 2, r->prg & 0x0F);
+            break;
+        default: // last bank fixed at $C000
+            _mapper_prg16(mp, 0, r->prg & 0x0F);
+            _mapper_prg16(mp, 2, -1);
+            break;
+    }
+    if (r->control & 0x10) { // two 4KB banks
+        _mapper_chr_run(mp, 0, 4, r->chr[0] * 4);
+        _mapper_chr_run(mp, 4, 4, r->chr[1] * 4);
+    }
+    else {
+        _mapper_chr_run(mp, 0, 8, (r->chr[0] & 0x1E) * 4);
+    }
+    static const Mirroring MMC1_MIRRORING[4] = {MIRROR_SINGLE_LOW, MIRROR_SINGLE_HIGH, MIRROR_VERTICAL, MIRROR_HORIZONTAL};
+    if (mp->mirroring != MIRROR_FOUR_SCREEN) {
+        mp->mirroring = MMC1_MIRRORING[r->control & 3];
+    }
+}
+
+void _mapper_update_mmc3(Mapper *mp) {
+    Mmc3 *r = &mp->mmc3;
+    if (r->bank_select & 0x40) { // R6 at $C000, second to last fixed at $8000
+        _mapper_prg(mp, 0, -2);
+        _mapper_prg(mp, 2, r->banks[6] & 0x3F);
+    }
+    else {
+        _mapper_prg(mp, 0, r->banks[6] & 0x3F);
+        _mapper_prg(mp, 2, -2);
+    }
+    _mapper_prg(mp, 1, r->banks[7] & 0x3F);
+    _mapper_prg(mp, 3, -1);
+
+    // R0 and R1 are 2KB at $0000, R2-R5 1KB at $1000, or the other way round
+    uint inverted = r->bank_select & 0x80 ? 4 : 0;
+    _mapper_chr_run(mp, 0 ^ inverted, 2, r->banks[0] & 0xFE);
+    _mapper_chr_run(mp, 2 ^ inverted, 2, r->banks[1] & 0xFE);
+    for (uint i = 0; i < 4; i++) {
+        _mapper_chr(mp, (4 + i) ^ inverted, r->banks[2 + i]);
+    }
+}
+
+// Sets every bank from the registers. Unchanged banks cost a compare.
+void _mapper_update(Mapper *mp) {
+    switch (mp->id) {
+        case MAPPER_MMC1:
+            _mapper_update_mmc1(mp);
+            break;
+        case MAPPER_UXROM:
+            _mapper_prg16(mp, 0, mp->latch);
+            _mapper_prg16(mp, 2, -1);
+            _mapper_chr_run(mp, 0, 8, 0);
+            break;
+        case MAPPER_CNROM:
+            _mapper_prg16(mp, 0, 0);
+            _mapper_prg16(mp, 2, 1); // a 16KB cartridge mirrors it
+            _mapper_chr_run(mp, 0, 8, mp->latch * 8);
+            break;
+        case MAPPER_MMC3:
+            _mapper_update_mmc3(mp);
+            break;
+        default:
+            _mapper_prg16(mp, 0, 0);
+            _mapper_prg16(mp, 2, 1);
+            _mapper_chr_run(mp, 0, 8, 0);
+            break;
+    }
+}
+
+void _mapper_write_mmc1(Mapper *mp, memaddr addr, u8 value) {
+    Mmc1 *r = &mp->mmc1;
+    if (value & 0x80) {
+        r->shift   = 0;
+        r->written = 0;
+        r->control |= 0x0C;
+        _mapper_update(mp);
+        return;
+    }
+    r->shift |= (value & 1) << r->written;
+    if (++r->written < 5) {
+        return;
+    }
+    // the fifth write's address picks the register
+    switch ((addr >> 13) & 3) {
+        case 0:
+            r->control = r->shift;
+            break;
+        case 1:
+            r->chr[0] = r->shift;
+            break;
+        case 2:
+            r->chr[1] = r->shift;
+            break;
+        default:
+            r->prg = r->shift;
+            break;
+    }
+    r->shift   = 0;
+    r->written = 0;
+    _mapper_update(mp);
+}
+
+void _mapper_write_mmc3(Mapper *mp, memaddr addr, u8 value) {
+    Mmc3 *r = &mp->mmc3;
+    switch (addr & 0xE001) {
+        case 0x8000:
+            r->bank_select = value;
+            _mapper_update(mp);
+            break;
+        case 0x8001:
+            r->banks[r->bank_select & 7] = value;
+            _mapper_update(mp);
+            break;
+        case 0xA000:
+            if (mp->mirroring != MIRROR_FOUR_SCREEN) {
+                mp->mirroring = value & 1 ? MIRROR_HORIZONTAL : MIRROR_VERTICAL;
+            }
+            break;
+        case 0xC000:
+            r->irq_latch = value;
+            break;
+        case 0xC001:
+            r->irq_counter = 0;
+            r->irq_reload  = true;
+            break;
+        case 0xE000:
+            r->irq_enabled = false;
+            cpu_set_irq(mp->cpu, false);
+            break;
+        case 0xE001:
+            r->irq_enabled = true;
+            break;
+        default: // $A001, PRG RAM protect
+            break;
+    }
+}
+
+void _mapper_write(void *ctx, memaddr addr, u8 value) {
+    Mapper *mp = ctx;
+    switch (mp->id) {
+        case MAPPER_MMC1:
+            _mapper_write_mmc1(mp, addr, value);
+            break;
+        case MAPPER_MMC3:
+            _mapper_write_mmc3(mp, addr, value);
+            break;
+        default: // UxROM and CNROM: any write sets the one register
+            mp->latch = value;
+            _mapper_update(mp);
+            break;
+    }
+}
+
+bool mapper_attach(Mapper *mp, Cpu6502 *c) {
+    MemoryMap *m = c->memmap;
+    mp->cpu      = c;
+    memset(&mp->mmc1, 0, sizeof(Mmc1));
+    memset(&mp->mmc3, 0, sizeof(Mmc3));
+    mp->latch        = 0;
+    mp->mmc1.control = 0x0C; // last bank fixed at $C000
+
+    if (m->n_read_blocks + 1 + MAPPER_PRG_SLOTS > MEM_MAP_MAX_BLOCKS || m->n_write_blocks == MEM_MAP_MAX_BLOCKS) {
+        return false;
+    }
+    mem_add_ram(m, &mp->prg_ram, "PRG RAM");
+    for (uint i = 0; i < MAPPER_PRG_SLOTS; i++) {
+        mp->prg_banks[i] = mem_add_bank(m, "PRG ROM", 0x8000 + i * MAPPER_PRG_BANK, MAPPER_PRG_BANK, mp->prg);
+    }
+    if (mp->id != MAPPER_NROM && !mem_add_io(m, 0x8000, 0xFFFF, NULL, _mapper_write, mp)) {
+        return false;
+    }
+    _mapper_update(mp);
+    return true;
+}
+
+u8 *mapper_chr(Mapper *mp, u16 addr) {
+    return mp->chr_banks[(addr >> 10) & 7] + (addr & (MAPPER_CHR_BANK - 1));
+}
+
+void mapper_scanline(Mapper *mp) {
+    if (mp->id != MAPPER_MMC3) {
+        return;
+    }
+    Mmc3 *r = &mp->mmc3;
+    if (r->irq_counter == 0 || r->irq_reload) {
+        r->irq_counter = r->irq_latch;
+        r->irq_reload  = false;
+    }
+    else {
+        r->irq_counter--;
+    }
+    if (r->irq_counter == 0 && r->irq_enabled) {
+        cpu_set_irq(mp->cpu, true);
+    }
+}
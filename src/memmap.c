@@ -1,35 +1,165 @@
 #include "headers/memmap.h"
+#include "headers/blockcache.h"
+#include "headers/debugger.h"
+#include "string.h"
+
+bool _mem_overlaps(memaddr range_low, memaddr range_high, memaddr lo, memaddr hi) {
+    return range_low <= hi && range_high >= lo;
+}
+
+bool _mem_io_handles(const MemoryIo *io, bool write) {
+    return write ? io->write != NULL : io->read != NULL;
+}
+
+// What serves a page in one direction
+MemoryPage _mem_map_page(MemoryMap *m, uint page, bool write) {
+    MemoryBlock *blocks   = write ? m->write_blocks : m->read_blocks;
+    uint         n_blocks = write ? m->n_write_blocks : m->n_read_blocks;
+    memaddr      lo       = page << 8;
+    memaddr      hi       = lo | 0xFF;
+    for (uint i = 0; i < m->n_io; i++) {
+        MemoryIo *io = m->io + i;
+        if (_mem_io_handles(io, write) && _mem_overlaps(io->range_low, io->range_high, lo, hi)) {
+            bool whole = io->range_low <= lo && io->range_high >= hi;
+            return (MemoryPage) {base: NULL, handler: whole ? MEM_PAGE_IO + i : MEM_PAGE_SCAN};
+        }
+    }
+    for (uint i = 0; i < n_blocks; i++) {
+        MemoryBlock *b = blocks + i;
+        if (_mem_overlaps(b->range_low, b->range_high, lo, hi)) {
+            if (b->range_low <= lo && b->range_high >= hi) {
+                return (MemoryPage) {base: b->values - b->range_low, handler: MEM_PAGE_OPEN};
+            }
+            return (MemoryPage) {base: NULL, handler: MEM_PAGE_SCAN};
+        }
+    }
+    return (MemoryPage) {base: NULL, handler: MEM_PAGE_OPEN};
+}
+
+// Rebuilds the page tables from scratch, so they don't depend on what the
+// MemoryMap held before the first block was added. Deltas from before don't
+// fit the new blocks, so everything is dirty again.
+void _mem_map(MemoryMap *m) {
+    for (uint page = 0; page < 0x100; page++) {
+        m->read_mapped[page]  = _mem_map_page(m, page, false);
+        m->write_mapped[page] = _mem_map_page(m, page, true);
+    }
+    mem_dirty_all(m);
+}
+
+bool _mem_dirty(MemoryMap *m, uint page) {
+    return (m->dirty[page >> 3] >> (page & 7)) & 1;
+}
+
+// Split pages already do all of it address by address.
+bool _mem_hooks_writes(MemoryMap *m, uint page) {
+    struct Debugger *d = m->debugger;
+    if (d && debugger_watches_page(d, BREAK_WRITE, page)) {
+        return true;
+    }
+    return m->write_mapped[page].base
+        && (!_mem_dirty(m, page) || (m->block_cache && m->block_cache->code_pages[page]));
+}
+
+void mem_hook_pages(MemoryMap *m, uint lo, uint hi) {
+    const MemoryPage hook = {base: NULL, handler: MEM_PAGE_HOOK};
+    struct Debugger *d    = m->debugger;
+    for (uint page = lo; page <= hi; page++) {
+        m->read_pages[page]  = d && debugger_watches_page(d, BREAK_READ, page) ? hook : m->read_mapped[page];
+        m->write_pages[page] = _mem_hooks_writes(m, page) ? hook : m->write_mapped[page];
+    }
+}
+
+// Adds the block at lo, then again every `size` bytes for as long as it fits
+// below mirror_high. Mirrors are further blocks with the same values, so the
+// page tables map them like any other.
+void _mem_add_block(MemoryBlock *blocks, uint *n_blocks, const char *name, memaddr lo, size_t size, u8 *values, u32 mirror_high) {
+    for (u32 at = lo; at + size - 1 <= mirror_high && *n_blocks < MEM_MAP_MAX_BLOCKS; at += size) {
+        blocks[*n_blocks].block_name = name;
+        blocks[*n_blocks].range_low  = at;
+        blocks[*n_blocks].range_high = (memaddr)(at + size - 1);
+        blocks[*n_blocks].values     = values;
+        blocks[*n_blocks].mirror     = at != lo;
+        blocks[*n_blocks].bank       = false;
+        (*n_blocks)++;
+    }
+}
 
 void mem_add_rom(MemoryMap *m, Rom *r, const char *name) {
     // tracef("mem_add_rom \n");
-    if (r->rom_size > 0) {
-        m->read_blocks[m->n_read_blocks].block_name = name;
-        m->read_blocks[m->n_read_blocks].range_low  = r->map_offset;
-        m->read_blocks[m->n_read_blocks].range_high = (memaddr)(r->map_offset + r->rom_size - 1);
-        m->read_blocks[m->n_read_blocks].values     = r->value;
-        m->n_read_blocks++;
-    }
+    mem_add_rom_mirrored(m, r, name, r->map_offset + r->rom_size - 1);
 }
 
 void mem_add_ram(MemoryMap *m, Ram *r, const char *name) {
     // tracef("mem_add_ram \n");
+    mem_add_ram_mirrored(m, r, name, r->map_offset + r->size - 1);
+}
+
+void mem_add_rom_mirrored(MemoryMap *m, Rom *r, const char *name, u32 mirror_high) {
+    if (r->rom_size > 0) {
+        _mem_add_block(m->read_blocks, &m->n_read_blocks, name, r->map_offset, r->rom_size, r->value, mirror_high);
+    }
+    _mem_map(m);
+}
+
+void mem_add_ram_mirrored(MemoryMap *m, Ram *r, const char *name, u32 mirror_high) {
     if (r->size > 0) {
-        m->read_blocks[m->n_read_blocks].block_name = name;
-        m->read_blocks[m->n_read_blocks].range_low  = r->map_offset;
-        m->read_blocks[m->n_read_blocks].range_high = (memaddr)(r->map_offset + r->size - 1);
-        m->read_blocks[m->n_read_blocks].values     = r->value;
-        m->n_read_blocks++;
+        _mem_add_block(m->read_blocks, &m->n_read_blocks, name, r->map_offset, r->size, r->value, mirror_high);
+        _mem_add_block(m->write_blocks, &m->n_write_blocks, name, r->map_offset, r->size, r->value, mirror_high);
+    }
+    _mem_map(m);
+}
+
+bool mem_add_io(MemoryMap *m, memaddr lo, memaddr hi, MemReadFn read_fn, MemWriteFn write_fn, void *ctx) {
+    if (m->n_io == MEM_MAP_MAX_IO) {
+        return false;
+    }
+    m->io[m->n_io] = (MemoryIo) {range_low: lo, range_high: hi, read: read_fn, write: write_fn, ctx: ctx};
+    m->n_io++;
+    _mem_map(m);
+    return true;
+}
 
-        m->write_blocks[m->n_write_blocks].block_name = name;
-        m->write_blocks[m->n_write_blocks].range_low  = r->map_offset;
-        m->write_blocks[m->n_write_blocks].range_high = (memaddr)(r->map_offset + r->size - 1);
-        m->write_blocks[m->n_write_blocks].values     = r->value;
-        m->n_write_blocks++;
+MemoryIo *mem_get_io(MemoryMap *m, memaddr addr, bool write) {
+    for (uint i = 0; i < m->n_io; i++) {
+        MemoryIo *io = m->io + i;
+        if (_mem_io_handles(io, write) && io->range_low <= addr && io->range_high >= addr) {
+            return io;
+        }
     }
+    return NULL;
 }
 
-void mem_add_ppu(MemoryMap *m, PPURegisters *p) {
-    m->_ppu = p; // :(
+int mem_add_bank(MemoryMap *m, const char *name, memaddr lo, size_t size, u8 *values) {
+    if (m->n_read_blocks == MEM_MAP_MAX_BLOCKS) {
+        return -1;
+    }
+    int bank = m->n_read_blocks;
+    _mem_add_block(m->read_blocks, &m->n_read_blocks, name, lo, size, values, lo + size - 1);
+    m->read_blocks[bank].bank = true;
+    _mem_map(m);
+    return bank;
+}
+
+void mem_switch_bank(MemoryMap *m, int bank, u8 *values) {
+    MemoryBlock *b = m->read_blocks + bank;
+    if (b->values == values) {
+        return;
+    }
+    // only the pages that went straight to the bank: anything over it (I/O,
+    // an earlier block) stays
+    u8 *old  = b->values - b->range_low;
+    u8 *base = values - b->range_low;
+    for (uint page = b->range_low >> 8; page <= (uint)(b->range_high >> 8); page++) {
+        if (m->read_mapped[page].base == old) {
+            m->read_mapped[page].base = base;
+            mem_hook_pages(m, page, page);
+        }
+    }
+    b->values = values;
+    if (m->block_cache) {
+        block_cache_invalidate(m->block_cache, b->range_low, b->range_high);
+    }
 }
 
 MemoryBlock *mem_get_read_block(MemoryMap *m, memaddr addr) {
@@ -59,43 +189,197 @@ MemoryBlock *mem_get_write_block(MemoryMap *m, memaddr addr) {
     return 0;
 }
 
-u8 mem_read_addr(MemoryMap *m, memaddr addr) {
-    // tracef("mem_read_addr \n");
+// The I/O for a handled page: its own, or whatever is at addr on a split one
+MemoryIo *_mem_page_io(MemoryMap *m, u8 handler, memaddr addr, bool write) {
+    if (handler >= MEM_PAGE_IO) {
+        return m->io + (handler - MEM_PAGE_IO);
+    }
+    return handler == MEM_PAGE_SCAN ? mem_get_io(m, addr, write) : NULL;
+}
+
+u8 _mem_read_handler(MemoryMap *m, u8 handler, memaddr addr) {
+    if (handler == MEM_PAGE_HOOK) {
+        const MemoryPage *p     = m->read_mapped + (addr >> 8);
+        u8                value = p->base ? p->base[addr] : _mem_read_handler(m, p->handler, addr);
+        if (m->debugger) {
+            debugger_on_read(m->debugger, addr, value);
+        }
+        return value;
+    }
+    MemoryIo *io = _mem_page_io(m, handler, addr, false);
+    if (io) {
+        return io->read(io->ctx, addr);
+    }
+    if (handler == MEM_PAGE_SCAN) {
+        MemoryBlock *b = mem_get_read_block(m, addr);
+        return b ? b->values[addr - b->range_low] : 0;
+    }
+    return 0;
+}
 
-    if (m->_ppu && addr >= 0x2000 && addr <= 0x3FFF) {
-        switch (addr % 0x08) {
-            case 1: return m->_ppu->mask;
-            case 2: return m->_ppu->status;
-            case 4: return m->_ppu->oam_data;
-            case 7: return m->_ppu->data;
+// A write to a block, however it got there
+void _mem_wrote(MemoryMap *m, memaddr addr) {
+    m->dirty[addr >> 11] |= 1 << ((addr >> 8) & 7);
+    if (m->block_cache) {
+        block_cache_write(m->block_cache, addr);
+    }
+}
+
+void _mem_write_handler(MemoryMap *m, u8 handler, memaddr addr, u8 value) {
+    if (handler == MEM_PAGE_HOOK) {
+        if (m->debugger) {
+            debugger_on_write(m->debugger, addr, value);
+        }
+        const MemoryPage *p     = m->write_mapped + (addr >> 8);
+        bool              clean = !_mem_dirty(m, addr >> 8);
+        if (!p->base) {
+            _mem_write_handler(m, p->handler, addr, value);
+            return;
+        }
+        p->base[addr] = value;
+        _mem_wrote(m, addr);
+        if (clean) {
+            mem_hook_pages(m, addr >> 8, addr >> 8); // it may not need the hook any more
+        }
+        return;
+    }
+    MemoryIo *io = _mem_page_io(m, handler, addr, true);
+    if (io) {
+        io->write(io->ctx, addr, value);
+        return;
+    }
+    if (handler == MEM_PAGE_SCAN) {
+        MemoryBlock *b = mem_get_write_block(m, addr);
+        if (b) {
+            b->values[addr - b->range_low] = value;
+            _mem_wrote(m, addr);
         }
-        return 0; // write-only
     }
+}
+
+// Everything that has to hear about an access is on a hooked page, so the
+// rest is just the pointer access.
+u8 mem_read_addr(MemoryMap *m, memaddr addr) {
+    // tracef("mem_read_addr \n");
 
-    MemoryBlock *b = mem_get_read_block(m, addr);
-    return b ? b->values[addr - b->range_low] : 0;
+    const MemoryPage *p = m->read_pages + (addr >> 8);
+    return p->base ? p->base[addr] : _mem_read_handler(m, p->handler, addr);
 }
 
 void mem_write_addr(MemoryMap *m, memaddr addr, u8 value) {
     // tracef("mem_write_addr \n");
 
-    if (m->_ppu && addr >= 0x2000 && addr <= 0x3FFF) {
-        switch (addr % 0x08) {
-            case 0: m->_ppu->controller = value; break;
-            case 1: m->_ppu->mask = value; break;
-            case 3: m->_ppu->oam_address = value; break;
-            case 4: m->_ppu->oam_data = value; break;
-            case 5: m->_ppu->scroll = value; break;
-            case 6: m->_ppu->address = value; break;
-            case 7: m->_ppu->data = value; break;
+    const MemoryPage *p = m->write_pages + (addr >> 8);
+    if (!p->base) {
+        _mem_write_handler(m, p->handler, addr, value);
+        return;
+    }
+    // tracef("[%04X] = %02X\n", addr, value);
+    p->base[addr] = value;
+}
+
+void mem_dirty_all(MemoryMap *m) {
+    memset(m->dirty, 0xFF, sizeof(m->dirty));
+    mem_hook_pages(m, 0, 0xFF);
+}
+
+void _mem_set_dirty(MemoryMap *m, memaddr lo, memaddr hi) {
+    for (uint page = lo >> 8; page <= (uint)(hi >> 8); page++) {
+        m->dirty[page >> 3] |= 1 << (page & 7);
+    }
+}
+
+// The block b mirrors: the one before it that isn't a mirror itself.
+MemoryBlock *_mem_mirrored(MemoryBlock *blocks, MemoryBlock *b) {
+    while (b > blocks && b->mirror) {
+        b--;
+    }
+    return b;
+}
+
+// Moves the dirty bits of mirrors' pages over to the pages they mirror.
+void _mem_fold_mirrors(MemoryMap *m) {
+    for (uint i = 0; i < m->n_write_blocks; i++) {
+        MemoryBlock *b = m->write_blocks + i;
+        if (!b->mirror) {
+            continue;
+        }
+        MemoryBlock *o = _mem_mirrored(m->write_blocks, b);
+        for (uint page = b->range_low >> 8; page <= (uint)(b->range_high >> 8); page++) {
+            if (_mem_dirty(m, page)) {
+                memaddr from = page << 8 > b->range_low ? page << 8 : b->range_low;
+                memaddr to   = (page << 8 | 0xFF) < b->range_high ? page << 8 | 0xFF : b->range_high;
+                _mem_set_dirty(m, o->range_low + (from - b->range_low), o->range_low + (to - b->range_low));
+            }
         }
-        return; // read-only
     }
+}
+
+bool mem_snapshot_delta(MemoryMap *m, MemDelta *d) {
+    _mem_fold_mirrors(m);
 
-    MemoryBlock *b = mem_get_write_block(m, addr);
-    if (b) {
-        // tracef("[%04X] = %02X\n", addr - b->range_low, value);
-        b->values[addr - b->range_low] = value;
-        // tracef("[%04X] = %02X\n", addr - b->range_low, b->values[addr - b->range_low]);
+    // sized first, so running out of memory leaves the bits for next time
+    size_t size = 0;
+    for (uint i = 0; i < m->n_write_blocks; i++) {
+        MemoryBlock *b = m->write_blocks + i;
+        for (uint page = b->range_low >> 8; !b->mirror && page <= (uint)(b->range_high >> 8); page++) {
+            if (_mem_dirty(m, page)) {
+                size += 0x100;
+            }
+        }
     }
-}
\ No newline at end of file
+    if (size > d->capacity) {
+        u8 *data = realloc(d->data, size);
+        if (!data) {
+            return false;
+        }
+        d->data     = data;
+        d->capacity = size;
+    }
+
+    d->n_pages = 0;
+    d->size    = 0;
+    for (uint i = 0; i < m->n_write_blocks; i++) {
+        MemoryBlock *b = m->write_blocks + i;
+        for (uint page = b->range_low >> 8; !b->mirror && page <= (uint)(b->range_high >> 8); page++) {
+            if (!_mem_dirty(m, page)) {
+                continue;
+            }
+            memaddr       from = page << 8 > b->range_low ? page << 8 : b->range_low;
+            memaddr       to   = (page << 8 | 0xFF) < b->range_high ? page << 8 | 0xFF : b->range_high;
+            MemDeltaPage *p    = d->pages + d->n_pages++;
+            *p                 = (MemDeltaPage) {block: i, addr: from, size: to - from + 1};
+            memcpy(d->data + d->size, b->values + (from - b->range_low), p->size);
+            d->size += p->size;
+        }
+    }
+    memset(m->dirty, 0, sizeof(m->dirty));
+    mem_hook_pages(m, 0, 0xFF);
+    return true;
+}
+
+void mem_restore_delta(MemoryMap *m, const MemDelta *d) {
+    const u8 *data = d->data;
+    for (uint i = 0; i < d->n_pages; i++) {
+        const MemDeltaPage *p = d->pages + i;
+        MemoryBlock        *b = m->write_blocks + p->block;
+        memcpy(b->values + (p->addr - b->range_low), data, p->size);
+        data += p->size;
+        _mem_set_dirty(m, p->addr, p->addr + p->size - 1);
+
+        // the page changed at its mirrors too
+        for (MemoryBlock *mb = b; m->block_cache && mb < m->write_blocks + m->n_write_blocks && (mb == b || mb->mirror); mb++) {
+            memaddr at = mb->range_low + (p->addr - b->range_low);
+            block_cache_write(m->block_cache, at);
+            block_cache_write(m->block_cache, at + p->size - 1);
+        }
+    }
+}
+
+void mem_delta_free(MemDelta *d) {
+    free(d->data);
+    d->data     = NULL;
+    d->capacity = 0;
+    d->size     = 0;
+    d->n_pages  = 0;
+}
@@ -0,0 +1,123 @@
+#include "headers/ppu.h"
+
+#define _PPU_FRAME_DOTS     (PPU_SCANLINES * PPU_DOTS_PER_SCANLINE)
+#define _PPU_VBLANK_DOT     (PPU_VBLANK_SCANLINE * PPU_DOTS_PER_SCANLINE + 1)
+#define _PPU_PRERENDER_DOT  (PPU_PRERENDER * PPU_DOTS_PER_SCANLINE + 1)
+
+#define _PPU_STATUS_SPRITE  0x60 // sprite 0 hit and overflow, cleared with vblank
+
+// Runs `dots` dots, stopping on the ones that change the status register.
+void _ppu_advance(PPURegisters *p, u64 dots) {
+    u32 pos = p->scanline * PPU_DOTS_PER_SCANLINE + p->dot;
+    while (dots > 0) {
+        u32 next = pos < _PPU_VBLANK_DOT    ? _PPU_VBLANK_DOT
+                 : pos < _PPU_PRERENDER_DOT ? _PPU_PRERENDER_DOT
+                                            : _PPU_FRAME_DOTS;
+        u32 step = dots < next - pos ? dots : next - pos;
+        pos += step;
+        dots -= step;
+
+        if (pos == _PPU_VBLANK_DOT) {
+            setflag(p->status, PPU_STATUS_VBLANK);
+        }
+        else if (pos == _PPU_PRERENDER_DOT) {
+            unsetflag(p->status, PPU_STATUS_VBLANK | _PPU_STATUS_SPRITE);
+        }
+        else if (pos == _PPU_FRAME_DOTS) {
+            pos = 0;
+            p->frame++;
+        }
+    }
+    p->scanline = pos / PPU_DOTS_PER_SCANLINE;
+    p->dot      = pos % PPU_DOTS_PER_SCANLINE;
+}
+
+void ppu_catch_up(PPURegisters *p) {
+    if (!p->cpu || p->cpu->cyc <= p->synced_cyc) {
+        return;
+    }
+    u64 dots      = (p->cpu->cyc - p->synced_cyc) * PPU_DOTS_PER_CYCLE;
+    p->synced_cyc = p->cpu->cyc;
+    p->catch_ups++;
+    _ppu_advance(p, dots);
+}
+
+void _ppu_vblank(Scheduler *s, u64 cyc, void *ctx);
+
+// The first CPU cycle by which the PPU will have started the next vblank
+void _ppu_schedule_vblank(PPURegisters *p, Scheduler *s) {
+    u32 pos  = p->scanline * PPU_DOTS_PER_SCANLINE + p->dot;
+    u32 dots = pos < _PPU_VBLANK_DOT ? _PPU_VBLANK_DOT - pos : _PPU_FRAME_DOTS - pos + _PPU_VBLANK_DOT;
+    scheduler_add(s, p->synced_cyc + (dots + PPU_DOTS_PER_CYCLE - 1) / PPU_DOTS_PER_CYCLE, _ppu_vblank, p);
+}
+
+void _ppu_vblank(Scheduler *s, u64 cyc, void *ctx) {
+    PPURegisters *p = ctx;
+    ppu_catch_up(p);
+    if ((p->controller & PPU_CTRL_NMI) && (p->status & PPU_STATUS_VBLANK)) {
+        cpu_nmi(p->cpu);
+    }
+    _ppu_schedule_vblank(p, s);
+}
+
+void ppu_attach(PPURegisters *p, Cpu6502 *c, Scheduler *s) {
+    p->cpu        = c;
+    p->synced_cyc = c->cyc;
+    p->scanline   = 0;
+    p->dot        = 0;
+    p->frame      = 0;
+    p->catch_ups  = 0;
+    scheduler_cancel(s, _ppu_vblank, p);
+    _ppu_schedule_vblank(p, s);
+}
+
+u8 _ppu_io_read(void *ctx, memaddr addr) {
+    return ppu_read(ctx, addr);
+}
+
+void _ppu_io_write(void *ctx, memaddr addr, u8 value) {
+    ppu_write(ctx, addr, value);
+}
+
+void mem_add_ppu(MemoryMap *m, PPURegisters *p) {
+    mem_add_io(m, 0x2000, 0x3FFF, _ppu_io_read, _ppu_io_write, p);
+    p->cpu = NULL;
+}
+
+u8 ppu_read(PPURegisters *p, memaddr addr) {
+    ppu_catch_up(p);
+    switch (addr % 0x08) {
+        case 1: return p->mask;
+        case 2:
+        {
+            u8 status = p->status;
+            if (p->cpu) {
+                unsetflag(p->status, PPU_STATUS_VBLANK); // reading acknowledges vblank
+            }
+            return status;
+        }
+        case 4: return p->oam_data;
+        case 7: return p->data;
+    }
+    return 0; // write-only
+}
+
+void ppu_write(PPURegisters *p, memaddr addr, u8 value) {
+    ppu_catch_up(p);
+    switch (addr % 0x08) {
+        case 0:
+            // turning NMIs on during vblank raises one straight away
+            if (p->cpu && !(p->controller & PPU_CTRL_NMI) && (value & PPU_CTRL_NMI) && (p->status & PPU_STATUS_VBLANK)) {
+                cpu_nmi(p->cpu);
+            }
+            p->controller = value;
+            break;
+        case 1: p->mask = value; break;
+        case 3: p->oam_address = value; break;
+        case 4: p->oam_data = value; break;
+        case 5: p->scroll = value; break;
+        case 6: p->address = value; break;
+        case 7: p->data = value; break;
+    }
+    // read-only
+}
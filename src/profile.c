@@ -78,6 +78,44 @@ void init_profiler() {
     _profilerStart = __rdtscp(&ui);
 }
 
+// -2 for the last comma+newline
+void _profiler_write_list(FILE *fd, const char *list, size_t size) {
+    if (size >= 2) {
+        fwrite(list, sizeof(char), size - 2, fd);
+        fprintf(fd, "\n");
+    }
+}
+
+void write_speedscope(FILE *fd, const char *name, const char *unit, unsigned long start, unsigned long end,
+                      const char *frames, size_t frames_size, const char *events, size_t events_size,
+                      const char *extra) {
+    fprintf(fd, "{\n");
+    fprintf(fd, "  \"version\": \"0.0.1\",\n");
+    fprintf(fd, "  \"$schema\": \"https://www.speedscope.app/file-format-schema.json\",\n");
+    fprintf(fd, "  \"shared\": {\n");
+    fprintf(fd, "    \"frames\": [\n");
+    _profiler_write_list(fd, frames, frames_size);
+    fprintf(fd, "    ]\n");
+    fprintf(fd, "  },\n");
+    fprintf(fd, "  \"profiles\": [\n");
+    fprintf(fd, "    {\n");
+    fprintf(fd, "      \"type\": \"evented\",\n");
+    fprintf(fd, "      \"name\": \"%s\",\n", name);
+    fprintf(fd, "      \"unit\": \"%s\",\n", unit);
+    fprintf(fd, "      \"startValue\":     %lu,\n", start);
+    fprintf(fd, "      \"endValue\":       %lu,\n", end);
+    if (extra) {
+        fprintf(fd, "%s", extra);
+    }
+
+    fprintf(fd, "      \"events\": [\n");
+    _profiler_write_list(fd, events, events_size);
+    fprintf(fd, "      ]\n");
+    fprintf(fd, "    }\n");
+    fprintf(fd, "  ]\n");
+    fprintf(fd, "}");
+}
+
 void end_profiler(const char *file_name) {
     if (_profilerEvents)
     {
@@ -123,34 +161,14 @@ void end_profiler(const char *file_name) {
             fprintf(fd, "]");
             fprintf(fd, "}");
 #else
-            fprintf(fd, "{\n");
-            fprintf(fd, "  \"version\": \"0.0.1\",\n");
-            fprintf(fd, "  \"$schema\": \"https://www.speedscope.app/file-format-schema.json\",\n");
-            fprintf(fd, "  \"shared\": {\n");
-            fprintf(fd, "    \"frames\": [\n");
-            fwrite(_profilerFramesB, sizeof(char), _profilerFramesS-2, fd);// -2 for comma+newline
-            fprintf(fd, "\n");
-            fprintf(fd, "    ]\n");
-            fprintf(fd, "  },\n");
-            fprintf(fd, "  \"profiles\": [\n");
-            fprintf(fd, "    {\n");
-            fprintf(fd, "      \"type\": \"evented\",\n");
-            fprintf(fd, "      \"name\": \"simple.txt\",\n");
-            fprintf(fd, "      \"unit\": \"none\",\n");
-            fprintf(fd, "      \"startValue\":     %lu,\n", _profilerStart);
-            fprintf(fd, "      \"endValue\":       %lu,\n", profilerEnd);
-            // debug fields not used by speedscope:
-            fprintf(fd, "      \"ticksPerSecond\": %lu,\n", _apprxHz);
-            fprintf(fd, "      \"totalTicks\":     %lu,\n", (profilerEnd - _profilerStart));
-            fprintf(fd, "      \"totalMs\":        %lu,\n", (profilerEnd - _profilerStart) / (_apprxHz / 1000));
-
-            fprintf(fd, "      \"events\": [\n");
-            fwrite(_profilerEventsB, sizeof(char), _profilerEventsS-2, fd);// -2 for comma+newline
-            fprintf(fd, "\n");
-            fprintf(fd, "      ]\n");
-            fprintf(fd, "    }\n");
-            fprintf(fd, "  ]\n");
-            fprintf(fd, "}");
+            char extra[256]; // debug fields not used by speedscope:
+            snprintf(extra, sizeof(extra),
+                     "      \"ticksPerSecond\": %lu,\n"
+                     "      \"totalTicks\":     %lu,\n"
+                     "      \"totalMs\":        %lu,\n",
+                     _apprxHz, (profilerEnd - _profilerStart), (profilerEnd - _profilerStart) / (_apprxHz / 1000));
+            write_speedscope(fd, "simple.txt", "none", _profilerStart, profilerEnd,
+                             _profilerFramesB, _profilerFramesS, _profilerEventsB, _profilerEventsS, extra);
 #endif
 
             fflush(fd);
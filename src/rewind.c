@@ -0,0 +1,193 @@
+#include "headers/rewind.h"
+#include "headers/blockcache.h"
+#include "headers/guestprofile.h"
+#include "string.h"
+
+void _rewind_take(Rewind *r) {
+    Cpu6502        *c = r->cpu;
+    MemoryMap      *m = c->memmap;
+    RewindSnapshot *s = r->snapshots + r->head;
+
+    s->cyc = c->cyc;
+    cpu_save_state(c, &s->cpu);
+    u8 *ram = s->ram;
+    for (uint i = 0; i < m->n_write_blocks; i++) {
+        MemoryBlock *b    = m->write_blocks + i;
+        size_t       size = b->range_high - b->range_low + 1;
+        if (b->mirror) {
+            continue;
+        }
+        memcpy(ram, b->values, size);
+        ram += size;
+    }
+    for (uint i = 0; i < r->n_states; i++) {
+        memcpy(ram, r->states[i].state, r->states[i].size);
+        ram += r->states[i].size;
+    }
+
+    r->head = (r->head + 1) % REWIND_MAX_SNAPSHOTS;
+    if (r->n < REWIND_MAX_SNAPSHOTS) {
+        r->n++;
+    }
+    r->next = c->cyc + r->interval;
+}
+
+// (Re)allocates the ring for the current blocks and states and starts it over.
+bool _rewind_alloc(Rewind *r) {
+    MemoryMap *m = r->cpu->memmap;
+    r->ram_size  = 0;
+    for (uint i = 0; i < m->n_write_blocks; i++) {
+        MemoryBlock *b = m->write_blocks + i;
+        r->ram_size += b->mirror ? 0 : b->range_high - b->range_low + 1;
+    }
+    for (uint i = 0; i < r->n_states; i++) {
+        r->ram_size += r->states[i].size;
+    }
+
+    free(r->ram);
+    r->ram  = malloc(REWIND_MAX_SNAPSHOTS * r->ram_size + 1);
+    r->head = 0;
+    r->n    = 0;
+    if (!r->ram) {
+        return false;
+    }
+    for (uint i = 0; i < REWIND_MAX_SNAPSHOTS; i++) {
+        r->snapshots[i].ram = r->ram + i * r->ram_size;
+    }
+    _rewind_take(r);
+    return true;
+}
+
+bool rewind_init(Rewind *r, Cpu6502 *c, u64 interval) {
+    memset(r, 0, sizeof(Rewind));
+    r->cpu      = c;
+    r->interval = interval;
+    return _rewind_alloc(r);
+}
+
+bool rewind_add_state(Rewind *r, void *state, size_t size) {
+    if (r->n_states == REWIND_MAX_STATES) {
+        return false;
+    }
+    r->states[r->n_states] = (RewindState) {state: state, size: size};
+    r->n_states++;
+    return _rewind_alloc(r);
+}
+
+void rewind_free(Rewind *r) {
+    free(r->ram);
+    r->ram = NULL;
+    r->n   = 0;
+}
+
+void rewind_poll(Rewind *r) {
+    if (r->cpu->cyc >= r->next) {
+        _rewind_take(r);
+    }
+}
+
+// i-th newest
+RewindSnapshot *_rewind_snapshot(Rewind *r, uint i) {
+    return r->snapshots + (r->head + REWIND_MAX_SNAPSHOTS - 1 - i) % REWIND_MAX_SNAPSHOTS;
+}
+
+// Restores s and runs `cycles` from it, with until as the stop callback (NULL
+// for none). Unlike with cpu_run_until, until is also called on the snapshot
+// itself if that's at a boundary.
+void _rewind_replay(Rewind *r, RewindSnapshot *s, u64 cycles, CpuStopCallback until, void *ctx) {
+    Cpu6502         *c        = r->cpu;
+    MemoryMap       *m        = c->memmap;
+    GuestProfile    *profile  = c->profile;
+    CpuTrace        *trace    = c->trace;
+    struct Debugger *debugger = m->debugger;
+    c->profile                = NULL;
+    c->trace                  = NULL;
+    m->debugger               = NULL;
+
+    cpu_load_state(c, &s->cpu);
+    u8 *ram = s->ram;
+    for (uint i = 0; i < m->n_write_blocks; i++) {
+        MemoryBlock *b    = m->write_blocks + i;
+        size_t       size = b->range_high - b->range_low + 1;
+        if (b->mirror) {
+            continue;
+        }
+        memcpy(b->values, ram, size);
+        ram += size;
+    }
+    for (uint i = 0; i < r->n_states; i++) {
+        memcpy(r->states[i].state, ram, r->states[i].size);
+        ram += r->states[i].size;
+    }
+    if (m->block_cache) {
+        block_cache_flush(m->block_cache);
+    }
+    mem_dirty_all(m);
+
+    if (!until || !(c->tcu == 0 && until(c, ctx))) {
+        cpu_run_until(c, until, ctx, cycles);
+    }
+
+    m->debugger = debugger;
+    mem_hook_pages(m, 0, 0xFF); // the watched pages were recomputed without it
+    guest_profile_attach(c, profile);
+    c->trace = trace;
+}
+
+bool rewind_to(Rewind *r, u64 cyc) {
+    if (cyc > r->cpu->cyc) {
+        return false;
+    }
+    for (uint i = 0; i < r->n; i++) {
+        RewindSnapshot *s = _rewind_snapshot(r, i);
+        if (s->cyc <= cyc) {
+            r->head = (s - r->snapshots + 1) % REWIND_MAX_SNAPSHOTS;
+            r->n -= i;
+            r->next = s->cyc + r->interval;
+            _rewind_replay(r, s, cyc - s->cyc, NULL, NULL);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool rewind_cycle(Rewind *r) {
+    return r->cpu->cyc > 0 && rewind_to(r, r->cpu->cyc - 1);
+}
+
+typedef struct {
+    u64  before; // boundaries from here on don't count
+    u64  last;
+    bool found;
+} _RewindBoundary;
+
+bool _rewind_boundary(Cpu6502 *c, void *ctx) {
+    _RewindBoundary *b = ctx;
+    if (c->cyc < b->before) {
+        b->last  = c->cyc;
+        b->found = true;
+    }
+    return false;
+}
+
+bool rewind_instruction(Rewind *r) {
+    u64 now = r->cpu->cyc;
+
+    // boundaries only show up by replaying, so replay from each snapshot back
+    // until one has a boundary between it and now
+    for (uint i = 0; i < r->n; i++) {
+        RewindSnapshot *s = _rewind_snapshot(r, i);
+        if (s->cyc >= now) {
+            continue;
+        }
+        _RewindBoundary b = {before: now, last: 0, found: false};
+        _rewind_replay(r, s, now - s->cyc, _rewind_boundary, &b);
+        if (b.found) {
+            return rewind_to(r, b.last);
+        }
+    }
+
+    // none: put the CPU back where it was
+    rewind_to(r, now);
+    return false;
+}
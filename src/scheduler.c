@@ -0,0 +1,104 @@
+#include "headers/scheduler.h"
+#include "string.h"
+
+void scheduler_init(Scheduler *s, Cpu6502 *c) {
+    memset(s, 0, sizeof(Scheduler));
+    s->cpu = c;
+}
+
+bool _scheduler_before(const ScheduledEvent *a, const ScheduledEvent *b) {
+    return a->cyc < b->cyc || (a->cyc == b->cyc && a->seq < b->seq);
+}
+
+void _scheduler_swap(Scheduler *s, uint i, uint j) {
+    ScheduledEvent t = s->events[i];
+    s->events[i]     = s->events[j];
+    s->events[j]     = t;
+}
+
+void _scheduler_sift_up(Scheduler *s, uint i) {
+    while (i > 0 && _scheduler_before(&s->events[i], &s->events[(i - 1) / 2])) {
+        _scheduler_swap(s, i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+}
+
+void _scheduler_sift_down(Scheduler *s, uint i) {
+    for (;;) {
+        uint first = i;
+        uint l     = 2 * i + 1;
+        uint r     = 2 * i + 2;
+        if (l < s->n_events && _scheduler_before(&s->events[l], &s->events[first])) {
+            first = l;
+        }
+        if (r < s->n_events && _scheduler_before(&s->events[r], &s->events[first])) {
+            first = r;
+        }
+        if (first == i) {
+            return;
+        }
+        _scheduler_swap(s, i, first);
+        i = first;
+    }
+}
+
+void _scheduler_remove(Scheduler *s, uint i) {
+    s->n_events--;
+    if (i == s->n_events) {
+        return;
+    }
+    s->events[i] = s->events[s->n_events];
+    _scheduler_sift_up(s, i);
+    _scheduler_sift_down(s, i);
+}
+
+bool scheduler_add(Scheduler *s, u64 cyc, EventFn fn, void *ctx) {
+    if (s->n_events == SCHEDULER_MAX_EVENTS) {
+        return false;
+    }
+    s->events[s->n_events] = (ScheduledEvent) {cyc: cyc, seq: s->n_scheduled++, fn: fn, ctx: ctx};
+    s->n_events++;
+    _scheduler_sift_up(s, s->n_events - 1);
+    return true;
+}
+
+uint scheduler_cancel(Scheduler *s, EventFn fn, void *ctx) {
+    uint n = 0;
+    for (uint i = 0; i < s->n_events;) {
+        if (s->events[i].fn == fn && s->events[i].ctx == ctx) {
+            _scheduler_remove(s, i);
+            n++;
+            i = 0; // the heap was reshuffled
+        }
+        else {
+            i++;
+        }
+    }
+    return n;
+}
+
+u64 scheduler_next(Scheduler *s) {
+    return s->n_events > 0 ? s->events[0].cyc : UINT64_MAX;
+}
+
+void scheduler_run_due(Scheduler *s) {
+    while (s->n_events > 0 && s->events[0].cyc <= s->cpu->cyc) {
+        ScheduledEvent e = s->events[0];
+        _scheduler_remove(s, 0);
+        e.fn(s, e.cyc, e.ctx);
+    }
+}
+
+u64 scheduler_run(Scheduler *s, u64 cycles) {
+    Cpu6502 *c         = s->cpu;
+    u64      cyc_start = c->cyc;
+    u64      end       = c->cyc + cycles;
+
+    scheduler_run_due(s);
+    while (c->cyc < end) {
+        u64 until = scheduler_next(s) < end ? scheduler_next(s) : end;
+        cpu_run_cycles(c, until - c->cyc);
+        scheduler_run_due(s);
+    }
+    return c->cyc - cyc_start;
+}